@@ -91,6 +91,27 @@ flush_block(void *addr)
         panic("flush block failed, addr:%08x\n", addr);
 }
 
+// Give the block containing VA a page of its own before it is written.
+// serve_read_pages lends block cache pages out, and a borrower (ns,
+// with the page queued on a connection) must never see them change:
+// if the page is mapped anywhere else, map a copy in its place.  The
+// copy is clean; the write that follows dirties it.
+void
+bc_unshare(void *addr)
+{
+	void *va = ROUNDDOWN(addr, PGSIZE);
+	int r;
+
+	if (!va_is_mapped(va) || pageref(va) <= 1)
+		return;
+	if ((r = sys_page_alloc(0, (void *) UNSHAREVA, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("bc_unshare: %e", r);
+	memmove((void *) UNSHAREVA, va, PGSIZE);
+	if ((r = sys_page_map(0, (void *) UNSHAREVA, 0, va, PTE_P|PTE_U|PTE_W)) < 0)
+		panic("bc_unshare: %e", r);
+	sys_page_unmap(0, (void *) UNSHAREVA);
+}
+
 // Test that the block cache works, by smashing the superblock and
 // reading it back.
 static void
@@ -3,6 +3,14 @@
 
 #include "fs.h"
 
+static int file_uninline(struct File *f);
+static void file_touch(struct File *f);
+
+// Versions are handed out from memory.  The super block holds a bound
+// on them, raised VERSION_BATCH at a time.
+#define VERSION_BATCH	1024
+static uint32_t fs_version;
+
 // --------------------------------------------------------------
 // Super block
 // --------------------------------------------------------------
@@ -44,11 +52,13 @@ free_block(uint32_t blockno)
 	if (blockno == 0)
 		panic("attempt to free zero block");
 	bitmap[blockno/32] |= 1<<(blockno%32);
+	journal_note(&bitmap[blockno/32]);
+	journal_free(blockno);
 }
 
 // Search the bitmap for a free block and allocate it.  When you
-// allocate a block, immediately flush the changed bitmap block
-// to disk.
+// allocate a block, log the changed bitmap block in the journal.
+// Blocks freed since the last journal checkpoint are passed over.
 //
 // Return block number allocated on success,
 // -E_NO_DISK if we are out of blocks.
@@ -62,11 +72,12 @@ alloc_block(void)
 	// super->s_nblocks blocks in the disk altogether.
 
     for(int i = 1;i < super -> s_nblocks;i++)
-        if(bitmap[i/32] & (1 << (i%32))){
+        if((bitmap[i/32] & (1 << (i%32))) && !journal_freed(i)){
             bitmap[i/32] &= ~(1 << (i%32));
-            flush_block(diskaddr(2 + i/(8*BLKSIZE)));
+            journal_note(&bitmap[i/32]);
             return i;
         }
+	journal_reclaim();
 	return -E_NO_DISK;
 }
 
@@ -113,6 +124,10 @@ fs_init(void)
 	super = diskaddr(1);
 	check_super();
 
+	// Replay metadata updates a crash left in the journal.
+	journal_init();
+	fs_version = super->s_version;
+
 	// Set "bitmap" to the beginning of the first bitmap block.
 	bitmap = diskaddr(2);
 	check_bitmap();
@@ -151,7 +166,10 @@ file_block_walk(struct File *f, uint32_t filebno, uint32_t **ppdiskbno, bool all
             if(block < 0)
                 return -E_NO_DISK;
             f -> f_indirect = block;
+            bc_unshare(diskaddr(block));
             memset(diskaddr(block), 0, BLKSIZE);
+            journal_note(f);
+            journal_note(diskaddr(block));
         }
         *ppdiskbno = (uint32_t*)diskaddr(f -> f_indirect) + filebno;
         return 0;
@@ -171,7 +189,14 @@ int
 file_get_block(struct File *f, uint32_t filebno, char **blk)
 {
     uint32_t* blkno;
-    int result = file_block_walk(f, filebno, &blkno, 1);
+    int result;
+    if(f -> f_flags & FFLAG_INLINE){
+        //caller wants blocks; give the file real ones
+        result = file_uninline(f);
+        if(result < 0)
+            return result;
+    }
+    result = file_block_walk(f, filebno, &blkno, 1);
     if(result < 0)
         return result;
     if(*blkno){
@@ -183,6 +208,9 @@ file_get_block(struct File *f, uint32_t filebno, char **blk)
     if(result < 0)
         return -E_NO_DISK;
     *blkno = result;
+    journal_note(blkno);
+    // The page may still be lent out with the block's old contents.
+    bc_unshare(diskaddr(result));
     *blk = (char*)diskaddr(result);
     return 0;
 }
@@ -240,6 +268,7 @@ dir_alloc_file(struct File *dir, struct File **file)
 			}
 	}
 	dir->f_size += BLKSIZE;
+	journal_note(dir);
 	if ((r = file_get_block(dir, i, &blk)) < 0)
 		return r;
 	f = (struct File*) blk;
@@ -332,7 +361,9 @@ file_create(const char *path, struct File **pf)
 	if ((r = dir_alloc_file(dir, &f)) < 0)
 		return r;
 
+	memset(f, 0, sizeof(*f));
 	strcpy(f->f_name, name);
+	file_touch(f);
 	*pf = f;
 	file_flush(dir);
 	return 0;
@@ -361,6 +392,11 @@ file_read(struct File *f, void *buf, size_t count, off_t offset)
 
 	count = MIN(count, f->f_size - offset);
 
+	if (f->f_flags & FFLAG_INLINE) {
+		memmove(buf, f->f_inline + offset, count);
+		return count;
+	}
+
 	for (pos = offset; pos < offset + count; ) {
 		if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
 			return r;
@@ -390,14 +426,22 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 		if ((r = file_set_size(f, offset + count)) < 0)
 			return r;
 
+	if (f->f_flags & FFLAG_INLINE) {
+		memmove(f->f_inline + offset, buf, count);
+		file_touch(f);
+		return count;
+	}
+
 	for (pos = offset; pos < offset + count; ) {
 		if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
 			return r;
 		bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
+		bc_unshare(blk);
 		memmove(blk + pos % BLKSIZE, buf, bn);
 		pos += bn;
 		buf += bn;
 	}
+	file_touch(f);
 
 	return count;
 }
@@ -415,6 +459,7 @@ file_free_block(struct File *f, uint32_t filebno)
 	if (*ptr) {
 		free_block(*ptr);
 		*ptr = 0;
+		journal_note(ptr);
 	}
 	return 0;
 }
@@ -443,48 +488,112 @@ file_truncate_blocks(struct File *f, off_t newsize)
 	if (new_nblocks <= NDIRECT && f->f_indirect) {
 		free_block(f->f_indirect);
 		f->f_indirect = 0;
+		journal_note(f);
 	}
 }
 
+// Move the contents of an inline file out into a block of its own,
+// so it can grow past FINLINE_MAX or be accessed by block.
+static int
+file_uninline(struct File *f)
+{
+	uint8_t data[FINLINE_MAX];
+	char *blk;
+	int r;
+
+	memmove(data, f->f_inline, FINLINE_MAX);
+	memset(f->f_inline, 0, FINLINE_MAX);
+	f->f_flags &= ~FFLAG_INLINE;
+	if ((r = file_get_block(f, 0, &blk)) < 0) {
+		memmove(f->f_inline, data, FINLINE_MAX);
+		f->f_flags |= FFLAG_INLINE;
+		return r;
+	}
+	memset(blk, 0, BLKSIZE);
+	memmove(blk, data, f->f_size);
+	journal_note(f);
+	return 0;
+}
+
 // Set the size of file f, truncating or extending as necessary.
+// An empty regular file that grows to at most FINLINE_MAX bytes keeps
+// its data inline; an inline file that grows past that gets a block.
 int
 file_set_size(struct File *f, off_t newsize)
 {
-	if (f->f_size > newsize)
+	int r;
+
+	if ((f->f_flags & FFLAG_INLINE) && newsize > FINLINE_MAX)
+		if ((r = file_uninline(f)) < 0)
+			return r;
+
+	if (f->f_flags & FFLAG_INLINE) {
+		if (f->f_size > newsize)
+			memset(f->f_inline + newsize, 0, f->f_size - newsize);
+		if (newsize == 0)
+			f->f_flags &= ~FFLAG_INLINE;
+	} else if (f->f_size == 0 && newsize > 0 && newsize <= FINLINE_MAX
+		   && f->f_type == FTYPE_REG) {
+		memset(f->f_inline, 0, FINLINE_MAX);
+		f->f_flags |= FFLAG_INLINE;
+	} else if (f->f_size > newsize)
 		file_truncate_blocks(f, newsize);
 	f->f_size = newsize;
-	flush_block(f);
+	file_touch(f);
 	return 0;
 }
 
+// Give f a new version, after its contents changed, and note f.  A file
+// removed and created again does not get the version it had, even after
+// a reboot: f is logged in the same transaction as the raised bound, or
+// a later one, so no version above the bound on disk ever survives a
+// crash.  Only the first change of each batch writes the super block.
+static void
+file_touch(struct File *f)
+{
+	if (fs_version == super->s_version) {
+		super->s_version += VERSION_BATCH;
+		journal_note(super);
+	}
+	f->f_version = ++fs_version;
+	journal_note(f);
+}
+
 // Flush the contents and metadata of file f out to disk.
 // Loop over all the blocks in file.
 // Translate the file block number into a disk block number
 // and then check whether that disk block is dirty.  If so, write it out.
+// Blocks held by the running transaction (directory blocks, say) and
+// the file's own metadata reach the disk through the journal commit.
 void
 file_flush(struct File *f)
 {
 	int i;
 	uint32_t *pdiskbno;
 
-	for (i = 0; i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
+	// Inline data lives in the directory block, which the commit covers.
+	for (i = 0; !(f->f_flags & FFLAG_INLINE) &&
+		    i < (f->f_size + BLKSIZE - 1) / BLKSIZE; i++) {
 		if (file_block_walk(f, i, &pdiskbno, 0) < 0 ||
-		    pdiskbno == NULL || *pdiskbno == 0)
+		    pdiskbno == NULL || *pdiskbno == 0 ||
+		    journal_holds(*pdiskbno))
 			continue;
 		flush_block(diskaddr(*pdiskbno));
 	}
-	flush_block(f);
-	if (f->f_indirect)
-		flush_block(diskaddr(f->f_indirect));
+	journal_commit();
 }
 
 
 // Sync the entire file system.  A big hammer.
+// Data blocks are written in place first, then the metadata that
+// points at them is appended to the journal.
 void
 fs_sync(void)
 {
 	int i;
 	for (i = 1; i < super->s_nblocks; i++)
-		flush_block(diskaddr(i));
+		if (!journal_holds(i))
+			flush_block(diskaddr(i));
+	journal_commit();
 }
 
@@ -11,6 +11,9 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE	0xC0000000
 
+/* Scratch page for bc_unshare, below serve()'s request and lend pages */
+#define UNSHAREVA	0x0fffd000
+
 extern struct Super *super;		// superblock
 extern uint32_t *bitmap;		// bitmap blocks mapped in memory
 
@@ -26,6 +29,7 @@ void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
 void	flush_block(void *addr);
+void	bc_unshare(void *addr);
 void	bc_init(void);
 
 /* fs.c */
@@ -40,9 +44,21 @@ void	file_flush(struct File *f);
 int	file_remove(const char *path);
 void	fs_sync(void);
 
+/* journal.c */
+void	journal_init(void);
+void	journal_note(void *addr);
+bool	journal_holds(uint32_t blockno);
+void	journal_commit(void);
+void	journal_boundary(void);
+void	journal_free(uint32_t blockno);
+bool	journal_freed(uint32_t blockno);
+void	journal_reclaim(void);
+void	journal_checkpoint(void);
+
 /* int	map_block(uint32_t); */
 bool	block_is_free(uint32_t blockno);
 int	alloc_block(void);
+void	free_block(uint32_t blockno);
 
 /* test.c */
 void	fs_test(void);
@@ -1,5 +1,10 @@
 /*
  * JOS file system format
+ *
+ * With -i, an existing image is updated in place: files whose size and
+ * mtime (or, failing that, content hash) match the manifest written by
+ * the previous run keep their blocks, and only changed files are copied.
+ * With -j N, file contents are copied by N host threads.
  */
 
 // We don't actually want to define off_t!
@@ -9,6 +14,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,6 +39,9 @@ typedef int bool;
 
 #define ROUNDUP(n, v) ((n) - 1 + (v) - ((n) - 1) % (v))
 #define MAX_DIR_ENTS 128
+#define MAX_THREADS 64
+
+#define MANIFEST_MAGIC "fsformat-manifest 1"
 
 struct Dir
 {
@@ -41,11 +50,38 @@ struct Dir
 	int n;
 };
 
+// One file on the image, as recorded in the manifest.
+struct Ment
+{
+	char name[MAXNAMELEN];
+	uint64_t size;
+	int64_t mtime_sec;
+	long mtime_nsec;
+	uint64_t hash;
+	uint32_t start;		// first block of the file's extent
+	uint32_t nblk;		// blocks in the extent, indirect block included
+};
+
+// A file whose contents must be copied into the image.
+struct Job
+{
+	const char *path;
+	struct Ment *m;
+};
+
 uint32_t nblocks;
 char *diskmap, *diskpos;
 struct Super *super;
 uint32_t *bitmap;
 
+bool incremental;
+struct Ment *oldman, *newman;
+int noldman, nnewman;
+bool *oldused;
+struct Job *jobs;
+int njobs, nextjob;
+pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+
 void
 panic(const char *fmt, ...)
 {
@@ -72,6 +108,35 @@ readn(int f, void *out, size_t n)
 	}
 }
 
+uint64_t
+fnv1a(uint64_t h, const void *buf, size_t n)
+{
+	const unsigned char *p = buf;
+	while (n--)
+		h = (h ^ *p++) * 0x100000001b3ULL;
+	return h;
+}
+
+#define FNV_BASIS 0xcbf29ce484222325ULL
+
+uint64_t
+hashfile(const char *name, size_t size)
+{
+	int fd;
+	char *buf;
+	uint64_t h;
+
+	if ((fd = open(name, O_RDONLY)) < 0)
+		panic("open %s: %s", name, strerror(errno));
+	if ((buf = malloc(size + 1)) == NULL)
+		panic("out of memory hashing %s", name);
+	readn(fd, buf, size);
+	h = fnv1a(FNV_BASIS, buf, size);
+	free(buf);
+	close(fd);
+	return h;
+}
+
 uint32_t
 blockof(void *pos)
 {
@@ -88,6 +153,42 @@ alloc(uint32_t bytes)
 	return start;
 }
 
+// Allocate n contiguous blocks.  A fresh image grows from diskpos;
+// an incremental one takes the first free run in the bitmap.
+uint32_t
+alloc_blocks(uint32_t n)
+{
+	uint32_t b, run;
+
+	if (n == 0)
+		return 0;
+	if (!incremental)
+		return blockof(alloc(n * BLKSIZE));
+
+	for (b = 0, run = 0; b < nblocks; b++) {
+		if (!(bitmap[b/32] & (1<<(b%32)))) {
+			run = 0;
+			continue;
+		}
+		if (++run == n) {
+			for (b = b + 1 - n; run > 0; run--, b++)
+				bitmap[b/32] &= ~(1<<(b%32));
+			return b - n;
+		}
+	}
+	panic("out of disk blocks");
+	return 0;
+}
+
+void
+free_blocks(uint32_t start, uint32_t n)
+{
+	uint32_t b;
+
+	for (b = start; b < start + n; b++)
+		bitmap[b/32] |= 1<<(b%32);
+}
+
 void
 opendisk(const char *name)
 {
@@ -117,6 +218,118 @@ opendisk(const char *name)
 	nbitblocks = (nblocks + BLKBITSIZE - 1) / BLKBITSIZE;
 	bitmap = alloc(nbitblocks * BLKSIZE);
 	memset(bitmap, 0xFF, nbitblocks * BLKSIZE);
+
+	// Leave small disks without a journal; the file server copes.
+	if (nblocks >= 8 * JOURNAL_NBLOCKS) {
+		struct JournalHeader *jh = alloc(JOURNAL_NBLOCKS * BLKSIZE);
+		jh->jh_magic = JOURNAL_MAGIC;
+		jh->jh_seq = 1;
+		super->s_journal = blockof(jh);
+		super->s_njournal = JOURNAL_NBLOCKS;
+	}
+}
+
+// Read the manifest left by the last run.  Returns 0 if there is
+// none or it does not describe an image of this size.
+int
+readmanifest(const char *name)
+{
+	char path[1024], line[256 + MAXNAMELEN];
+	FILE *mf;
+	struct Ment *m;
+	uint32_t n;
+	int cap = 0;
+
+	snprintf(path, sizeof path, "%s.manifest", name);
+	if ((mf = fopen(path, "r")) == NULL)
+		return 0;
+	if (!fgets(line, sizeof line, mf)
+	    || sscanf(line, MANIFEST_MAGIC " %u", &n) != 1 || n != nblocks) {
+		fclose(mf);
+		return 0;
+	}
+
+	while (fgets(line, sizeof line, mf)) {
+		if (noldman == cap) {
+			cap = cap ? cap * 2 : 64;
+			oldman = realloc(oldman, cap * sizeof *oldman);
+		}
+		m = &oldman[noldman];
+		if (sscanf(line, "%127s %" SCNu64 " %" SCNd64 " %ld %" SCNx64 " %u %u",
+			   m->name, &m->size, &m->mtime_sec, &m->mtime_nsec,
+			   &m->hash, &m->start, &m->nblk) != 7) {
+			fclose(mf);
+			return 0;
+		}
+		noldman++;
+	}
+	fclose(mf);
+	oldused = calloc(noldman + 1, sizeof *oldused);
+	return 1;
+}
+
+void
+writemanifest(const char *name)
+{
+	char path[1024], tmp[1024];
+	FILE *mf;
+	struct Ment *m;
+
+	snprintf(path, sizeof path, "%s.manifest", name);
+	snprintf(tmp, sizeof tmp, "%s.manifest~", name);
+	if ((mf = fopen(tmp, "w")) == NULL)
+		panic("open %s: %s", tmp, strerror(errno));
+	fprintf(mf, MANIFEST_MAGIC " %u\n", nblocks);
+	for (m = newman; m < newman + nnewman; m++)
+		fprintf(mf, "%s %" PRIu64 " %" PRId64 " %ld %" PRIx64 " %u %u\n",
+			m->name, m->size, m->mtime_sec, m->mtime_nsec,
+			m->hash, m->start, m->nblk);
+	if (fclose(mf) != 0 || rename(tmp, path) < 0)
+		panic("write %s: %s", path, strerror(errno));
+}
+
+// Remove the manifest of image name.  Called before the image is
+// changed, so a run that fails part way leaves no manifest behind that
+// a later -i run would trust; writemanifest() puts one back at the end.
+void
+dropmanifest(const char *name)
+{
+	char path[1024];
+
+	snprintf(path, sizeof path, "%s.manifest", name);
+	if (unlink(path) < 0 && errno != ENOENT)
+		panic("unlink %s: %s", path, strerror(errno));
+}
+
+// Map an existing image for an incremental update.  Returns 0 if
+// it cannot be reused, in which case the caller formats afresh.
+int
+reopendisk(const char *name)
+{
+	int diskfd;
+	struct stat st;
+
+	if (!readmanifest(name))
+		return 0;
+	if ((diskfd = open(name, O_RDWR)) < 0)
+		return 0;
+	if (fstat(diskfd, &st) < 0 || st.st_size != nblocks * BLKSIZE) {
+		close(diskfd);
+		return 0;
+	}
+	if ((diskmap = mmap(NULL, nblocks * BLKSIZE, PROT_READ|PROT_WRITE,
+			    MAP_SHARED, diskfd, 0)) == MAP_FAILED)
+		panic("mmap %s: %s", name, strerror(errno));
+	close(diskfd);
+
+	super = (struct Super *) (diskmap + BLKSIZE);
+	if (super->s_magic != FS_MAGIC || super->s_nblocks != nblocks) {
+		munmap(diskmap, nblocks * BLKSIZE);
+		return 0;
+	}
+	bitmap = (uint32_t *) (diskmap + 2 * BLKSIZE);
+	incremental = 1;
+	return 1;
 }
 
 void
@@ -124,24 +337,38 @@ finishdisk(void)
 {
 	int r, i;
 
-	for (i = 0; i < blockof(diskpos); ++i)
-		bitmap[i/32] &= ~(1<<(i%32));
+	if (!incremental)
+		for (i = 0; i < blockof(diskpos); ++i)
+			bitmap[i/32] &= ~(1<<(i%32));
 
 	if ((r = msync(diskmap, nblocks * BLKSIZE, MS_SYNC)) < 0)
 		panic("msync: %s", strerror(errno));
 }
 
+// Number of blocks a file of len bytes occupies, indirect block included.
+uint32_t
+extentsize(uint32_t len)
+{
+	uint32_t n = ROUNDUP(len, BLKSIZE) / BLKSIZE;
+	return n > NDIRECT ? n + 1 : n;
+}
+
+// Point f at the extent starting at block start.  Files past NDIRECT
+// blocks keep their indirect block right after the data.
 void
 finishfile(struct File *f, uint32_t start, uint32_t len)
 {
 	int i;
 	f->f_size = len;
 	len = ROUNDUP(len, BLKSIZE);
+	memset(f->f_direct, 0, sizeof f->f_direct);
+	f->f_indirect = 0;
 	for (i = 0; i < len / BLKSIZE && i < NDIRECT; ++i)
 		f->f_direct[i] = start + i;
-	if (i == NDIRECT) {
-		uint32_t *ind = alloc(BLKSIZE);
-		f->f_indirect = blockof(ind);
+	if (i == NDIRECT && len / BLKSIZE > NDIRECT) {
+		uint32_t *ind = (uint32_t *) (diskmap + (start + len / BLKSIZE) * BLKSIZE);
+		memset(ind, 0, BLKSIZE);
+		f->f_indirect = start + len / BLKSIZE;
 		for (; i < len / BLKSIZE; ++i)
 			ind[i - NDIRECT] = start + i;
 	}
@@ -151,7 +378,7 @@ void
 startdir(struct File *f, struct Dir *dout)
 {
 	dout->f = f;
-	dout->ents = malloc(MAX_DIR_ENTS * sizeof *dout->ents);
+	dout->ents = calloc(MAX_DIR_ENTS, sizeof *dout->ents);
 	dout->n = 0;
 }
 
@@ -170,25 +397,61 @@ void
 finishdir(struct Dir *d)
 {
 	int size = d->n * sizeof(struct File);
-	struct File *start = alloc(size);
-	memmove(start, d->ents, size);
-	finishfile(d->f, blockof(start), ROUNDUP(size, BLKSIZE));
+	uint32_t i, start;
+
+	// The directory is rebuilt every time; give back its old blocks.
+	if (incremental)
+		for (i = 0; i < NDIRECT; i++)
+			if (d->f->f_direct[i])
+				free_blocks(d->f->f_direct[i], 1);
+
+	start = alloc_blocks(extentsize(ROUNDUP(size, BLKSIZE)));
+	memset(diskmap + start * BLKSIZE, 0, ROUNDUP(size, BLKSIZE));
+	memmove(diskmap + start * BLKSIZE, d->ents, size);
+	finishfile(d->f, start, ROUNDUP(size, BLKSIZE));
 	free(d->ents);
 	d->ents = NULL;
 }
 
+// Store the contents of a small file in the File itself.
+void
+readinline(struct File *f, const char *name, uint32_t len)
+{
+	int fd;
+
+	if ((fd = open(name, O_RDONLY)) < 0)
+		panic("open %s: %s", name, strerror(errno));
+	readn(fd, f->f_inline, len);
+	close(fd);
+	f->f_size = len;
+	f->f_flags |= FFLAG_INLINE;
+}
+
+// Find name in the old manifest.
+struct Ment *
+oldlookup(const char *name)
+{
+	int i;
+
+	for (i = 0; i < noldman; i++)
+		if (!oldused[i] && strcmp(oldman[i].name, name) == 0) {
+			oldused[i] = 1;
+			return &oldman[i];
+		}
+	return NULL;
+}
+
 void
 writefile(struct Dir *dir, const char *name)
 {
-	int r, fd;
+	int r;
 	struct File *f;
 	struct stat st;
 	const char *last;
-	char *start;
+	struct Ment *m, *old;
+	bool copy;
 
-	if ((fd = open(name, O_RDONLY)) < 0)
-		panic("open %s: %s", name, strerror(errno));
-	if ((r = fstat(fd, &st)) < 0)
+	if ((r = stat(name, &st)) < 0)
 		panic("stat %s: %s", name, strerror(errno));
 	if (!S_ISREG(st.st_mode))
 		panic("%s is not a regular file", name);
@@ -202,28 +465,134 @@ writefile(struct Dir *dir, const char *name)
 		last = name;
 
 	f = diradd(dir, FTYPE_REG, last);
-	start = alloc(st.st_size);
-	readn(fd, start, st.st_size);
-	finishfile(f, blockof(start), st.st_size);
+
+	m = &newman[nnewman++];
+	strcpy(m->name, last);
+	m->size = st.st_size;
+	m->mtime_sec = st.st_mtim.tv_sec;
+	m->mtime_nsec = st.st_mtim.tv_nsec;
+	old = incremental ? oldlookup(last) : NULL;
+
+	if (st.st_size > 0 && st.st_size <= FINLINE_MAX) {
+		// Tiny files live in their directory entry; the directory
+		// is rewritten every time, so just read them again.
+		if (old)
+			free_blocks(old->start, old->nblk);
+		m->start = m->nblk = 0;
+		readinline(f, name, st.st_size);
+		m->hash = fnv1a(FNV_BASIS, f->f_inline, st.st_size);
+		return;
+	}
+	m->nblk = extentsize(st.st_size);
+
+	copy = 1;
+	if (old && old->size == m->size) {
+		if (old->mtime_sec == m->mtime_sec && old->mtime_nsec == m->mtime_nsec)
+			copy = 0;
+		else if ((m->hash = hashfile(name, st.st_size)) == old->hash)
+			copy = 0;
+	}
+
+	if (!copy) {
+		m->start = old->start;
+		m->hash = old->hash;
+	} else if (old && old->nblk == m->nblk) {
+		// Same shape: overwrite the old extent in place.
+		m->start = old->start;
+	} else {
+		if (old)
+			free_blocks(old->start, old->nblk);
+		m->start = alloc_blocks(m->nblk);
+	}
+	finishfile(f, m->start, st.st_size);
+
+	if (copy) {
+		jobs[njobs].path = name;
+		jobs[njobs].m = m;
+		njobs++;
+	}
+}
+
+// Copy one file's contents into its extent.
+void
+copyfile(struct Job *j)
+{
+	int fd;
+	char *start = diskmap + j->m->start * BLKSIZE;
+
+	if ((fd = open(j->path, O_RDONLY)) < 0)
+		panic("open %s: %s", j->path, strerror(errno));
+	readn(fd, start, j->m->size);
 	close(fd);
+	// Zero the tail of the last block; a reused extent holds old bytes.
+	memset(start + j->m->size, 0, ROUNDUP(j->m->size, BLKSIZE) - j->m->size);
+	j->m->hash = fnv1a(FNV_BASIS, start, j->m->size);
+}
+
+void *
+copyworker(void *arg)
+{
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&joblock);
+		i = nextjob++;
+		pthread_mutex_unlock(&joblock);
+		if (i >= njobs)
+			return NULL;
+		copyfile(&jobs[i]);
+	}
+}
+
+void
+copyfiles(int nthreads)
+{
+	pthread_t tids[MAX_THREADS];
+	int i;
+
+	if (nthreads > njobs)
+		nthreads = njobs;
+	if (nthreads <= 1) {
+		copyworker(NULL);
+		return;
+	}
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&tids[i], NULL, copyworker, NULL) != 0)
+			panic("pthread_create failed");
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
 }
 
 void
 usage(void)
 {
-	fprintf(stderr, "Usage: fsformat fs.img NBLOCKS files...\n");
+	fprintf(stderr, "Usage: fsformat [-i] [-j NTHREADS] fs.img NBLOCKS files...\n");
 	exit(2);
 }
 
 int
 main(int argc, char **argv)
 {
-	int i;
+	int i, nthreads = 1;
+	bool reuse = 0;
 	char *s;
 	struct Dir root;
 
 	assert(BLKSIZE % sizeof(struct File) == 0);
 
+	while (argc > 1 && argv[1][0] == '-') {
+		if (strcmp(argv[1], "-i") == 0)
+			reuse = 1;
+		else if (strcmp(argv[1], "-j") == 0 && argc > 2) {
+			nthreads = strtol(argv[2], &s, 0);
+			if (*s || nthreads < 1 || nthreads > MAX_THREADS)
+				usage();
+			argc--, argv++;
+		} else
+			usage();
+		argc--, argv++;
+	}
+
 	if (argc < 3)
 		usage();
 
@@ -231,14 +600,32 @@ main(int argc, char **argv)
 	if (*s || s == argv[2] || nblocks < 2 || nblocks > 1024)
 		usage();
 
-	opendisk(argv[1]);
+	if (reuse && !reopendisk(argv[1]))
+		reuse = 0;
+	dropmanifest(argv[1]);
+	if (!reuse) {
+		incremental = 0;
+		noldman = 0;
+		opendisk(argv[1]);
+	}
+
+	newman = calloc(argc, sizeof *newman);
+	jobs = calloc(argc, sizeof *jobs);
 
 	startdir(&super->s_root, &root);
 	for (i = 3; i < argc; i++)
 		writefile(&root, argv[i]);
+	// Give back the blocks of files that are no longer on the list.
+	for (i = 0; i < noldman; i++)
+		if (!oldused[i])
+			free_blocks(oldman[i].start, oldman[i].nblk);
 	finishdir(&root);
 
+	copyfiles(nthreads);
+
 	finishdisk();
+	writemanifest(argv[1]);
+	if (incremental)
+		printf("fsformat: %d of %d files rewritten\n", njobs, argc - 3);
 	return 0;
 }
-
@@ -0,0 +1,321 @@
+/*
+ * Write-ahead journal for file system metadata.
+ *
+ * Code that changes a metadata block (bitmap, directory, indirect block,
+ * superblock) calls journal_note() on it instead of writing it in place.
+ * journal_commit() appends the noted blocks to the on-disk journal as one
+ * record, so a sync is a short sequential write.  The home copies stay
+ * dirty in the block cache and are written back by journal_checkpoint()
+ * once the journal runs low on space.  At boot, journal_init() replays
+ * every complete record, so a crash never leaves metadata half-updated.
+ *
+ * A transaction runs from one sync or flush to the next.  serve() calls
+ * journal_boundary() before each request, which syncs early when the
+ * next operation might not fit in the transaction, so an operation is
+ * never split across two records.
+ *
+ * A freed block is not handed out again until the next checkpoint.
+ * Until then a record may still hold an old copy of it, which replay
+ * would write over its new contents, and the transaction that freed it
+ * may not even be committed yet.
+ */
+
+#include <inc/string.h>
+
+#include "fs.h"
+
+// Most blocks a single transaction may hold.
+#define JOURNAL_MAXTX	64
+// Most blocks that may be waiting for a checkpoint.
+#define JOURNAL_MAXCKPT	(JOURNAL_NBLOCKS * 4)
+
+static bool journaling;		// Disk has a journal
+static uint32_t jstart;		// First block of the journal
+static uint32_t jsize;		// Number of blocks in the journal
+static uint32_t jmaxtx;		// Transaction size limit for this journal
+static uint32_t jopmax;		// Most blocks one operation may note
+static uint32_t jseq;		// Sequence number of the next record
+static uint32_t jpos;		// Next free journal block, relative to jstart
+
+static uint32_t jpending[JOURNAL_MAXTX];	// Running transaction
+static int njpending;
+static uint32_t jcommitted[JOURNAL_MAXCKPT];	// Logged, not yet home
+static int njcommitted;
+static uint32_t jfreed[DISKSIZE / BLKSIZE / 32];	// Freed, not yet reusable
+static int njfreed;
+static bool jreclaim;		// Checkpoint at the next boundary
+
+static union {
+	struct JournalHeader h;
+	struct JournalDesc d;
+	char pad[BLKSIZE];
+} jbuf __attribute__((aligned(PGSIZE)));
+static char jscratch[BLKSIZE] __attribute__((aligned(PGSIZE)));
+
+static uint32_t
+jsum(uint32_t sum, const void *buf, size_t n)
+{
+	const uint32_t *p = buf;
+	for (; n >= 4; n -= 4, p++)
+		sum = ((sum << 5) | (sum >> 27)) + *p;
+	return sum;
+}
+
+static int
+jwrite(uint32_t jblock, const void *src)
+{
+	return ide_write((jstart + jblock) * BLKSECTS, src, BLKSECTS);
+}
+
+static int
+jread(uint32_t jblock, void *dst)
+{
+	return ide_read((jstart + jblock) * BLKSECTS, dst, BLKSECTS);
+}
+
+static void
+write_header(void)
+{
+	memset(&jbuf, 0, sizeof jbuf);
+	jbuf.h.jh_magic = JOURNAL_MAGIC;
+	jbuf.h.jh_seq = jseq;
+	if (jwrite(0, &jbuf) < 0)
+		panic("journal: cannot write header");
+}
+
+// Is block 'blockno' part of the running transaction?
+bool
+journal_holds(uint32_t blockno)
+{
+	int i;
+
+	for (i = 0; i < njpending; i++)
+		if (jpending[i] == blockno)
+			return 1;
+	return 0;
+}
+
+// Record that the metadata block containing 'addr' has changed.
+// Without a journal the block is written through immediately, as
+// before.
+void
+journal_note(void *addr)
+{
+	uint32_t blockno = ((uint32_t)addr - DISKMAP) / BLKSIZE;
+
+	if (!journaling) {
+		flush_block(addr);
+		return;
+	}
+	if (journal_holds(blockno))
+		return;
+	// journal_boundary() left room for jopmax blocks.  Committing
+	// now would split the operation, so running out is a bug.
+	if (njpending >= jmaxtx)
+		panic("journal: operation noted more than %d blocks", jopmax);
+	jpending[njpending++] = blockno;
+}
+
+// Record that block 'blockno' has been freed.
+void
+journal_free(uint32_t blockno)
+{
+	if (!journaling || (jfreed[blockno / 32] & (1 << (blockno % 32))))
+		return;
+	jfreed[blockno / 32] |= 1 << (blockno % 32);
+	njfreed++;
+}
+
+// Is block 'blockno', free in the bitmap, still not to be handed out?
+bool
+journal_freed(uint32_t blockno)
+{
+	return njfreed > 0 && (jfreed[blockno / 32] & (1 << (blockno % 32)));
+}
+
+// Called when the disk is out of blocks.  If blocks freed since the
+// last checkpoint are held back, checkpoint at the next boundary to
+// make them usable again.
+void
+journal_reclaim(void)
+{
+	if (njfreed > 0)
+		jreclaim = 1;
+}
+
+// Called between file system operations.  Commit the running
+// transaction if the next operation might not fit in it.
+void
+journal_boundary(void)
+{
+	if (journaling && (jreclaim || njpending + jopmax > jmaxtx))
+		fs_sync();
+	if (jreclaim)
+		journal_checkpoint();
+}
+
+// Write every logged block to its home location and retire the
+// journal records that covered them.  Must not be called while a
+// transaction is running: home blocks would get uncommitted contents.
+void
+journal_checkpoint(void)
+{
+	int i;
+
+	if (!journaling)
+		return;
+	assert(njpending == 0);
+
+	for (i = 0; i < njcommitted; i++)
+		flush_block(diskaddr(jcommitted[i]));
+	njcommitted = 0;
+	if (njfreed > 0)
+		memset(jfreed, 0, ROUNDUP(super->s_nblocks, 32) / 8);
+	njfreed = 0;
+	jreclaim = 0;
+
+	write_header();
+	jpos = 1;
+}
+
+// Append the running transaction to the journal.
+void
+journal_commit(void)
+{
+	int i, j;
+	uint32_t b, sum;
+	void *addr;
+
+	if (!journaling || njpending == 0)
+		return;
+
+	// Block copies first; the descriptor is the commit point.
+	sum = 0;
+	for (i = 0; i < njpending; i++) {
+		b = jpending[i];
+		addr = diskaddr(b);
+		sum = jsum(sum, &b, sizeof b);
+		sum = jsum(sum, addr, BLKSIZE);
+		if (jwrite(jpos + 1 + i, addr) < 0)
+			panic("journal: cannot write block copy");
+	}
+
+	memset(&jbuf, 0, sizeof jbuf);
+	jbuf.d.jd_magic = JOURNAL_MAGIC;
+	jbuf.d.jd_seq = jseq;
+	jbuf.d.jd_nblocks = njpending;
+	jbuf.d.jd_checksum = sum;
+	memmove(jbuf.d.jd_blocks, jpending, njpending * sizeof jpending[0]);
+	if (jwrite(jpos, &jbuf) < 0)
+		panic("journal: cannot write descriptor");
+
+	jpos += njpending + 1;
+	jseq++;
+
+	// The home copies are still dirty in the cache; remember them
+	// for the checkpoint.
+	for (i = 0; i < njpending; i++) {
+		for (j = 0; j < njcommitted; j++)
+			if (jcommitted[j] == jpending[i])
+				break;
+		if (j == njcommitted)
+			jcommitted[njcommitted++] = jpending[i];
+	}
+	njpending = 0;
+
+	// Keep room for a full transaction so the next commit never
+	// has to checkpoint under a running transaction.
+	if (jsize - jpos < jmaxtx + 1 || njcommitted + jmaxtx > JOURNAL_MAXCKPT)
+		journal_checkpoint();
+}
+
+// Replay one record at journal block 'pos'.  Returns the number of
+// journal blocks it used, or 0 if there is no complete record there.
+static int
+replay_record(uint32_t pos)
+{
+	struct JournalDesc *d = &jbuf.d;
+	uint32_t i, n, b, sum;
+
+	if (pos >= jsize || jread(pos, d) < 0)
+		return 0;
+	if (d->jd_magic != JOURNAL_MAGIC || d->jd_seq != jseq)
+		return 0;
+	n = d->jd_nblocks;
+	if (n == 0 || n > jmaxtx || pos + 1 + n > jsize)
+		return 0;
+
+	// Check the whole record before touching any home block.
+	sum = 0;
+	for (i = 0; i < n; i++) {
+		b = d->jd_blocks[i];
+		if (b == 0 || b >= super->s_nblocks || jread(pos + 1 + i, jscratch) < 0)
+			return 0;
+		sum = jsum(sum, &b, sizeof b);
+		sum = jsum(sum, jscratch, BLKSIZE);
+	}
+	if (sum != d->jd_checksum)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		b = d->jd_blocks[i];
+		if (jread(pos + 1 + i, jscratch) < 0)
+			panic("journal: cannot reread block copy");
+		memmove(diskaddr(b), jscratch, BLKSIZE);
+		flush_block(diskaddr(b));
+	}
+	return n + 1;
+}
+
+// Find the journal and replay any records left by a crash.
+// Called before the bitmap is used, so replayed bitmap blocks are seen.
+void
+journal_init(void)
+{
+	uint32_t pos;
+	int n, nrecords;
+
+	if (super->s_journal == 0 || super->s_njournal < 4) {
+		cprintf("journal: none on this disk\n");
+		return;
+	}
+	if (super->s_journal + super->s_njournal > super->s_nblocks)
+		panic("journal lies outside the disk");
+
+	jstart = super->s_journal;
+	jsize = super->s_njournal;
+	jmaxtx = MIN(JOURNAL_MAXTX, (jsize - 1) / 2 - 1);
+	jmaxtx = MIN(jmaxtx, JDESC_NBLOCKS);
+	// The most an operation touches: every bitmap block (truncating
+	// or growing a large file), the super block, the File and its
+	// indirect block, and a directory's File, indirect block and
+	// new data block.
+	jopmax = (super->s_nblocks + BLKBITSIZE - 1) / BLKBITSIZE + 6;
+	if (jmaxtx < jopmax) {
+		cprintf("journal: %d blocks is too small, not used\n", jsize);
+		return;
+	}
+	journaling = 1;
+
+	if (jread(0, &jbuf) < 0)
+		panic("journal: cannot read header");
+	if (jbuf.h.jh_magic != JOURNAL_MAGIC) {
+		jseq = 1;
+		write_header();
+		jpos = 1;
+		cprintf("journal: initialized\n");
+		return;
+	}
+
+	jseq = jbuf.h.jh_seq;
+	nrecords = 0;
+	for (pos = 1; (n = replay_record(pos)) > 0; pos += n) {
+		jseq++;
+		nrecords++;
+	}
+
+	// Everything replayed is home now; retire it.
+	write_header();
+	jpos = 1;
+	cprintf("journal is good (%d records replayed)\n", nrecords);
+}
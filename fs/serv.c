@@ -47,6 +47,8 @@ struct OpenFile opentab[MAXOPEN] = {
 
 // Virtual address at which to receive page mappings containing client requests.
 union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
+// A copy of an inline file's data is lent from here.
+#define LENDVA		0x0fffe000
 
 void
 serve_init(void)
@@ -224,6 +226,65 @@ serve_read(envid_t envid, union Fsipc *ipc)
 }
 
 
+// Lend the caller the block cache pages holding up to req->req_n bytes
+// of req->req_fileid from req->req_offset, for serve() to map read-only
+// into it: store them in pgs and their number in *npgs.  The data starts
+// req_offset % BLKSIZE bytes into the first page.  Later writes to the
+// file go to fresh pages, so what was lent never changes.  Returns the
+// number of bytes lent, 0 at end of file, or < 0 on error.
+static int
+serve_read_pages(envid_t envid, struct Fsreq_read_pages *req, void **pgs,
+		 int *npgs)
+{
+	struct OpenFile *o;
+	struct File *f;
+	off_t off = req->req_offset;
+	size_t n;
+	char *blk;
+	int i, r;
+
+	if (debug)
+		cprintf("serve_read_pages %08x %08x %08x %08x\n",
+			envid, req->req_fileid, off, req->req_n);
+
+	*npgs = 0;
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	f = o->o_file;
+	// Directory blocks hold Files that change in place; only regular
+	// file blocks are lent, and bc_unshare copies them before a write.
+	if (off < 0 || f->f_type != FTYPE_REG)
+		return -E_INVAL;
+	if (off >= f->f_size)
+		return 0;
+	n = MIN(req->req_n, f->f_size - off);
+	n = MIN(n, IPC_MAXPAGES * BLKSIZE - off % BLKSIZE);
+
+	if (f->f_flags & FFLAG_INLINE) {
+		// No block to lend; lend a copy.
+		if ((r = sys_page_alloc(0, (void *) LENDVA, PTE_P|PTE_U|PTE_W)) < 0)
+			return r;
+		memmove((char *) LENDVA + off, f->f_inline + off, n);
+		pgs[0] = (void *) LENDVA;
+		*npgs = 1;
+		return n;
+	}
+
+	for (i = 0; i * BLKSIZE < off % BLKSIZE + n; i++) {
+		if ((r = file_get_block(f, off / BLKSIZE + i, &blk)) < 0) {
+			if (i == 0)
+				return r;
+			n = i * BLKSIZE - off % BLKSIZE;
+			break;
+		}
+		// Fault the block into the cache, so there is a page to map.
+		(void) *(volatile char *) blk;
+		pgs[i] = blk;
+	}
+	*npgs = i;
+	return n;
+}
+
 // Write req->req_n bytes from req->req_buf to req_fileid, starting at
 // the current seek position, and update the seek position
 // accordingly.  Extend the file if necessary.  Returns the number of
@@ -264,6 +325,7 @@ serve_stat(envid_t envid, union Fsipc *ipc)
 	strcpy(ret->ret_name, o->o_file->f_name);
 	ret->ret_size = o->o_file->f_size;
 	ret->ret_isdir = (o->o_file->f_type == FTYPE_DIR);
+	ret->ret_version = o->o_file->f_version;
 	return 0;
 }
 
@@ -308,8 +370,8 @@ void
 serve(void)
 {
 	uint32_t req, whom;
-	int perm, r;
-	void *pg;
+	int perm, r, npgs;
+	void *pg, *pgs[IPC_MAXPAGES];
 
 	while (1) {
 		perm = 0;
@@ -325,17 +387,30 @@ serve(void)
 			continue; // just leave it hanging...
 		}
 
+		// Make sure the request's metadata fits in the journal.
+		journal_boundary();
+
 		pg = NULL;
+		npgs = 0;
 		if (req == FSREQ_OPEN) {
 			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
+		} else if (req == FSREQ_READ_PAGES) {
+			// Read pages is handled specially because it passes pages
+			r = serve_read_pages(whom, &fsreq->read_pages, pgs, &npgs);
+			perm = PTE_P|PTE_U;
 		} else if (req < ARRAY_SIZE(handlers) && handlers[req]) {
 			r = handlers[req](whom, fsreq);
 		} else {
 			cprintf("Invalid request code %d from %08x\n", req, whom);
 			r = -E_INVAL;
 		}
-		ipc_send(whom, r, pg, perm);
+		if (npgs > 0)
+			ipc_sendv(whom, r, pgs, npgs, perm);
+		else
+			ipc_send(whom, r, pg, perm);
 		sys_page_unmap(0, fsreq);
+		if (npgs > 0 && pgs[0] == (void *) LENDVA)
+			sys_page_unmap(0, (void *) LENDVA);
 	}
 }
 
@@ -5,13 +5,20 @@
 
 static char *msg = "This is the NEW message of the day!\n\n";
 
+// Metadata is either clean or waiting in the running transaction.
+static bool
+meta_logged(void *va)
+{
+	return !va_is_dirty(va) || journal_holds(((uint32_t)va - DISKMAP) / BLKSIZE);
+}
+
 void
 fs_test(void)
 {
 	struct File *f;
-	int r;
-	char *blk;
-	uint32_t *bits;
+	int r, i;
+	char *blk, buf[64];
+	uint32_t *bits, v;
 
 	// back up bitmap
 	if ((r = sys_page_alloc(0, (void*) PGSIZE, PTE_P|PTE_U|PTE_W)) < 0)
@@ -50,18 +57,92 @@ fs_test(void)
 	if ((r = file_set_size(f, 0)) < 0)
 		panic("file_set_size: %e", r);
 	assert(f->f_direct[0] == 0);
-	assert(!(uvpt[PGNUM(f)] & PTE_D));
+	assert(meta_logged(f));
 	cprintf("file_truncate is good\n");
 
 	if ((r = file_set_size(f, strlen(msg))) < 0)
 		panic("file_set_size 2: %e", r);
-	assert(!(uvpt[PGNUM(f)] & PTE_D));
+	assert(meta_logged(f));
 	if ((r = file_get_block(f, 0, &blk)) < 0)
 		panic("file_get_block 2: %e", r);
 	strcpy(blk, msg);
 	assert((uvpt[PGNUM(blk)] & PTE_D));
 	file_flush(f);
 	assert(!(uvpt[PGNUM(blk)] & PTE_D));
-	assert(!(uvpt[PGNUM(f)] & PTE_D));
+	assert(!journal_holds(((uint32_t)f - DISKMAP) / BLKSIZE));
 	cprintf("file rewrite is good\n");
+
+	// A checkpoint leaves no metadata dirty.
+	journal_checkpoint();
+	assert(!(uvpt[PGNUM(f)] & PTE_D));
+	assert(!va_is_dirty(bitmap));
+	cprintf("journal checkpoint is good\n");
+
+	// Operations that together note more blocks than one transaction
+	// holds are committed between operations, and none is left out.
+	for (i = 0; super->s_journal && i < JOURNAL_NBLOCKS; i++) {
+		journal_boundary();
+		blk = diskaddr(super->s_journal + super->s_njournal + i);
+		*(volatile char*)blk = *(volatile char*)blk;
+		journal_note(blk);
+	}
+	journal_commit();
+	journal_checkpoint();
+	for (i = 0; super->s_journal && i < JOURNAL_NBLOCKS; i++)
+		assert(!va_is_dirty(diskaddr(super->s_journal + super->s_njournal + i)));
+	cprintf("journal overflow is good\n");
+
+	// A freed block is not handed out again before a checkpoint.
+	if (super->s_journal) {
+		fs_sync();
+		journal_checkpoint();
+		if ((r = alloc_block()) < 0)
+			panic("alloc_block 2: %e", r);
+		free_block(r);
+		if ((i = alloc_block()) < 0)
+			panic("alloc_block 3: %e", i);
+		assert(i != r);
+		free_block(i);
+		fs_sync();
+		journal_checkpoint();
+		assert(alloc_block() == r);
+		free_block(r);
+		cprintf("journal revoke is good\n");
+	}
+
+	// Small files keep their data in the File and move to a block
+	// when they outgrow it.
+	if ((r = file_set_size(f, 0)) < 0)
+		panic("file_set_size 3: %e", r);
+	if ((r = file_write(f, msg, strlen(msg), 0)) != strlen(msg))
+		panic("file_write inline: %e", r);
+	assert((f->f_flags & FFLAG_INLINE) && f->f_size == strlen(msg));
+	if ((r = file_write(f, msg, strlen(msg), FINLINE_MAX)) < 0)
+		panic("file_write uninline: %e", r);
+	assert(!(f->f_flags & FFLAG_INLINE) && f->f_direct[0] != 0);
+	if ((r = file_read(f, buf, strlen(msg), 0)) != strlen(msg) ||
+	    memcmp(buf, msg, strlen(msg)) != 0)
+		panic("file_read after uninline: %e", r);
+	if ((r = file_set_size(f, strlen(msg))) < 0)
+		panic("file_set_size 4: %e", r);
+	file_flush(f);
+	cprintf("file inline is good\n");
+
+	// Every change to a file gives it a new version.
+	v = f->f_version;
+	if ((r = file_write(f, msg, 1, 0)) != 1)
+		panic("file_write version: %e", r);
+	assert(f->f_version != v && f->f_version <= super->s_version);
+	cprintf("file version is good\n");
+
+	// A block page lent out is never written: the write gets a copy.
+	if ((r = file_get_block(f, 0, &blk)) < 0)
+		panic("file_get_block 3: %e", r);
+	if ((r = sys_page_map(0, blk, 0, (void*) PGSIZE, PTE_P|PTE_U)) < 0)
+		panic("sys_page_map: %e", r);
+	if ((r = file_write(f, "X", 1, 0)) != 1)
+		panic("file_write lent: %e", r);
+	assert(*(char*) PGSIZE == msg[0] && blk[0] == 'X');
+	sys_page_unmap(0, (void*) PGSIZE);
+	cprintf("lent page is good\n");
 }
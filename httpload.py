@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+
+"""Load generator for httpd.
+
+Keeps a number of keep-alive connections busy with GETs against the web
+server, optionally pipelining several requests per connection, and
+reports requests per second and latency percentiles.  Run JOS with
+`make run-httpd-nox` and point this at the forwarded port, which
+`make which-ports` prints (or use `make load-80`).
+"""
+
+import argparse
+import socket
+import sys
+import threading
+import time
+
+
+class Worker(threading.Thread):
+    def __init__(self, args, deadline):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.args = args
+        self.deadline = deadline
+        self.latencies = []
+        self.bytes = 0
+        self.errors = 0
+        self.conns = 0
+        req = "GET %s HTTP/1.1\r\nHost: %s\r\n" % (args.path, args.host)
+        if args.close:
+            req += "Connection: close\r\n"
+        self.request = (req + "\r\n").encode("ascii")
+
+    def connect(self):
+        sock = socket.create_connection((self.args.host, self.args.port),
+                                        timeout=self.args.timeout)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.conns += 1
+        return sock, b""
+
+    def read_response(self, sock, buf):
+        """Read one response off sock; return the rest of buf, and
+        whether the server keeps the connection."""
+        while b"\r\n\r\n" not in buf:
+            data = sock.recv(65536)
+            if not data:
+                raise IOError("connection closed in response head")
+            buf += data
+        head, buf = buf.split(b"\r\n\r\n", 1)
+        lines = head.decode("latin-1").split("\r\n")
+        version, status = lines[0].split()[:2]
+        status = int(status)
+        length, keep = 0, version == "HTTP/1.1"
+        for line in lines[1:]:
+            name, _, value = line.partition(":")
+            name, value = name.strip().lower(), value.strip().lower()
+            if name == "content-length":
+                length = int(value)
+            elif name == "connection":
+                keep = value == "keep-alive" or \
+                    (keep and value != "close")
+        while len(buf) < length:
+            data = sock.recv(65536)
+            if not data:
+                raise IOError("connection closed in response body")
+            buf += data
+        if status != 200:
+            self.errors += 1
+        self.bytes += length
+        return buf[length:], keep
+
+    def run(self):
+        sock, buf = None, b""
+        depth = self.args.pipeline
+        while time.time() < self.deadline:
+            try:
+                if sock is None:
+                    sock, buf = self.connect()
+                start = time.time()
+                sock.sendall(self.request * depth)
+                keep = True
+                for i in range(depth):
+                    buf, keep = self.read_response(sock, buf)
+                    self.latencies.append(time.time() - start)
+                if not keep:
+                    sock.close()
+                    sock = None
+            except (IOError, socket.error, ValueError, IndexError):
+                self.errors += 1
+                if sock is not None:
+                    sock.close()
+                sock = None
+                time.sleep(0.01)
+        if sock is not None:
+            sock.close()
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    k = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[k]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("port", type=int, help="forwarded httpd port")
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("-c", "--connections", type=int, default=8,
+                        help="concurrent connections (default 8)")
+    parser.add_argument("-d", "--duration", type=float, default=10,
+                        help="seconds to run (default 10)")
+    parser.add_argument("-p", "--pipeline", type=int, default=1,
+                        help="requests in flight per connection (default 1)")
+    parser.add_argument("--close", action="store_true",
+                        help="one request per connection")
+    parser.add_argument("--timeout", type=float, default=5)
+    parser.add_argument("path", nargs="?", default="/index.html")
+    args = parser.parse_intermixed_args()
+    if args.close:
+        args.pipeline = 1
+
+    start = time.time()
+    workers = [Worker(args, start + args.duration)
+               for i in range(args.connections)]
+    for w in workers:
+        w.start()
+    for w in workers:
+        w.join()
+    elapsed = time.time() - start
+
+    lat = sorted(l for w in workers for l in w.latencies)
+    nbytes = sum(w.bytes for w in workers)
+    print("%d requests in %.1f s over %d connections, %d errors" %
+          (len(lat), elapsed, sum(w.conns for w in workers),
+           sum(w.errors for w in workers)))
+    print("%.1f requests/s, %.1f KB/s" %
+          (len(lat) / elapsed, nbytes / elapsed / 1024))
+    print("latency ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f" %
+          tuple(1000 * percentile(lat, p) for p in (50, 90, 99, 100)))
+    return 0 if lat else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
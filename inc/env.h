@@ -67,6 +67,12 @@ struct Env {
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+	int env_ipc_maxpages;		// Pages the receiver has room for
+	int env_ipc_npages;		// Pages mapped at env_ipc_dstva
+
+	// Timed and device waits
+	uint32_t env_wakeup;		// time_msec() ending a timed wait, or 0
+	bool env_dev_wait;		// Blocked until a device interrupt
 };
 
 #endif // !JOS_INC_ENV_H
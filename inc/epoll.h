@@ -0,0 +1,47 @@
+// Definitions for the epoll-style socket readiness interface in
+// lib/epoll.c and the event ring it shares with the network server.
+
+#ifndef JOS_INC_EPOLL_H
+#define JOS_INC_EPOLL_H
+
+#include <inc/types.h>
+#include <inc/poll.h>
+
+typedef union epoll_data {
+	void *ptr;
+	int fd;
+	uint32_t u32;
+} epoll_data_t;
+
+struct epoll_event {
+	uint32_t events;	// EPOLL* events
+	epoll_data_t data;	// Passed back as given to epoll_ctl
+};
+
+#define EPOLLIN		POLLIN
+#define EPOLLOUT	POLLOUT
+#define EPOLLERR	POLLERR
+#define EPOLLHUP	POLLHUP
+
+// epoll_ctl operations
+#define EPOLL_CTL_ADD	1
+#define EPOLL_CTL_DEL	2
+#define EPOLL_CTL_MOD	3
+
+// The event ring of an epoll instance.  It is the data page of the epoll
+// fd, which ns also maps.  ns is the only producer: when a watched
+// socket becomes readable or writable, it writes an event to slot
+// er_prod and then advances er_prod.  The owner takes events from slot
+// er_cons and advances er_cons.  Both count up forever, modulo
+// EPOLL_RING_SLOTS.  Events are edge-triggered, and a socket has at
+// most one event in the ring: ns ORs new events into it until the owner
+// takes it.  There are fewer sockets than slots, so the ring never fills.
+#define EPOLL_RING_SLOTS	64
+
+struct epoll_ring {
+	volatile uint32_t er_prod;	// Next slot ns fills
+	volatile uint32_t er_cons;	// Next slot the owner empties
+	struct epoll_event er_ev[EPOLL_RING_SLOTS];
+};
+
+#endif	// not JOS_INC_EPOLL_H
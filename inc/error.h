@@ -26,6 +26,12 @@ enum {
 	E_NOT_EXEC	,	// File not a valid executable
 	E_NOT_SUPP	,	// Operation not supported
 
+	// Network error codes
+	E_NIC_BUSY	,	// NIC transmit ring is full
+
+	E_TIMEOUT	,	// Timed wait expired
+	E_AGAIN		,	// Non-blocking operation would block
+
 	MAXERROR
 };
 
@@ -7,6 +7,11 @@
 
 #include <inc/types.h>
 #include <inc/fs.h>
+#include <inc/poll.h>
+#include <inc/epoll.h>
+
+// Maximum number of file descriptors a program may hold open concurrently
+#define MAXFD		32
 
 struct Fd;
 struct Stat;
@@ -21,6 +26,9 @@ struct Dev {
 	int (*dev_close)(struct Fd *fd);
 	int (*dev_stat)(struct Fd *fd, struct Stat *stat);
 	int (*dev_trunc)(struct Fd *fd, off_t length);
+	// Returns the POLL* events now pending on fd, without blocking.
+	// Devices without dev_poll are always ready.
+	int (*dev_poll)(struct Fd *fd, int events);
 };
 
 struct FdFile {
@@ -31,6 +39,10 @@ struct FdSock {
 	int sockid;
 };
 
+struct FdEpoll {
+	int epid;
+};
+
 struct Fd {
 	int fd_dev_id;
 	off_t fd_offset;
@@ -40,6 +52,8 @@ struct Fd {
 		struct FdFile fd_file;
 		// Network sockets
 		struct FdSock fd_sock;
+		// Epoll instances in the network server
+		struct FdEpoll fd_epoll;
 	};
 };
 
@@ -47,6 +61,7 @@ struct Stat {
 	char st_name[MAXNAMELEN];
 	off_t st_size;
 	int st_isdir;
+	uint32_t st_version;	// Changes with the contents of a file
 	struct Dev *st_dev;
 };
 
@@ -61,5 +76,6 @@ extern struct Dev devfile;
 extern struct Dev devsock;
 extern struct Dev devcons;
 extern struct Dev devpipe;
+extern struct Dev devepoll;
 
 #endif	// not JOS_INC_FD_H
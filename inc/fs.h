@@ -26,19 +26,31 @@
 
 #define MAXFILESIZE	((NDIRECT + NINDIRECT) * BLKSIZE)
 
+// Files up to this size keep their data in the File itself, in place of
+// the block pointers, and need no blocks of their own.
+#define FINLINE_MAX	112
+
 struct File {
 	char f_name[MAXNAMELEN];	// filename
 	off_t f_size;			// file size in bytes
 	uint32_t f_type;		// file type
 
-	// Block pointers.
-	// A block is allocated iff its value is != 0.
-	uint32_t f_direct[NDIRECT];	// direct blocks
-	uint32_t f_indirect;		// indirect block
+	union {
+		// Block pointers.
+		// A block is allocated iff its value is != 0.
+		struct {
+			uint32_t f_direct[NDIRECT];	// direct blocks
+			uint32_t f_indirect;		// indirect block
+		} __attribute__((packed));
+		// Contents of a file with FFLAG_INLINE set.
+		uint8_t f_inline[FINLINE_MAX];
+	} __attribute__((packed));
+	uint32_t f_flags;		// FFLAG_* bits
+	uint32_t f_version;		// Changes whenever the contents do
 
 	// Pad out to 256 bytes; must do arithmetic in case we're compiling
 	// fsformat on a 64-bit machine.
-	uint8_t f_pad[256 - MAXNAMELEN - 8 - 4*NDIRECT - 4];
+	uint8_t f_pad[256 - MAXNAMELEN - 8 - FINLINE_MAX - 8];
 } __attribute__((packed));	// required only on some 64-bit machines
 
 // An inode block contains exactly BLKFILES 'struct File's
@@ -48,6 +60,9 @@ struct File {
 #define FTYPE_REG	0	// Regular file
 #define FTYPE_DIR	1	// Directory
 
+// File flags
+#define FFLAG_INLINE	0x1	// Data is in f_inline, not in blocks
+
 
 // File system super-block (both in-memory and on-disk)
 
@@ -57,6 +72,35 @@ struct Super {
 	uint32_t s_magic;		// Magic number: FS_MAGIC
 	uint32_t s_nblocks;		// Total number of blocks on disk
 	struct File s_root;		// Root directory node
+	uint32_t s_journal;		// First block of metadata journal, 0 if none
+	uint32_t s_njournal;		// Number of blocks in the journal
+	uint32_t s_version;		// Bound on the f_versions handed out
+};
+
+// Metadata journal (on-disk)
+//
+// The journal is s_njournal blocks starting at s_journal.  Its first block
+// holds a JournalHeader naming the sequence number of the oldest live
+// record.  Records follow back to back, each a JournalDesc block followed
+// by a copy of every block it lists.  The descriptor is written after the
+// copies, so a descriptor with the expected sequence number and checksum
+// marks a complete record.
+
+#define JOURNAL_MAGIC	0x4A4E4C21	// 'JNL!'
+#define JOURNAL_NBLOCKS	64		// Journal size laid down by fsformat
+#define JDESC_NBLOCKS	((BLKSIZE - 16) / 4)
+
+struct JournalHeader {
+	uint32_t jh_magic;		// Magic number: JOURNAL_MAGIC
+	uint32_t jh_seq;		// Sequence number of first live record
+};
+
+struct JournalDesc {
+	uint32_t jd_magic;		// Magic number: JOURNAL_MAGIC
+	uint32_t jd_seq;		// Sequence number of this record
+	uint32_t jd_nblocks;		// Number of block copies that follow
+	uint32_t jd_checksum;		// Checksum over block numbers and copies
+	uint32_t jd_blocks[JDESC_NBLOCKS];	// Home block of each copy
 };
 
 // Definitions for requests from clients to file system
@@ -70,7 +114,10 @@ enum {
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Read pages maps the block cache pages holding the data into the
+	// caller, read-only, instead of copying it into the request page
+	FSREQ_READ_PAGES
 };
 
 union Fsipc {
@@ -101,6 +148,7 @@ union Fsipc {
 		char ret_name[MAXNAMELEN];
 		off_t ret_size;
 		int ret_isdir;
+		uint32_t ret_version;
 	} statRet;
 	struct Fsreq_flush {
 		int req_fileid;
@@ -108,6 +156,11 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_read_pages {
+		int req_fileid;
+		off_t req_offset;
+		size_t req_n;
+	} read_pages;
 
 	// Ensure Fsipc is one page
 	char _pad[PGSIZE];
@@ -20,6 +20,7 @@
 #include <inc/trap.h>
 #include <inc/fs.h>
 #include <inc/fd.h>
+#include <inc/poll.h>
 #include <inc/args.h>
 #include <inc/malloc.h>
 #include <inc/ns.h>
@@ -61,8 +62,15 @@ int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
 unsigned int sys_time_msec(void);
-int sys_nic_transmit(const void* packet, int size);
-int sys_nic_recv(void* buf, int limit);
+int sys_nic_transmit(const void* packet, int size, int flags);
+int sys_nic_recv(void* dstva);
+int sys_nic_wait(void);
+int sys_nic_wait_tx(void);
+int sys_nic_transmit_batch(const struct nic_pkt* pkts, int n);
+int sys_nic_recv_batch(void* dstva, struct nic_rx* rx, int n);
+int sys_sleep_until(uint32_t msec);
+int sys_ipc_recv_until(void* dstva, int npages, uint32_t msec);
+int sys_ipc_try_sendv(envid_t to_env, uint32_t value, void* const* pgs, int npgs, int perm);
 
 // This must be inlined.  Exercise for reader: why?
 static inline envid_t __attribute__((always_inline))
@@ -78,6 +86,10 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_recv_until(envid_t *from_env_store, void *pg, int npages,
+		       int *perm_store, uint32_t msec);
+void	ipc_sendv(envid_t to_env, uint32_t value, void* const* pgs, int npgs,
+		  int perm);
 envid_t	ipc_find_env(enum EnvType type);
 
 // fork.c
@@ -94,12 +106,14 @@ void	close_all(void);
 ssize_t	readn(int fd, void *buf, size_t nbytes);
 int	dup(int oldfd, int newfd);
 int	fstat(int fd, struct Stat *statbuf);
+int	fcntl(int fd, int cmd, int arg);
 int	stat(const char *path, struct Stat *statbuf);
 
 // file.c
 int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
+int	read_pages(int fd, off_t offset, size_t n, void *dstva);
 int	sync(void);
 
 // pageref.c
@@ -112,6 +126,9 @@ int     shutdown(int s, int how);
 int     connect(int s, const struct sockaddr *name, socklen_t namelen);
 int     listen(int s, int backlog);
 int     socket(int domain, int type, int protocol);
+ssize_t recv(int s, void *buf, size_t len, unsigned int flags);
+ssize_t send(int s, const void *buf, size_t len, unsigned int flags);
+ssize_t sendfile(int s, int fd, off_t offset, size_t len);
 
 // nsipc.c
 int     nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
@@ -122,7 +139,33 @@ int     nsipc_connect(int s, const struct sockaddr *name, socklen_t namelen);
 int     nsipc_listen(int s, int backlog);
 int     nsipc_recv(int s, void *mem, int len, unsigned int flags);
 int     nsipc_send(int s, const void *buf, int size, unsigned int flags);
+int     nsipc_sendfile(int s, const void *buf, int size);
 int     nsipc_socket(int domain, int type, int protocol);
+int     nsipc_poll(struct pollfd *fds, int nfds, int timeout);
+int     nsipc_ioctl(int s, long cmd, uint32_t *argp);
+int     nsipc_epoll_create(struct epoll_ring *ring);
+int     nsipc_epoll_ctl(int epid, int op, int s, uint32_t events,
+			uint32_t data);
+int     nsipc_epoll_wait(int epid, int timeout);
+int     nsipc_epoll_close(int epid);
+int     nsipc_stats(struct Nsret_stats *stats);
+
+// poll.c
+int	poll(struct pollfd *fds, int nfds, int timeout);
+int	select(int nfds, fd_set *readfds, fd_set *writefds,
+	       fd_set *exceptfds, struct timeval *timeout);
+
+// epoll.c
+int	epoll_create(int size);
+int	epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+int	epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+		   int timeout);
+
+// jifring.c
+void	jifring_wait(volatile uint32_t *waiting, volatile uint32_t *idx,
+		     uint32_t seen);
+void	jifring_notify(volatile uint32_t *waiting, envid_t envid,
+		       int32_t value);
 
 // spawn.c
 envid_t	spawn(const char *program, const char **argv);
@@ -151,5 +194,10 @@ void	wait(envid_t env);
 #define	O_TRUNC		0x0200		/* truncate to zero length */
 #define	O_EXCL		0x0400		/* error if already exists */
 #define O_MKDIR		0x0800		/* create directory, not regular file */
+/* O_NONBLOCK, from <lwip/sockets.h>, may be set on sockets with fcntl */
+
+/* fcntl commands */
+#define F_GETFL		3		/* get fd_omode */
+#define F_SETFL		4		/* set O_NONBLOCK */
 
 #endif	// !JOS_INC_LIB_H
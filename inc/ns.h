@@ -5,13 +5,57 @@
 
 #include <inc/types.h>
 #include <inc/mmu.h>
+#include <inc/poll.h>
+#include <inc/epoll.h>
 #include <lwip/sockets.h>
 
 struct jif_pkt {
 	int jp_len;
+	int jp_flags;		// NIC_CSUM_* flags from <inc/syscall.h>
 	char jp_data[0];
 };
 
+// Packet rings between ns and its input and output environments.
+//
+// Each slot of a ring holds a struct jif_pkt at a fixed address in the
+// helper environment: JIF_RXSLOT in input, JIF_TXSLOT in output.  A TX
+// slot spans JIF_TX_PAGES pages, enough for a TSO frame.  ns, the parent
+// of both helpers, maps pages into and out of those slots itself.  The
+// struct jif_rings lives in a page ns shares with the helpers by
+// allocating it PTE_SHARE before forking them.
+//
+// The producer fills slot jr_prod and then advances jr_prod; the
+// consumer empties slot jr_cons and then advances jr_cons.  Both count
+// up forever and are taken modulo JIF_RING_SLOTS.  A side with nothing
+// to do sets its wait flag and sleeps in ipc_recv (jifring_wait); the
+// other side sends it a page-less IPC, the doorbell, once it has moved
+// its index and sees the flag (jifring_notify).  A full ring makes the
+// producer wait, so a slow consumer holds its producer back instead of
+// losing frames.
+#define JIF_RING_SLOTS	64
+
+struct jif_ring {
+	volatile uint32_t jr_prod;	// Next slot the producer fills
+	volatile uint32_t jr_cons;	// Next slot the consumer empties
+	volatile uint32_t jr_pwait;	// Producer sleeps until jr_cons moves
+	volatile uint32_t jr_cwait;	// Consumer sleeps until jr_prod moves
+	uint8_t jr_pad[48];		// Keep the rings on separate cache lines
+};
+
+struct jif_rings {
+	struct jif_ring rx;		// input -> ns
+	struct jif_ring tx;		// ns -> output
+};
+
+#define JIF_RINGS	((struct jif_rings *) 0x0d000000)
+#define JIF_RXSLOT(i)	(0x0d400000 + ((i) % JIF_RING_SLOTS) * PGSIZE)
+#define JIF_TX_PAGES	17	// a 64 KB frame plus struct jif_pkt
+#define JIF_TXSLOT(i)	\
+	(0x0e000000 + ((i) % JIF_RING_SLOTS) * JIF_TX_PAGES * PGSIZE)
+
+// Most buffer pages a bulk request lends to ns.
+#define NSIPC_BULK_PAGES	16
+
 // Definitions for requests from clients to network server
 enum {
 	// The following messages pass a page containing an Nsipc.
@@ -26,17 +70,67 @@ enum {
 	NSREQ_RECV,
 	NSREQ_SEND,
 	NSREQ_SOCKET,
-
-	// The following two messages pass a page containing a struct jif_pkt
+	// Poll waits like poll() and returns the revents on the request
+	// page.  The fd fields of req_fds hold socket ids.
+	NSREQ_POLL,
+	// Ioctl returns the updated req_arg on the request page.
+	NSREQ_IOCTL,
+	// Epoll create passes the new struct epoll_ring instead of an
+	// Nsipc; ns keeps it mapped until epoll close.
+	NSREQ_EPOLL_CREATE,
+	NSREQ_EPOLL_CTL,
+	NSREQ_EPOLL_WAIT,
+	NSREQ_EPOLL_CLOSE,
+	// Bulk recv and send lend the pages of the caller's buffer, sent
+	// with ipc_sendv right after the request page, instead of copying
+	// the data through it.  The data starts req_off bytes into the
+	// first lent page.
+	NSREQ_RECV_BULK,
+	NSREQ_SEND_BULK,
+	// Sendfile is a bulk send of file pages the caller will not touch
+	// again: ns queues them on the connection in place, without a
+	// copy, and keeps them until they are acknowledged.
+	NSREQ_SENDFILE,
+	// Stats returns a Nsret_stats on the request page.
+	NSREQ_STATS,
+
+	// The following two messages pass no page; they are the doorbells
+	// of the packet rings.  NSREQ_INPUT is sent by the input
+	// environment to ns when it adds frames to the RX ring, and by ns
+	// to input when it frees RX slots.  NSREQ_OUTPUT is sent by ns to
+	// the output environment when it adds frames to the TX ring.
 	NSREQ_INPUT,
-	// NSREQ_OUTPUT, unlike all other messages, is sent *from* the
-	// network server, to the output environment
 	NSREQ_OUTPUT,
+};
+
+// Counters of one protocol, and the use of one memory pool, as kept by
+// lwIP (see lwip/stats.h).  Pool sizes are in elements, except for the
+// heap's, which are in bytes.
+struct ns_proto_stats {
+	char ps_name[8];
+	uint32_t ps_xmit;
+	uint32_t ps_recv;
+	uint32_t ps_drop;
+	uint32_t ps_chkerr;
+	uint32_t ps_lenerr;
+	uint32_t ps_memerr;
+	uint32_t ps_rterr;
+	uint32_t ps_proterr;
+	uint32_t ps_opterr;
+	uint32_t ps_err;
+};
 
-	// The following message passes no page
-	NSREQ_TIMER,
+struct ns_mem_stats {
+	char ms_name[16];
+	uint32_t ms_avail;
+	uint32_t ms_used;
+	uint32_t ms_max;		// Most ever in use at once
+	uint32_t ms_err;		// Allocations that failed
 };
 
+#define NS_STATS_PROTOS	8
+#define NS_STATS_MEMS	24
+
 union Nsipc {
 	struct Nsreq_accept {
 		int req_s;
@@ -91,12 +185,60 @@ union Nsipc {
 		char req_buf[0];
 	} send;
 
+	struct Nsreq_bulk {
+		int req_s;
+		int req_len;
+		unsigned int req_flags;
+		int req_off;
+	} bulk;
+
 	struct Nsreq_socket {
 		int req_domain;
 		int req_type;
 		int req_protocol;
 	} socket;
 
+	struct Nsreq_poll {
+		int req_nfds;
+		int req_timeout;	// msec; < 0 waits forever
+		struct pollfd req_fds[0];
+	} poll;
+
+	struct Nsreq_ioctl {
+		int req_s;
+		long req_cmd;
+		uint32_t req_arg;
+	} ioctl;
+
+	struct Nsreq_epoll_ctl {
+		int req_epid;
+		int req_op;
+		int req_s;
+		uint32_t req_events;
+		uint32_t req_data;
+	} epoll_ctl;
+
+	struct Nsreq_epoll_wait {
+		int req_epid;
+		int req_timeout;	// msec; < 0 waits forever
+	} epoll_wait;
+
+	struct Nsreq_epoll_close {
+		int req_epid;
+	} epoll_close;
+
+	struct Nsret_stats {
+		int ret_nprotos;
+		struct ns_proto_stats ret_protos[NS_STATS_PROTOS];
+		int ret_nmems;
+		struct ns_mem_stats ret_mems[NS_STATS_MEMS];
+		// TCP configuration, to read the numbers by
+		uint32_t ret_tcp_mss;
+		uint32_t ret_tcp_wnd;
+		uint32_t ret_tcp_rcv_scale;
+		uint32_t ret_tcp_snd_buf;
+	} statsRet;
+
 	struct jif_pkt pkt;
 
 	// Ensure Nsipc is one page
@@ -0,0 +1,18 @@
+// Definitions for poll(), the readiness multiplexer in lib/poll.c.
+
+#ifndef JOS_INC_POLL_H
+#define JOS_INC_POLL_H
+
+struct pollfd {
+	int fd;			// File descriptor to poll; < 0 is skipped
+	short events;		// Events of interest
+	short revents;		// Events that occurred
+};
+
+#define POLLIN		0x0001	// Data may be read without blocking
+#define POLLOUT		0x0004	// Data may be written without blocking
+#define POLLERR		0x0008	// Error; always reported
+#define POLLHUP		0x0010	// Other end closed; always reported
+#define POLLNVAL	0x0020	// fd is not open; always reported
+
+#endif	// not JOS_INC_POLL_H
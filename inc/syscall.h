@@ -20,7 +20,43 @@ enum {
 	SYS_time_msec,
     SYS_nic_transmit,
     SYS_nic_recv,
+    SYS_nic_wait,
+    SYS_nic_transmit_batch,
+    SYS_nic_recv_batch,
+    SYS_nic_wait_tx,
+    SYS_sleep_until,
+    SYS_ipc_recv_until,
+    SYS_ipc_try_sendv,
 	NSYSCALLS
 };
 
+// Most pages one SYS_ipc_try_sendv call maps.
+#define IPC_MAXPAGES	32
+
+// Most frames one SYS_nic_*_batch call moves.
+#define NIC_BATCH_MAX	64
+
+// Checksum offload flags for frames passed to and from the NIC.
+#define NIC_CSUM_OFFLOAD	0x1	// tx: NIC fills in IPv4/TCP/UDP checksums
+#define NIC_CSUM_IP_OK		0x2	// rx: NIC verified the IPv4 header checksum
+#define NIC_CSUM_L4_OK		0x4	// rx: NIC verified the TCP or UDP checksum
+#define NIC_TSO			0x8	// tx: NIC splits a large TCP frame
+
+// A NIC_TSO frame carries the segment size in the top 16 bits of its flags.
+#define NIC_TSO_FLAGS(mss)	(NIC_TSO | NIC_CSUM_OFFLOAD | ((mss) << 16))
+#define NIC_TSO_MSS(flags)	((uint32_t)(flags) >> 16)
+
+// One frame for SYS_nic_transmit_batch.
+struct nic_pkt {
+	const void *np_data;
+	int np_len;
+	int np_flags;		// NIC_CSUM_OFFLOAD
+};
+
+// One frame returned by SYS_nic_recv_batch.
+struct nic_rx {
+	int nr_len;
+	int nr_flags;		// NIC_CSUM_*_OK
+};
+
 #endif /* !JOS_INC_SYSCALL_H */
@@ -2,14 +2,32 @@
 #include <kern/e1000.h>
 #include <kern/pmap.h>
 #include <inc/string.h>
+#include <inc/error.h>
+#include <inc/syscall.h>
+#include <kern/env.h>
+#include <kern/picirq.h>
+#include <kern/sched.h>
 
 #define MAC_HIGH 0x5634
 #define MAC_LOW 0x12005452
 
-#define TX_QUEUE_SIZE 32
-#define TX_BUFFER_SIZE 2048
-#define RX_QUEUE_SIZE 256
+//ring sizes come from the build: make E1000_TX_RING=n E1000_RX_RING=n
+#ifndef E1000_TX_RING
+#define E1000_TX_RING 256
+#endif
+#ifndef E1000_RX_RING
+#define E1000_RX_RING 256
+#endif
+#define TX_QUEUE_SIZE E1000_TX_RING
+#define TX_PACKET_SIZE 2048
+//largest frame the NIC will segment: an ethernet header and a 64 KB ip packet
+#define TSO_PACKET_SIZE (14 + 0xffff)
+#define RX_QUEUE_SIZE E1000_RX_RING
 #define RX_BUFFER_SIZE 2048
+//descriptor rings must be a multiple of 128 bytes, i.e. 8 descriptors
+#if TX_QUEUE_SIZE % 8 != 0 || RX_QUEUE_SIZE % 8 != 0 || TX_QUEUE_SIZE < E1000_TX_MAX_SEGS + 8
+#error "e1000 ring sizes must be multiples of 8 with room for a whole packet"
+#endif
 
 #define DEVICE_STATUS_REG 2
 #define TDBAL (0x3800 / 4)
@@ -37,9 +55,24 @@
 #define RA_LIMIT 16
 #define MTA_BASE (0x5200 / 4)
 #define MTA_LIMIT 128
+#define ICR (0xc0 / 4)
+#define ITR (0xc4 / 4)
 #define IMS (0xd0 / 4)
 #define IMC (0xd8 / 4)
 #define INT_ALL_MASK ((1 << 17) - 1)
+#define INT_TXDW (1 << 0)
+#define INT_RXDMT0 (1 << 4)
+#define INT_RXO (1 << 6)
+#define INT_RXT0 (1 << 7)
+#define INT_RX_MASK (INT_RXDMT0 | INT_RXO | INT_RXT0)
+//at most one interrupt per 200us, in units of 256ns
+#define ITR_INTERVAL 781
+#define RDTR (0x2820 / 4)
+#define RADV (0x282c / 4)
+//rx interrupt delay after each frame, and the most a frame may be
+//held back by it, in units of 1.024us
+#define RDTR_DELAY 16
+#define RADV_DELAY 64
 #define RDBAL (0x2800 / 4)
 #define RDBAH (0x2804 / 4)
 #define RDLEN (0x2808 / 4)
@@ -64,14 +97,40 @@
 #define RCTL_BSIZE_MASK (0x3 << 16)
 #define RCTL_BSIZE_2048 (0x0 << 16)
 #define RCTL_SECRC (1 << 26)
+#define RXCSUM (0x5000 / 4)
+#define RXCSUM_IPOFL (1 << 8)
+#define RXCSUM_TUOFL (1 << 9)
 
 #define STATUS_DD (1 << 0)
 #define CMD_EOP (1 << 0)
 #define CMD_RS (1 << 3)
 #define CMD_DEXT (1 << 5)
 
+#define DTYP_CTX 0
+#define DTYP_DATA 1
+#define TUCMD_TCP (1 << 0)
+#define TUCMD_IP (1 << 1)
+#define TUCMD_TSE (1 << 2)
+#define TUCMD_RS (1 << 3)
+#define TUCMD_DEXT (1 << 5)
+#define DCMD_EOP (1 << 0)
+#define DCMD_TSE (1 << 2)
+#define DCMD_RS (1 << 3)
+#define DCMD_DEXT (1 << 5)
+#define POPTS_IXSM (1 << 0)
+#define POPTS_TXSM (1 << 1)
+
 #define RX_STATUS_DD (1 << 0)
 #define RX_STATUS_EOP (1 << 1)
+#define RX_STATUS_IXSM (1 << 2)
+#define RX_STATUS_TCPCS (1 << 5)
+#define RX_STATUS_IPCS (1 << 6)
+#define RX_ERR_TCPE (1 << 5)
+#define RX_ERR_IPE (1 << 6)
+
+#define ETH_HLEN 14
+#define IP_PROTO_TCP 6
+#define IP_PROTO_UDP 17
 
 #define DEVICE(dev) (((dev) >> 16) & 0xffff)
 #define VENDOR(dev) ((dev) & 0xffff)
@@ -85,8 +144,31 @@ struct tx_desc{
     uint8_t css;
     uint8_t special;
 };
-struct tx_buffer{
-    uint8_t buffer[TX_BUFFER_SIZE];
+//tcp/ip context descriptor: sets up checksum offload for the data
+//descriptors that follow it
+struct tx_ctx_desc{
+    uint8_t ipcss;
+    uint8_t ipcso;
+    uint16_t ipcse;
+    uint8_t tucss;
+    uint8_t tucso;
+    uint16_t tucse;
+    uint32_t paylen : 20;
+    uint32_t dtyp : 4;
+    uint32_t tucmd : 8;
+    uint8_t status;
+    uint8_t hdrlen;
+    uint16_t mss;
+};
+//extended data descriptor, used for packets with offloads
+struct tx_data_desc{
+    uint64_t addr;
+    uint32_t length : 20;
+    uint32_t dtyp : 4;
+    uint32_t dcmd : 8;
+    uint8_t status;
+    uint8_t popts;
+    uint16_t special;
 };
 struct rx_desc{
     uint64_t addr;
@@ -96,15 +178,18 @@ struct rx_desc{
     uint8_t err;
     uint16_t special;
 };
-struct rx_buffer{
-    uint8_t buffer[RX_BUFFER_SIZE];
-};
 
-struct tx_desc descs[TX_QUEUE_SIZE];
-struct tx_buffer buffers[TX_QUEUE_SIZE];
-struct rx_desc rxdescs[RX_QUEUE_SIZE];
-struct rx_buffer rxbuffers[RX_QUEUE_SIZE];
+struct tx_desc descs[TX_QUEUE_SIZE] __attribute__((aligned(128)));
+//page each tx descriptor points into, pinned until the descriptor is done
+struct PageInfo* txpages[TX_QUEUE_SIZE];
+struct rx_desc rxdescs[RX_QUEUE_SIZE] __attribute__((aligned(128)));
+//page each rx descriptor fills; handed to the receiver whole
+struct PageInfo* rxpages[RX_QUEUE_SIZE];
 volatile uint32_t* mmio;
+int e1000_irq = -1;
+//envs blocked in sys_nic_wait and sys_nic_wait_tx, if any
+static envid_t rx_waiter;
+static envid_t tx_waiter;
 int e1000_82540em_attach(struct pci_func* pcif){
     //enable device
     pci_func_enable(pcif);
@@ -121,7 +206,7 @@ int e1000_82540em_attach(struct pci_func* pcif){
         descs[i].css = 0;
         descs[i].special = 0;
     }
-    cprintf("PCI[%04x:%04x] E1000-82540EM-A tx buffer count:%d, size:%d\n", VENDOR(pcif->dev_id), DEVICE(pcif->dev_id), TX_QUEUE_SIZE, TX_BUFFER_SIZE);
+    cprintf("PCI[%04x:%04x] E1000-82540EM-A tx descriptor count:%d, max packet:%d\n", VENDOR(pcif->dev_id), DEVICE(pcif->dev_id), TX_QUEUE_SIZE, TX_PACKET_SIZE);
     //install tx queue
     mmio[TDBAL] = PADDR(descs);
     mmio[TDBAH] = 0;
@@ -135,12 +220,18 @@ int e1000_82540em_attach(struct pci_func* pcif){
     mmio[RAH_BASE] = RAH_RAH(MAC_HIGH) | RAH_AV | RAH_AS_DEST;
     for(int i = 0;i < MTA_LIMIT;i++)
         mmio[MTA_BASE + i] = 0;
-    //disable interrupt now
+    //only rx interrupts, throttled and delayed so a burst raises one
     mmio[IMC] = INT_ALL_MASK;
-    //skip RDTR due to disabled RDMT interrupt
+    mmio[ITR] = ITR_INTERVAL;
+    mmio[RDTR] = RDTR_DELAY;
+    mmio[RADV] = RADV_DELAY;
     //setup rx queue
     for(int i = 0;i < RX_QUEUE_SIZE;i++){
-        rxdescs[i].addr = PADDR(rxbuffers[i].buffer);
+        rxpages[i] = page_alloc(ALLOC_ZERO);
+        if(!rxpages[i])
+            panic("e1000: out of memory for rx pages");
+        rxpages[i] -> pp_ref++;
+        rxdescs[i].addr = page2pa(rxpages[i]) + E1000_RX_OFFSET;
         rxdescs[i].checksum = 0;
         rxdescs[i].length = 0;
         rxdescs[i].err = 0;
@@ -154,43 +245,278 @@ int e1000_82540em_attach(struct pci_func* pcif){
     mmio[RDLEN] = RX_QUEUE_SIZE * sizeof(struct rx_desc);
     mmio[RDH] = 0;
     mmio[RDT] = RX_QUEUE_SIZE - 1;
+    //verify ip, tcp and udp checksums
+    mmio[RXCSUM] = RXCSUM_IPOFL | RXCSUM_TUOFL;
     //other rctl settings
     mmio[RCTL] = RCTL_EN | (~RCTL_LPE) | RCTL_LBM_NOLOOP | RCTL_RDMTS_ONE_EIGHTH | RCTL_MO_47 | RCTL_BAM | RCTL_BSIZE_2048 | RCTL_SECRC;
+    //route the interrupt
+    e1000_irq = pcif -> irq_line;
+    mmio[ICR];
+    mmio[IMS] = INT_RX_MASK;
+    irq_setmask_8259A(irq_mask_8259A & ~(1 << e1000_irq));
+    return 0;
+}
+
+//next tx descriptor to fill; the NIC learns of it in e1000_82540em_flush_tx
+static uint32_t txtail = 0;
+//oldest tx descriptor not yet reclaimed
+static uint32_t txclean = 0;
+//checksum context the NIC was last given, so it is only sent on change
+static struct e1000_csum txctx;
+static bool txctx_valid;
+
+//prepare an ethernet frame for checksum offload: zero the ip checksum,
+//seed the tcp/udp checksum with the pseudo-header sum as the NIC wants,
+//and fill in *cs.  returns -1 if the frame is not ipv4.  tcp and udp
+//checksums of fragments are left alone, as they cover the whole datagram.
+//with mss, a tcp frame is also set up to be cut into mss sized segments;
+//the NIC then fixes up lengths, ids and checksums of each one
+int e1000_82540em_csum_setup(uint8_t* frame, int size, int mss, struct e1000_csum* cs){
+    if(size < ETH_HLEN + 20 || frame[12] != 0x08 || frame[13] != 0x00)
+        return -1;
+    uint8_t* ip = frame + ETH_HLEN;
+    int ihl = (ip[0] & 0xf) * 4;
+    int iplen = (ip[2] << 8) | ip[3];
+    if((ip[0] >> 4) != 4 || ihl < 20 || iplen < ihl || ETH_HLEN + iplen > size)
+        return -1;
+    memset(cs, 0, sizeof(*cs));
+    cs -> ipcss = ETH_HLEN;
+    cs -> ipcso = ETH_HLEN + 10;
+    cs -> ipcse = ETH_HLEN + ihl - 1;
+    cs -> tucmd = TUCMD_IP;
+    cs -> popts = POPTS_IXSM;
+    ip[10] = ip[11] = 0;
+
+    int frag = ((ip[6] << 8) | ip[7]) & 0x3fff;
+    int proto = ip[9];
+    int off = proto == IP_PROTO_TCP ? 16 : proto == IP_PROTO_UDP ? 6 : -1;
+    if(frag || off < 0 || iplen - ihl < off + 2)
+        return mss ? -1 : 0;
+    int hdrlen = ETH_HLEN + ihl + (proto == IP_PROTO_TCP ? (ip[ihl + 12] >> 4) * 4 : 0);
+    bool tso = mss > 0 && proto == IP_PROTO_TCP && size - hdrlen > mss;
+    if(mss && !tso && size > TX_PACKET_SIZE)
+        return -1;
+    //the pseudo-header sum leaves out the length for TSO, as each
+    //segment gets its own
+    uint32_t sum = proto + (tso ? 0 : iplen - ihl);
+    for(int i = 12;i < 20;i += 2)
+        sum += (ip[i] << 8) | ip[i + 1];
+    while(sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    ip[ihl + off] = sum >> 8;
+    ip[ihl + off + 1] = sum;
+    cs -> tucss = ETH_HLEN + ihl;
+    cs -> tucso = ETH_HLEN + ihl + off;
+    cs -> tucse = ETH_HLEN + iplen - 1;
+    if(proto == IP_PROTO_TCP)
+        cs -> tucmd |= TUCMD_TCP;
+    cs -> popts |= POPTS_TXSM;
+    if(tso){
+        cs -> tucse = 0;
+        cs -> tucmd |= TUCMD_TSE;
+        cs -> hdrlen = hdrlen;
+        cs -> mss = mss;
+        cs -> paylen = size - hdrlen;
+    }
     return 0;
 }
 
-int e1000_82540em_send(const void* packet, int size){
-    if(size > TX_BUFFER_SIZE)
+//release the pages of every packet the NIC has finished sending;
+//returns the number of descriptors free for new packets.  one slot
+//stays empty so a full ring is not mistaken for an empty one
+static int e1000_82540em_reclaim_tx(void){
+    while(txclean != txtail && (descs[txclean].status & STATUS_DD)){
+        if(txpages[txclean]){
+            page_decref(txpages[txclean]);
+            txpages[txclean] = NULL;
+        }
+        txclean = (txclean + 1) % TX_QUEUE_SIZE;
+    }
+    return TX_QUEUE_SIZE - 1 - (txtail + TX_QUEUE_SIZE - txclean) % TX_QUEUE_SIZE;
+}
+
+//queue one packet made of nsegs pieces, one descriptor per piece;
+//the NIC reads the pages directly, so nothing is copied.  with cs, the
+//NIC inserts checksums, which may take one more descriptor for the context
+int e1000_82540em_queue(const struct e1000_seg* segs, int nsegs, const struct e1000_csum* cs){
+    int size = 0;
+    for(int i = 0;i < nsegs;i++)
+        size += segs[i].length;
+    if(nsegs > E1000_TX_MAX_SEGS || size > (cs && cs -> mss ? TSO_PACKET_SIZE : TX_PACKET_SIZE))
         return -E_PACKET_TOO_BIG;
-    uint32_t next = mmio[TDT];
-    if(!(descs[next].status & STATUS_DD))
+    bool newctx = cs && (!txctx_valid || memcmp(cs, &txctx, sizeof(txctx)) != 0);
+    //every descriptor the packet needs must be free before any is used
+    if(e1000_82540em_reclaim_tx() < nsegs + newctx)
         return -E_TX_OVERFLOW;
-    memcpy(buffers[next].buffer, packet, size);
-    descs[next].addr = PADDR(&buffers[next].buffer);
-    descs[next].length = size;
-    descs[next].cmd |= CMD_RS | CMD_EOP;
-    descs[next].cmd &= (~CMD_DEXT);
-    descs[next].status &= (~STATUS_DD);
-    mmio[TDT] = (next + 1) % TX_QUEUE_SIZE;
+    if(newctx){
+        struct tx_ctx_desc* ctx = (struct tx_ctx_desc*)&descs[txtail];
+        memset(ctx, 0, sizeof(*ctx));
+        ctx -> ipcss = cs -> ipcss;
+        ctx -> ipcso = cs -> ipcso;
+        ctx -> ipcse = cs -> ipcse;
+        ctx -> tucss = cs -> tucss;
+        ctx -> tucso = cs -> tucso;
+        ctx -> tucse = cs -> tucse;
+        ctx -> hdrlen = cs -> hdrlen;
+        ctx -> mss = cs -> mss;
+        ctx -> paylen = cs -> paylen;
+        ctx -> dtyp = DTYP_CTX;
+        ctx -> tucmd = cs -> tucmd | TUCMD_RS | TUCMD_DEXT;
+        txpages[txtail] = NULL;
+        txtail = (txtail + 1) % TX_QUEUE_SIZE;
+        txctx = *cs;
+        txctx_valid = 1;
+    }
+    for(int i = 0;i < nsegs;i++){
+        uint32_t next = (txtail + i) % TX_QUEUE_SIZE;
+        txpages[next] = segs[i].page;
+        segs[i].page -> pp_ref++;
+        if(cs){
+            struct tx_data_desc* d = (struct tx_data_desc*)&descs[next];
+            memset(d, 0, sizeof(*d));
+            d -> addr = page2pa(segs[i].page) + segs[i].offset;
+            d -> length = segs[i].length;
+            d -> dtyp = DTYP_DATA;
+            d -> dcmd = DCMD_RS | DCMD_DEXT | (i == nsegs - 1 ? DCMD_EOP : 0);
+            if(cs -> mss)
+                d -> dcmd |= DCMD_TSE;
+            //only the first descriptor's options count
+            d -> popts = i == 0 ? cs -> popts : 0;
+            continue;
+        }
+        descs[next].addr = page2pa(segs[i].page) + segs[i].offset;
+        descs[next].length = segs[i].length;
+        descs[next].cso = 0;
+        descs[next].css = 0;
+        descs[next].cmd = CMD_RS;
+        if(i == nsegs - 1)
+            descs[next].cmd |= CMD_EOP;
+        descs[next].status &= (~STATUS_DD);
+    }
+    txtail = (txtail + nsegs) % TX_QUEUE_SIZE;
     return 0;
 }
 
-int e1000_82540em_recv(void* buf, int limit){
-    static int next = 0;
+//hand every queued descriptor to the NIC with one tail write
+void e1000_82540em_flush_tx(void){
+    mmio[TDT] = txtail;
+}
+
+int e1000_82540em_send(const struct e1000_seg* segs, int nsegs, const struct e1000_csum* cs){
+    int r = e1000_82540em_queue(segs, nsegs, cs);
+    if(r == 0)
+        e1000_82540em_flush_tx();
+    return r;
+}
+
+//index of the next rx descriptor to hand out
+static int rxnext = 0;
+
+//take the page holding the next received frame out of the ring and
+//put a fresh one in its place; the frame starts E1000_RX_OFFSET bytes
+//into *page, and the caller owns the reference it comes with.
+//the descriptor goes back to the NIC in e1000_82540em_flush_rx.
+//*flags says which checksums the NIC found good
+int e1000_82540em_take(struct PageInfo** page, int* flags){
+    int next = rxnext;
     int size = 0;
     if(!(rxdescs[next].status & RX_STATUS_DD))
         return -E_RX_NOT_RECV;
     if(!(rxdescs[next].status & RX_STATUS_EOP)){
+        //drop it and let the NIC refill the same page
         size = -E_RX_LONG_PACKET;
         goto end;
     }
-    int packet_size = rxdescs[next].length;
-    size = (packet_size > limit) ? limit : packet_size;
-    memcpy(buf, rxbuffers[next].buffer, size);
+    struct PageInfo* fresh = page_alloc(ALLOC_ZERO);
+    if(!fresh)
+        return -E_NO_MEM;
+    fresh -> pp_ref++;
+    *page = rxpages[next];
+    rxpages[next] = fresh;
+    rxdescs[next].addr = page2pa(fresh) + E1000_RX_OFFSET;
+    size = rxdescs[next].length;
+    uint8_t status = rxdescs[next].status;
+    uint8_t err = rxdescs[next].err;
+    *flags = 0;
+    if(!(status & RX_STATUS_IXSM)){
+        uint8_t* frame = (uint8_t*)page2kva(*page) + E1000_RX_OFFSET;
+        bool frag = size >= ETH_HLEN + 20 && (((frame[ETH_HLEN + 6] << 8) | frame[ETH_HLEN + 7]) & 0x3fff);
+        if((status & RX_STATUS_IPCS) && !(err & RX_ERR_IPE))
+            *flags |= NIC_CSUM_IP_OK;
+        if((status & RX_STATUS_TCPCS) && !(err & RX_ERR_TCPE) && !frag)
+            *flags |= NIC_CSUM_L4_OK;
+    }
 end:
     rxdescs[next].status = 0;
-    next = (next + 1) % RX_QUEUE_SIZE;
-    uint32_t rdt = mmio[RDT];
-    mmio[RDT] = (rdt + 1) % RX_QUEUE_SIZE;
+    rxnext = (next + 1) % RX_QUEUE_SIZE;
     return size;
 }
+
+//give every descriptor taken so far back to the NIC with one tail write;
+//the tail trails the next descriptor to take by one
+void e1000_82540em_flush_rx(void){
+    mmio[RDT] = (rxnext + RX_QUEUE_SIZE - 1) % RX_QUEUE_SIZE;
+}
+
+int e1000_82540em_recv(struct PageInfo** page){
+    int flags;
+    int size = e1000_82540em_take(page, &flags);
+    e1000_82540em_flush_rx();
+    return size;
+}
+
+//return at once if a frame is waiting, otherwise put env to sleep until
+//the next rx interrupt; only one env may wait at a time
+int e1000_82540em_wait(struct Env* env){
+    if(rxdescs[rxnext].status & RX_STATUS_DD)
+        return 0;
+    if(rx_waiter && rx_waiter != env -> env_id){
+        struct Env* other;
+        if(envid2env(rx_waiter, &other, 0) == 0 && other -> env_status == ENV_NOT_RUNNABLE)
+            return -E_INVAL;
+    }
+    rx_waiter = env -> env_id;
+    env -> env_status = ENV_NOT_RUNNABLE;
+    env -> env_dev_wait = 1;
+    env -> env_tf.tf_regs.reg_eax = 0;
+    sched_yield();
+}
+
+//return at once if a whole packet fits in the tx ring, otherwise put
+//env to sleep until the NIC reports sent descriptors
+int e1000_82540em_wait_tx(struct Env* env){
+    //one more descriptor for a checksum context
+    if(e1000_82540em_reclaim_tx() >= E1000_TX_MAX_SEGS + 1)
+        return 0;
+    if(tx_waiter && tx_waiter != env -> env_id){
+        struct Env* other;
+        if(envid2env(tx_waiter, &other, 0) == 0 && other -> env_status == ENV_NOT_RUNNABLE)
+            return -E_INVAL;
+    }
+    tx_waiter = env -> env_id;
+    env -> env_status = ENV_NOT_RUNNABLE;
+    env -> env_dev_wait = 1;
+    env -> env_tf.tf_regs.reg_eax = 0;
+    //tx interrupts are only wanted while someone waits for them
+    mmio[IMS] = INT_TXDW;
+    sched_yield();
+}
+
+static void wakeup(envid_t* waiter){
+    struct Env* env;
+    if(*waiter && envid2env(*waiter, &env, 0) == 0 && env -> env_status == ENV_NOT_RUNNABLE){
+        env -> env_status = ENV_RUNNABLE;
+        env -> env_dev_wait = 0;
+    }
+    *waiter = 0;
+}
+
+void e1000_82540em_intr(void){
+    uint32_t cause = mmio[ICR];
+    if(cause & INT_RX_MASK)
+        wakeup(&rx_waiter);
+    if(cause & INT_TXDW){
+        mmio[IMC] = INT_TXDW;
+        wakeup(&tx_waiter);
+    }
+}
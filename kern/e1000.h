@@ -3,6 +3,8 @@
 #endif  // SOL >= 6
 
 #include <kern/pci.h>
+#include <inc/memlayout.h>
+#include <inc/env.h>
 #define PCI_82540EM_VENDOR 0x8086
 #define PCI_82540EM_DESKTOP_DEVICE 0x100e
 #define PCI_82540EM_MOBILE_DEVICE 0X1015
@@ -14,6 +16,49 @@
 
 #define PCI_82540EM_DESKTOP_ATTACH \
     { PCI_82540EM_VENDOR, PCI_82540EM_DESKTOP_DEVICE, e1000_82540em_attach }
+//where a received frame starts in its page; leaves room for the
+//length and flags words of the struct jif_pkt the network server expects
+#define E1000_RX_OFFSET 8
+
+//most descriptors a single packet may be split across: enough for a
+//64 KB TSO frame starting anywhere in a page
+#define E1000_TX_MAX_SEGS 18
+
+//a piece of an outgoing packet, in place in a physical page;
+//the driver holds a reference on the page until the NIC is done with it
+struct e1000_seg{
+    struct PageInfo* page;
+    uint16_t offset;
+    uint16_t length;
+};
+
+//checksum offload settings for one packet, see e1000_82540em_csum_setup
+struct e1000_csum{
+    uint8_t ipcss;
+    uint8_t ipcso;
+    uint16_t ipcse;
+    uint8_t tucss;
+    uint8_t tucso;
+    uint16_t tucse;
+    uint8_t tucmd;
+    uint8_t popts;
+    //segmentation, for TSO frames only
+    uint8_t hdrlen;
+    uint16_t mss;
+    uint32_t paylen;
+};
+
 int e1000_82540em_attach(struct pci_func* pcif);
-int e1000_82540em_send(const void* packet, int size);
-int e1000_82540em_recv(void* buf, int limit);
+int e1000_82540em_csum_setup(uint8_t* frame, int size, int mss, struct e1000_csum* cs);
+int e1000_82540em_send(const struct e1000_seg* segs, int nsegs, const struct e1000_csum* cs);
+int e1000_82540em_queue(const struct e1000_seg* segs, int nsegs, const struct e1000_csum* cs);
+void e1000_82540em_flush_tx(void);
+int e1000_82540em_recv(struct PageInfo** page);
+int e1000_82540em_take(struct PageInfo** page, int* flags);
+void e1000_82540em_flush_rx(void);
+int e1000_82540em_wait(struct Env* env);
+int e1000_82540em_wait_tx(struct Env* env);
+void e1000_82540em_intr(void);
+
+//irq line of the attached NIC, -1 if there is none
+extern int e1000_irq;
@@ -4,9 +4,14 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/time.h>
+#include <inc/error.h>
 
 void sched_halt(void);
 
+// Earliest env_wakeup of any environment, or 0 if none is sleeping.
+static uint32_t next_wakeup;
+
 // Choose a user environment to run and run it.
 void
 sched_yield(void)
@@ -53,6 +58,46 @@ sched_yield(void)
 	sched_halt();
 }
 
+//block e until time_msec() reaches msec, or until something else makes
+//it runnable first (an ipc, for sys_ipc_recv_until)
+void
+sched_sleep(struct Env *e, uint32_t msec)
+{
+    e -> env_wakeup = msec;
+    e -> env_status = ENV_NOT_RUNNABLE;
+    if(!next_wakeup || msec < next_wakeup)
+        next_wakeup = msec;
+}
+
+//called on every clock tick: make the envs whose sleep is over runnable;
+//one still blocked in sys_ipc_recv_until gets -E_TIMEOUT back
+void
+sched_wake_sleepers(void)
+{
+    uint32_t now = time_msec(), next = 0;
+    if(!next_wakeup || now < next_wakeup)
+        return;
+    for(int i = 0;i < NENV;i++){
+        struct Env* e = &envs[i];
+        if(!e -> env_wakeup)
+            continue;
+        if(e -> env_status != ENV_NOT_RUNNABLE){
+            e -> env_wakeup = 0;
+            continue;
+        }
+        if(e -> env_wakeup > now){
+            if(!next || e -> env_wakeup < next)
+                next = e -> env_wakeup;
+            continue;
+        }
+        e -> env_wakeup = 0;
+        e -> env_tf.tf_regs.reg_eax = e -> env_ipc_recving ? -E_TIMEOUT : 0;
+        e -> env_ipc_recving = 0;
+        e -> env_status = ENV_RUNNABLE;
+    }
+    next_wakeup = next;
+}
+
 // Halt this CPU when there is nothing to do. Wait until the
 // timer interrupt wakes it up. This function never returns.
 //
@@ -68,6 +113,10 @@ sched_halt(void)
 		     envs[i].env_status == ENV_RUNNING ||
 		     envs[i].env_status == ENV_DYING))
 			break;
+		// An interrupt will make these runnable again.
+		if (envs[i].env_status == ENV_NOT_RUNNABLE &&
+		    (envs[i].env_wakeup || envs[i].env_dev_wait))
+			break;
 	}
 	if (i == NENV) {
 		cprintf("No runnable environments in the system!\n");
@@ -6,7 +6,14 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/types.h>
+
+struct Env;
+
 // This function does not return.
 void sched_yield(void) __attribute__((noreturn));
 
+void sched_sleep(struct Env *e, uint32_t msec);
+void sched_wake_sleepers(void);
+
 #endif	// !JOS_KERN_SCHED_H
@@ -361,9 +361,12 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
     dstenv -> env_ipc_value = value;
     dstenv -> env_ipc_from = curenv -> env_id;
     dstenv -> env_ipc_perm = perm;
+    dstenv -> env_ipc_npages = send_page;
     //responsible for receiver's return value
     dstenv -> env_tf.tf_regs.reg_eax = 0;
     dstenv -> env_ipc_recving = 0;
+    //cancel the timeout of sys_ipc_recv_until
+    dstenv -> env_wakeup = 0;
 
     //enable scheduling
     dstenv -> env_status = ENV_RUNNABLE;
@@ -390,6 +393,7 @@ sys_ipc_recv(void *dstva)
 
     //install data, as syscall is marked as interrupt, it cam never be interrupted again
     curenv -> env_ipc_dstva = dstva;
+    curenv -> env_ipc_maxpages = 1;
     curenv -> env_ipc_recving = 1;
     curenv -> env_status = ENV_NOT_RUNNABLE;
     curenv -> env_ipc_perm = 0;
@@ -413,16 +417,210 @@ sys_time_msec(void)
     return time_msec();
 }
 
+//block until time_msec() reaches msec; the clock ticks every 10ms
 static int
-sys_nic_transmit(const void* packet, int size){
-    user_mem_assert(curenv, packet, size, PTE_U);
-    return e1000_82540em_send(packet, size);
+sys_sleep_until(uint32_t msec){
+    if(msec <= time_msec())
+        return 0;
+    sched_sleep(curenv, msec);
+    sched_yield();
+}
+
+//like sys_ipc_recv, but give up with -E_TIMEOUT once time_msec()
+//reaches msec, and take up to npages pages from sys_ipc_try_sendv
+static int
+sys_ipc_recv_until(void* dstva, int npages, uint32_t msec){
+    if((uint32_t)dstva < UTOP && (uint32_t)dstva % PGSIZE)
+        return -E_INVAL;
+    if(npages < 1 || npages > IPC_MAXPAGES
+       || (uint32_t)dstva + npages * PGSIZE > UTOP)
+        npages = 1;
+    if(msec <= time_msec())
+        return -E_TIMEOUT;
+    curenv -> env_ipc_dstva = dstva;
+    curenv -> env_ipc_maxpages = npages;
+    curenv -> env_ipc_recving = 1;
+    curenv -> env_ipc_perm = 0;
+    curenv -> env_ipc_from = curenv -> env_id;
+    sched_sleep(curenv, msec);
+    sched_yield();
+}
+
+//like sys_ipc_try_send, but maps each of the npgs pages pgs[i] at
+//dstva + i*PGSIZE in the receiver, all with perm.  a receiver that asked
+//for fewer pages (env_ipc_maxpages) gets only the first ones; it learns
+//how many from env_ipc_npages.  every page is checked before any is
+//mapped, so on error the receiver gets nothing
+static int
+sys_ipc_try_sendv(envid_t envid, uint32_t value, void* const* pgs, int npgs, unsigned perm){
+    struct Env* dstenv;
+    struct PageInfo* pages[IPC_MAXPAGES];
+    pte_t* pte;
+    int i, n;
+
+    if(envid2env(envid, &dstenv, 0) < 0)
+        return -E_BAD_ENV;
+    if(!dstenv -> env_ipc_recving)
+        return -E_IPC_NOT_RECV;
+    if(npgs < 1 || npgs > IPC_MAXPAGES)
+        return -E_INVAL;
+    user_mem_assert(curenv, pgs, npgs * sizeof(pgs[0]), PTE_U);
+    if((perm & (PTE_U|PTE_P)) != (PTE_U|PTE_P)
+       || (perm & ~(PTE_W|PTE_U|PTE_P|PTE_AVAIL)))
+        return -E_INVAL;
+    for(i = 0; i < npgs; i++){
+        if((uint32_t)pgs[i] >= UTOP || (uint32_t)pgs[i] % PGSIZE)
+            return -E_INVAL;
+        if(!(pages[i] = page_lookup(curenv -> env_pgdir, pgs[i], &pte)))
+            return -E_INVAL;
+        if((perm & PTE_W) && !(*pte & PTE_W))
+            return -E_INVAL;
+    }
+
+    n = 0;
+    if((uint32_t)dstenv -> env_ipc_dstva < UTOP)
+        n = MIN(npgs, dstenv -> env_ipc_maxpages);
+    for(i = 0; i < n; i++)
+        if(page_insert(dstenv -> env_pgdir, pages[i],
+                       (char*)dstenv -> env_ipc_dstva + i * PGSIZE, perm) < 0){
+            while(--i >= 0)
+                page_remove(dstenv -> env_pgdir,
+                            (char*)dstenv -> env_ipc_dstva + i * PGSIZE);
+            return -E_NO_MEM;
+        }
+
+    dstenv -> env_ipc_value = value;
+    dstenv -> env_ipc_from = curenv -> env_id;
+    dstenv -> env_ipc_perm = n ? perm : 0;
+    dstenv -> env_ipc_npages = n;
+    dstenv -> env_tf.tf_regs.reg_eax = 0;
+    dstenv -> env_ipc_recving = 0;
+    dstenv -> env_wakeup = 0;
+    dstenv -> env_status = ENV_RUNNABLE;
+    return 0;
+}
+
+//the packet is handed to the NIC in place: each page it spans becomes
+//one transmit descriptor, and the page stays allocated until it is sent;
+//the NIC is not told until e1000_82540em_flush_tx.  with NIC_CSUM_OFFLOAD
+//the headers are patched in place for the NIC to fill in the checksums,
+//and with NIC_TSO a large tcp frame is cut up by the NIC as well
+static int
+nic_queue(const void* packet, int size, int flags){
+    struct e1000_seg segs[E1000_TX_MAX_SEGS];
+    struct e1000_csum cs;
+    bool offload = 0;
+    int nsegs = 0;
+    uintptr_t va = (uintptr_t)packet;
+    int mss = (flags & NIC_TSO) ? NIC_TSO_MSS(flags) : 0;
+    if((flags & NIC_TSO) && (mss == 0 || !(flags & NIC_CSUM_OFFLOAD)))
+        return -E_INVAL;
+    if(flags & ~(NIC_CSUM_OFFLOAD | NIC_TSO | (mss << 16)))
+        return -E_INVAL;
+    if(size < 0)
+        return -E_INVAL;
+    if(flags & NIC_CSUM_OFFLOAD){
+        user_mem_assert(curenv, packet, size, PTE_U | PTE_W);
+        offload = e1000_82540em_csum_setup((uint8_t*)packet, size, mss, &cs) == 0;
+    }else
+        user_mem_assert(curenv, packet, size, PTE_U);
+    while(size > 0){
+        if(nsegs == E1000_TX_MAX_SEGS)
+            return -E_PACKET_TOO_BIG;
+        int len = MIN(size, PGSIZE - PGOFF(va));
+        segs[nsegs].page = page_lookup(curenv -> env_pgdir, (void*)va, NULL);
+        segs[nsegs].offset = PGOFF(va);
+        segs[nsegs].length = len;
+        nsegs++;
+        va += len;
+        size -= len;
+    }
+    int r = e1000_82540em_queue(segs, nsegs, offload ? &cs : NULL);
+    return r == -E_TX_OVERFLOW ? -E_NIC_BUSY : r;
+}
+
+static int
+sys_nic_transmit(const void* packet, int size, int flags){
+    int r = nic_queue(packet, size, flags);
+    e1000_82540em_flush_tx();
+    return r;
+}
+
+//queue up to n packets behind a single tail update; returns how many
+//were queued, which is less than n once the ring fills
+static int
+sys_nic_transmit_batch(const struct nic_pkt* pkts, int n){
+    if(n < 0 || n > NIC_BATCH_MAX)
+        return -E_INVAL;
+    user_mem_assert(curenv, pkts, n * sizeof(struct nic_pkt), PTE_U);
+    int i, r = 0;
+    for(i = 0;i < n;i++)
+        if((r = nic_queue(pkts[i].np_data, pkts[i].np_len, pkts[i].np_flags)) < 0)
+            break;
+    e1000_82540em_flush_tx();
+    return (i > 0 || r >= 0) ? i : r;
+}
+
+//map the page holding the next received frame at dstva, replacing
+//whatever was there; returns the frame length, and the frame itself
+//starts E1000_RX_OFFSET bytes into the page
+static int
+sys_nic_recv(void* dstva){
+    if((uint32_t)dstva >= UTOP || (uint32_t)dstva % PGSIZE != 0)
+        return -E_INVAL;
+    struct PageInfo* page;
+    int size = e1000_82540em_recv(&page);
+    if(size < 0)
+        return size;
+    int r = page_insert(curenv -> env_pgdir, page, dstva, PTE_P | PTE_U | PTE_W);
+    page_decref(page);
+    return r < 0 ? r : size;
+}
+
+//map up to n received frames at dstva, dstva + PGSIZE, ... and store
+//their lengths and checksum flags in rx[]; returns how many, 0 if none
+//are waiting.  frames too long for one buffer are dropped along the way
+static int
+sys_nic_recv_batch(void* dstva, struct nic_rx* rx, int n){
+    if(n < 0 || n > NIC_BATCH_MAX)
+        return -E_INVAL;
+    if((uint32_t)dstva % PGSIZE != 0 || (uint32_t)dstva >= UTOP || n > (UTOP - (uint32_t)dstva) / PGSIZE)
+        return -E_INVAL;
+    user_mem_assert(curenv, rx, n * sizeof(struct nic_rx), PTE_U | PTE_W);
+    int i = 0, r = 0;
+    while(i < n){
+        struct PageInfo* page;
+        int flags;
+        int size = e1000_82540em_take(&page, &flags);
+        if(size == -E_RX_LONG_PACKET)
+            continue;
+        if(size < 0){
+            r = size;
+            break;
+        }
+        r = page_insert(curenv -> env_pgdir, page, dstva + i * PGSIZE, PTE_P | PTE_U | PTE_W);
+        page_decref(page);
+        if(r < 0)
+            break;
+        rx[i].nr_len = size;
+        rx[i++].nr_flags = flags;
+    }
+    e1000_82540em_flush_rx();
+    if(i > 0 || r == -E_RX_NOT_RECV)
+        return i;
+    return r;
+}
+
+//block until the NIC has a received frame for sys_nic_recv
+static int
+sys_nic_wait(void){
+    return e1000_82540em_wait(curenv);
 }
 
+//block until a transmit that failed with -E_NIC_BUSY would fit
 static int
-sys_nic_recv(void* buf, int limit){
-    user_mem_assert(curenv, buf, limit, PTE_U);
-    return e1000_82540em_recv(buf, limit);
+sys_nic_wait_tx(void){
+    return e1000_82540em_wait_tx(curenv);
 }
 
 // Dispatches to the correct kernel function, passing the arguments.
@@ -467,9 +665,23 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
     case SYS_time_msec:
         return sys_time_msec();
     case SYS_nic_transmit:
-        return sys_nic_transmit((const void*)a1, (int)a2);
+        return sys_nic_transmit((const void*)a1, (int)a2, (int)a3);
     case SYS_nic_recv:
-        return sys_nic_recv((void*)a1, (int)a2);
+        return sys_nic_recv((void*)a1);
+    case SYS_nic_wait:
+        return sys_nic_wait();
+    case SYS_nic_wait_tx:
+        return sys_nic_wait_tx();
+    case SYS_sleep_until:
+        return sys_sleep_until(a1);
+    case SYS_ipc_recv_until:
+        return sys_ipc_recv_until((void*)a1, (int)a2, a3);
+    case SYS_ipc_try_sendv:
+        return sys_ipc_try_sendv((envid_t)a1, a2, (void* const*)a3, (int)a4, (unsigned)a5);
+    case SYS_nic_transmit_batch:
+        return sys_nic_transmit_batch((const struct nic_pkt*)a1, (int)a2);
+    case SYS_nic_recv_batch:
+        return sys_nic_recv_batch((void*)a1, (struct nic_rx*)a2, (int)a3);
 	default:
 		return -E_INVAL;
 	}
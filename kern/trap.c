@@ -14,6 +14,7 @@
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
 #include <kern/time.h>
+#include <kern/e1000.h>
 
 static struct Taskstate ts;
 
@@ -253,8 +254,10 @@ trap_dispatch(struct Trapframe *tf)
 	    // Add time tick increment to clock interrupts.
 	    // Be careful! In multiprocessors, clock interrupts are
 	    // triggered on every CPU.
-        if(!thiscpu -> cpu_id)
+        if(!thiscpu -> cpu_id){
             time_tick();
+            sched_wake_sleepers();
+        }
         sched_yield();
     }
 
@@ -269,6 +272,13 @@ trap_dispatch(struct Trapframe *tf)
         return;
     }
 
+    //the NIC may sit behind the slave 8259, which needs an explicit EOI
+    if(e1000_irq >= 0 && tf -> tf_trapno == IRQ_OFFSET + e1000_irq){
+        e1000_82540em_intr();
+        irq_eoi();
+        return;
+    }
+
 	// Unexpected trap: The user process or the kernel has a bug.
 	print_trapframe(tf);
 	if (tf->tf_cs == GD_KT)
@@ -38,6 +38,7 @@ static ssize_t devcons_read(struct Fd*, void*, size_t);
 static ssize_t devcons_write(struct Fd*, const void*, size_t);
 static int devcons_close(struct Fd*);
 static int devcons_stat(struct Fd*, struct Stat*);
+static int devcons_poll(struct Fd*, int);
 
 struct Dev devcons =
 {
@@ -46,9 +47,13 @@ struct Dev devcons =
 	.dev_read =	devcons_read,
 	.dev_write =	devcons_write,
 	.dev_close =	devcons_close,
-	.dev_stat =	devcons_stat
+	.dev_stat =	devcons_stat,
+	.dev_poll =	devcons_poll
 };
 
+// A character devcons_poll read ahead, for the next devcons_read.
+static int cons_ahead;
+
 int
 iscons(int fdnum)
 {
@@ -83,8 +88,11 @@ devcons_read(struct Fd *fd, void *vbuf, size_t n)
 	if (n == 0)
 		return 0;
 
-	while ((c = sys_cgetc()) == 0)
-		sys_yield();
+	if ((c = cons_ahead) != 0)
+		cons_ahead = 0;
+	else
+		while ((c = sys_cgetc()) == 0)
+			sys_yield();
 	if (c < 0)
 		return c;
 	if (c == 0x04)	// ctl-d is eof
@@ -119,6 +127,15 @@ devcons_close(struct Fd *fd)
 	return 0;
 }
 
+static int
+devcons_poll(struct Fd *fd, int events)
+{
+	// the console has no input buffer we can peek at, so read ahead
+	if ((events & POLLIN) && cons_ahead == 0)
+		cons_ahead = sys_cgetc();
+	return (cons_ahead != 0 ? POLLIN : 0) | POLLOUT;
+}
+
 static int
 devcons_stat(struct Fd *fd, struct Stat *stat)
 {
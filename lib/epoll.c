@@ -0,0 +1,159 @@
+// Edge-triggered socket readiness, after Linux's epoll.
+//
+// An epoll fd's data page is a struct epoll_ring (inc/epoll.h) that ns
+// maps too.  ns puts an event on the ring whenever a watched socket
+// becomes readable or writable, so epoll_wait only asks ns to wait when
+// the ring is empty.  Make the sockets non-blocking (fcntl O_NONBLOCK)
+// and read or write each until -E_AGAIN before waiting again: an event
+// only says the socket changed.
+
+#include <inc/lib.h>
+
+static int devepoll_close(struct Fd *fd);
+static int devepoll_stat(struct Fd *fd, struct Stat *stat);
+static int devepoll_poll(struct Fd *fd, int events);
+
+struct Dev devepoll =
+{
+	.dev_id =	'e',
+	.dev_name =	"epoll",
+	.dev_close =	devepoll_close,
+	.dev_stat =	devepoll_stat,
+	.dev_poll =	devepoll_poll,
+};
+
+static int
+fd2epoll(int fdnum, struct Fd **fd_store)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devepoll.dev_id)
+		return -E_INVAL;
+	*fd_store = fd;
+	return 0;
+}
+
+// Create an epoll instance.  size is ignored, as on Linux.
+int
+epoll_create(int size)
+{
+	struct Fd *fd;
+	struct epoll_ring *ring;
+	int r;
+
+	USED(size);
+	if ((r = fd_alloc(&fd)) < 0)
+		return r;
+	ring = (struct epoll_ring *) fd2data(fd);
+	if ((r = sys_page_alloc(0, fd, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
+		return r;
+	if ((r = sys_page_alloc(0, ring, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
+		goto err;
+	if ((r = nsipc_epoll_create(ring)) < 0)
+		goto err1;
+
+	fd->fd_dev_id = devepoll.dev_id;
+	fd->fd_omode = O_RDONLY;
+	fd->fd_epoll.epid = r;
+	return fd2num(fd);
+
+    err1:
+	sys_page_unmap(0, ring);
+    err:
+	sys_page_unmap(0, fd);
+	return r;
+}
+
+// Add, change or remove (op) the watch of epfd on socket fd.
+int
+epoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	struct Fd *efd, *sfd;
+	int r;
+
+	if ((r = fd2epoll(epfd, &efd)) < 0
+	    || (r = fd_lookup(fd, &sfd)) < 0)
+		return r;
+	if (sfd->fd_dev_id != devsock.dev_id)
+		return -E_NOT_SUPP;
+	if (op != EPOLL_CTL_DEL && !event)
+		return -E_INVAL;
+	return nsipc_epoll_ctl(efd->fd_epoll.epid, op, sfd->fd_sock.sockid,
+			       event ? event->events : 0,
+			       event ? event->data.u32 : 0);
+}
+
+// Take up to maxevents events off the ring of epfd, waiting up to
+// timeout msec for the first one; a negative timeout waits forever.
+// Returns the number of events, 0 on timeout.
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	struct Fd *fd;
+	struct epoll_ring *ring;
+	struct epoll_event *e;
+	unsigned deadline;
+	int r, n, wait;
+
+	if ((r = fd2epoll(epfd, &fd)) < 0)
+		return r;
+	if (maxevents <= 0)
+		return -E_INVAL;
+	ring = (struct epoll_ring *) fd2data(fd);
+	deadline = sys_time_msec() + timeout;
+
+	for (;;) {
+		n = 0;
+		while (n < maxevents && ring->er_cons != ring->er_prod) {
+			e = &ring->er_ev[ring->er_cons % EPOLL_RING_SLOTS];
+			// ns may still OR new events into the slot; take
+			// them atomically, then free the slot.
+			events[n].events = __sync_lock_test_and_set(&e->events, 0);
+			events[n].data = e->data;
+			ring->er_cons++;
+			if (events[n].events)
+				n++;
+		}
+		if (n > 0 || timeout == 0)
+			return n;
+
+		wait = -1;
+		if (timeout > 0 && (wait = deadline - sys_time_msec()) <= 0)
+			return 0;
+		if ((r = nsipc_epoll_wait(fd->fd_epoll.epid, wait)) < 0)
+			return r;
+	}
+}
+
+static int
+devepoll_close(struct Fd *fd)
+{
+	int r = 0;
+
+	if (pageref(fd) == 1)
+		r = nsipc_epoll_close(fd->fd_epoll.epid);
+	(void) sys_page_unmap(0, fd2data(fd));
+	return r;
+}
+
+static int
+devepoll_stat(struct Fd *fd, struct Stat *stat)
+{
+	struct epoll_ring *ring = (struct epoll_ring *) fd2data(fd);
+
+	strcpy(stat->st_name, "<epoll>");
+	stat->st_size = ring->er_prod - ring->er_cons;
+	return 0;
+}
+
+// An epoll fd is readable while its ring holds events.
+static int
+devepoll_poll(struct Fd *fd, int events)
+{
+	struct epoll_ring *ring = (struct epoll_ring *) fd2data(fd);
+
+	return ring->er_cons != ring->er_prod ? POLLIN : 0;
+}
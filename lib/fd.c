@@ -2,8 +2,6 @@
 
 #define debug		0
 
-// Maximum number of file descriptors a program may hold open concurrently
-#define MAXFD		32
 // Bottom of file descriptor area
 #define FDTABLE		0xD0000000
 // Bottom of file data area.  We reserve one data page for each FD,
@@ -129,6 +127,7 @@ static struct Dev *devtab[] =
 	&devsock,
 	&devpipe,
 	&devcons,
+	&devepoll,
 	0
 };
 
@@ -303,10 +302,40 @@ fstat(int fdnum, struct Stat *stat)
 	stat->st_name[0] = 0;
 	stat->st_size = 0;
 	stat->st_isdir = 0;
+	stat->st_version = 0;
 	stat->st_dev = dev;
 	return (*dev->dev_stat)(fd, stat);
 }
 
+// F_GETFL returns the fd's open mode.  F_SETFL sets or clears its
+// O_NONBLOCK flag, which only sockets support: ns then fails socket
+// calls that would block with -E_AGAIN.
+int
+fcntl(int fdnum, int cmd, int arg)
+{
+	int r;
+	uint32_t on;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	switch (cmd) {
+	case F_GETFL:
+		return fd->fd_omode;
+	case F_SETFL:
+		on = (arg & O_NONBLOCK) != 0;
+		if (fd->fd_dev_id == devsock.dev_id) {
+			if ((r = nsipc_ioctl(fd->fd_sock.sockid, FIONBIO, &on)) < 0)
+				return r;
+		} else if (on)
+			return -E_NOT_SUPP;
+		fd->fd_omode = (fd->fd_omode & ~O_NONBLOCK) | (arg & O_NONBLOCK);
+		return 0;
+	default:
+		return -E_INVAL;
+	}
+}
+
 int
 stat(const char *path, struct Stat *stat)
 {
@@ -6,6 +6,15 @@
 
 union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 
+static envid_t
+fsenv(void)
+{
+	static envid_t envid;
+	if (envid == 0)
+		envid = ipc_find_env(ENV_TYPE_FS);
+	return envid;
+}
+
 // Send an inter-environment request to the file server, and wait for
 // a reply.  The request body should be in fsipcbuf, and parts of the
 // response may be written back to fsipcbuf.
@@ -15,16 +24,12 @@ union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
 static int
 fsipc(unsigned type, void *dstva)
 {
-	static envid_t fsenv;
-	if (fsenv == 0)
-		fsenv = ipc_find_env(ENV_TYPE_FS);
-
 	static_assert(sizeof(fsipcbuf) == PGSIZE);
 
 	if (debug)
 		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
 
-	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
+	ipc_send(fsenv(), type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
 	return ipc_recv(NULL, dstva, NULL);
 }
 
@@ -127,6 +132,39 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 	return r;
 }
 
+// Map the pages holding up to 'n' bytes of file 'fdnum' from 'offset' at
+// 'dstva', read-only.  They are the file server's block cache pages, not
+// copies, but the server never writes a page it has lent: they keep
+// showing the data as it was when mapped.  The data starts
+// offset % PGSIZE bytes into the first page; at most IPC_MAXPAGES pages
+// are mapped.  The file position does not change.
+//
+// Returns:
+//	The number of bytes mapped, 0 at end of file.
+//	< 0 on error.
+int
+read_pages(int fdnum, off_t offset, size_t n, void *dstva)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	if (offset < 0)
+		return -E_INVAL;
+	n = MIN(n, IPC_MAXPAGES * PGSIZE - offset % PGSIZE);
+
+	fsipcbuf.read_pages.req_fileid = fd->fd_file.id;
+	fsipcbuf.read_pages.req_offset = offset;
+	fsipcbuf.read_pages.req_n = n;
+	ipc_send(fsenv(), FSREQ_READ_PAGES, &fsipcbuf, PTE_P | PTE_W | PTE_U);
+	r = ipc_recv_until(NULL, dstva, ROUNDUP(offset % PGSIZE + n, PGSIZE) / PGSIZE,
+			   NULL, ~0);
+	assert(r <= (int) n);
+	return r;
+}
 
 // Write at most 'n' bytes from 'buf' to 'fd' at the current seek position.
 //
@@ -163,6 +201,7 @@ devfile_stat(struct Fd *fd, struct Stat *st)
 	strcpy(st->st_name, fsipcbuf.statRet.ret_name);
 	st->st_size = fsipcbuf.statRet.ret_size;
 	st->st_isdir = fsipcbuf.statRet.ret_isdir;
+	st->st_version = fsipcbuf.statRet.ret_version;
 	return 0;
 }
 
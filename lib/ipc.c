@@ -39,6 +39,30 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
     return value;
 }
 
+// Like ipc_recv, but give up once sys_time_msec() reaches 'msec' and
+// return -E_TIMEOUT.  There is room for 'npages' pages at 'pg', which
+// ipc_sendv may fill; thisenv->env_ipc_npages says how many it did.
+int32_t
+ipc_recv_until(envid_t *from_env_store, void *pg, int npages, int *perm_store,
+               uint32_t msec)
+{
+    if(!pg)
+        pg = (void*)UTOP;
+    envid_t envid = 0;
+    int perm = 0;
+    int value;
+    if(value=sys_ipc_recv_until(pg, npages, msec), !value){
+        envid = thisenv -> env_ipc_from;
+        perm = thisenv -> env_ipc_perm;
+        value = thisenv -> env_ipc_value;
+    }
+    if(from_env_store)
+        *from_env_store = envid;
+    if(perm_store)
+        *perm_store = perm;
+    return value;
+}
+
 // Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
 // This function keeps trying until it succeeds.
 // It should panic() on any error other than -E_IPC_NOT_RECV.
@@ -73,6 +97,19 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
     }while(value);
 }
 
+// Like ipc_send, but send the 'npgs' pages pgs[0..npgs-1], which the
+// receiver gets mapped one after the other.
+void
+ipc_sendv(envid_t to_env, uint32_t val, void* const* pgs, int npgs, int perm)
+{
+    int value;
+    while((value = sys_ipc_try_sendv(to_env, val, pgs, npgs, perm)) != 0){
+        if(value != -E_IPC_NOT_RECV)
+            panic("ipc_sendv %08x to %08x: %e", thisenv -> env_id, to_env, value);
+        sys_yield();
+    }
+}
+
 // Find the first environment of the given type.  We'll use this to
 // find special environments.
 // Returns 0 if no such environment exists.
@@ -0,0 +1,36 @@
+// Doorbells for the packet rings shared by the network server and its
+// input and output environments; see struct jif_ring in inc/ns.h.
+
+#include <inc/lib.h>
+
+// Sleep until *idx, the other side's index, no longer equals 'seen'.
+// The other side rings our doorbell while *waiting is set, so check
+// *idx again after setting it, or a doorbell could be missed.
+void
+jifring_wait(volatile uint32_t *waiting, volatile uint32_t *idx,
+	     uint32_t seen)
+{
+	*waiting = 1;
+	__sync_synchronize();
+	while (*idx == seen)
+		ipc_recv(NULL, NULL, NULL);
+	*waiting = 0;
+}
+
+// Ring envid's doorbell if it is waiting on our index, which the caller
+// has just moved.  The waiter may not be in ipc_recv yet; keep trying
+// until it is, or until it notices the new index by itself.
+void
+jifring_notify(volatile uint32_t *waiting, envid_t envid, int32_t value)
+{
+	int r;
+
+	__sync_synchronize();
+	while (*waiting) {
+		if ((r = sys_ipc_try_send(envid, value, 0, 0)) == 0)
+			return;
+		if (r != -E_IPC_NOT_RECV)
+			panic("jifring_notify: %e", r);
+		sys_yield();
+	}
+}
@@ -8,27 +8,43 @@
 #define REQVA		0x0ffff000
 union Nsipc nsipcbuf __attribute__((aligned(PGSIZE)));
 
+// Recv and send calls at least this long lend the caller's buffer to ns
+// instead of copying it through nsipcbuf.
+#define BULK_MIN	1024
+
+static envid_t
+nsenv(void)
+{
+	static envid_t envid;
+	if (envid == 0)
+		envid = ipc_find_env(ENV_TYPE_NS);
+	return envid;
+}
+
 // Send an IP request to the network server, and wait for a reply.
-// The request body should be in nsipcbuf, and parts of the response
-// may be written back to nsipcbuf.
+// The request body should be in pg, and parts of the response
+// may be written back to pg.
 // type: request code, passed as the simple integer IPC value.
 // Returns 0 if successful, < 0 on failure.
 static int
-nsipc(unsigned type)
+nsipc_page(unsigned type, void *pg)
 {
-	static envid_t nsenv;
-	if (nsenv == 0)
-		nsenv = ipc_find_env(ENV_TYPE_NS);
-
-	static_assert(sizeof(nsipcbuf) == PGSIZE);
-
 	if (debug)
 		cprintf("[%08x] nsipc %d\n", thisenv->env_id, type);
 
-	ipc_send(nsenv, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
+	ipc_send(nsenv(), type, pg, PTE_P|PTE_W|PTE_U);
 	return ipc_recv(NULL, NULL, NULL);
 }
 
+// Send a request whose body is in nsipcbuf.
+static int
+nsipc(unsigned type)
+{
+	static_assert(sizeof(nsipcbuf) == PGSIZE);
+
+	return nsipc_page(type, &nsipcbuf);
+}
+
 int
 nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 {
@@ -85,11 +101,52 @@ nsipc_listen(int s, int backlog)
 	return nsipc(NSREQ_LISTEN);
 }
 
+// Bulk recv or send: lend ns the pages under [buf, buf + len), after
+// nsipcbuf, for it to work on in place.  Moves at most what
+// NSIPC_BULK_PAGES pages hold.
+static int
+nsipc_bulk(unsigned type, int s, const void *buf, int len, unsigned int flags)
+{
+	void *pgs[1 + NSIPC_BULK_PAGES];
+	uintptr_t va = ROUNDDOWN((uintptr_t) buf, PGSIZE);
+	int off = (uintptr_t) buf - va;
+	int perm = PTE_P|PTE_U;
+	volatile char *p;
+	int i, npgs;
+
+	len = MIN(len, NSIPC_BULK_PAGES * PGSIZE - off);
+	npgs = ROUNDUP(off + len, PGSIZE) / PGSIZE;
+	if (type == NSREQ_RECV_BULK)
+		perm |= PTE_W;
+
+	pgs[0] = &nsipcbuf;
+	for (i = 0; i < npgs; i++) {
+		pgs[1 + i] = (void *) (va + i * PGSIZE);
+		// ns must write into our pages, not copy-on-write copies of
+		// them, so take a write fault on each one now.
+		if (perm & PTE_W) {
+			p = (char *) MAX((uintptr_t) buf, va + i * PGSIZE);
+			*p = *p;
+		}
+	}
+
+	nsipcbuf.bulk.req_s = s;
+	nsipcbuf.bulk.req_len = len;
+	nsipcbuf.bulk.req_flags = flags;
+	nsipcbuf.bulk.req_off = off;
+	if (debug)
+		cprintf("[%08x] nsipc %d, %d pages\n", thisenv->env_id, type, npgs);
+	ipc_sendv(nsenv(), type, pgs, 1 + npgs, perm);
+	return ipc_recv(NULL, NULL, NULL);
+}
+
 int
 nsipc_recv(int s, void *mem, int len, unsigned int flags)
 {
 	int r;
 
+	if (len >= BULK_MIN)
+		return nsipc_bulk(NSREQ_RECV_BULK, s, mem, len, flags);
 	nsipcbuf.recv.req_s = s;
 	nsipcbuf.recv.req_len = len;
 	nsipcbuf.recv.req_flags = flags;
@@ -105,6 +162,8 @@ nsipc_recv(int s, void *mem, int len, unsigned int flags)
 int
 nsipc_send(int s, const void *buf, int size, unsigned int flags)
 {
+	if (size >= BULK_MIN)
+		return nsipc_bulk(NSREQ_SEND_BULK, s, buf, size, flags);
 	nsipcbuf.send.req_s = s;
 	assert(size < 1600);
 	memmove(&nsipcbuf.send.req_buf, buf, size);
@@ -113,6 +172,15 @@ nsipc_send(int s, const void *buf, int size, unsigned int flags)
 	return nsipc(NSREQ_SEND);
 }
 
+// A bulk send whose pages ns queues in place and keeps until they are
+// acknowledged, so nothing may write them meanwhile: file pages from
+// read_pages.
+int
+nsipc_sendfile(int s, const void *buf, int size)
+{
+	return nsipc_bulk(NSREQ_SENDFILE, s, buf, size, 0);
+}
+
 int
 nsipc_socket(int domain, int type, int protocol)
 {
@@ -121,3 +189,76 @@ nsipc_socket(int domain, int type, int protocol)
 	nsipcbuf.socket.req_protocol = protocol;
 	return nsipc(NSREQ_SOCKET);
 }
+
+int
+nsipc_poll(struct pollfd *fds, int nfds, int timeout)
+{
+	int i, r;
+
+	assert(nfds * sizeof(fds[0]) <= PGSIZE - sizeof(nsipcbuf.poll));
+	nsipcbuf.poll.req_nfds = nfds;
+	nsipcbuf.poll.req_timeout = timeout;
+	memmove(nsipcbuf.poll.req_fds, fds, nfds * sizeof(fds[0]));
+
+	if ((r = nsipc(NSREQ_POLL)) >= 0)
+		for (i = 0; i < nfds; i++)
+			fds[i].revents = nsipcbuf.poll.req_fds[i].revents;
+	return r;
+}
+
+int
+nsipc_ioctl(int s, long cmd, uint32_t *argp)
+{
+	int r;
+
+	nsipcbuf.ioctl.req_s = s;
+	nsipcbuf.ioctl.req_cmd = cmd;
+	nsipcbuf.ioctl.req_arg = *argp;
+	if ((r = nsipc(NSREQ_IOCTL)) >= 0)
+		*argp = nsipcbuf.ioctl.req_arg;
+	return r;
+}
+
+// Hand the page ring to ns as the event ring of a new epoll instance.
+int
+nsipc_epoll_create(struct epoll_ring *ring)
+{
+	return nsipc_page(NSREQ_EPOLL_CREATE, ring);
+}
+
+int
+nsipc_epoll_ctl(int epid, int op, int s, uint32_t events, uint32_t data)
+{
+	nsipcbuf.epoll_ctl.req_epid = epid;
+	nsipcbuf.epoll_ctl.req_op = op;
+	nsipcbuf.epoll_ctl.req_s = s;
+	nsipcbuf.epoll_ctl.req_events = events;
+	nsipcbuf.epoll_ctl.req_data = data;
+	return nsipc(NSREQ_EPOLL_CTL);
+}
+
+int
+nsipc_epoll_wait(int epid, int timeout)
+{
+	nsipcbuf.epoll_wait.req_epid = epid;
+	nsipcbuf.epoll_wait.req_timeout = timeout;
+	return nsipc(NSREQ_EPOLL_WAIT);
+}
+
+int
+nsipc_epoll_close(int epid)
+{
+	nsipcbuf.epoll_close.req_epid = epid;
+	return nsipc(NSREQ_EPOLL_CLOSE);
+}
+
+// Copy the network server's statistics into *stats.
+int
+nsipc_stats(struct Nsret_stats *stats)
+{
+	int r;
+
+	if ((r = nsipc(NSREQ_STATS)) >= 0)
+		memmove(stats, &nsipcbuf.statsRet, sizeof(*stats));
+	return r;
+}
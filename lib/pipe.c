@@ -6,6 +6,7 @@ static ssize_t devpipe_read(struct Fd *fd, void *buf, size_t n);
 static ssize_t devpipe_write(struct Fd *fd, const void *buf, size_t n);
 static int devpipe_stat(struct Fd *fd, struct Stat *stat);
 static int devpipe_close(struct Fd *fd);
+static int devpipe_poll(struct Fd *fd, int events);
 
 struct Dev devpipe =
 {
@@ -15,6 +16,7 @@ struct Dev devpipe =
 	.dev_write =	devpipe_write,
 	.dev_close =	devpipe_close,
 	.dev_stat =	devpipe_stat,
+	.dev_poll =	devpipe_poll,
 };
 
 #define PIPEBUFSIZ 32		// small to provoke races
@@ -182,6 +184,22 @@ devpipe_stat(struct Fd *fd, struct Stat *stat)
 	return 0;
 }
 
+static int
+devpipe_poll(struct Fd *fd, int events)
+{
+	struct Pipe *p = (struct Pipe*) fd2data(fd);
+	int revents = 0;
+
+	if (p->p_rpos != p->p_wpos)
+		revents |= POLLIN;
+	if (p->p_wpos < p->p_rpos + sizeof(p->p_buf))
+		revents |= POLLOUT;
+	// the other end is gone: readers see eof, writers an error
+	if (_pipeisclosed(fd, p))
+		revents |= (fd->fd_omode == O_RDONLY) ? POLLHUP : POLLERR;
+	return revents;
+}
+
 static int
 devpipe_close(struct Fd *fd)
 {
@@ -0,0 +1,150 @@
+// poll() and select() over any mix of sockets, pipes, files and the
+// console.
+//
+// Sockets live in the network server, so all the sockets in a call are
+// polled with a single NSREQ_POLL, which ns answers with lwip_select.
+// Other devices answer immediately through their dev_poll.  If every fd
+// is a socket, ns does the waiting; otherwise we check the sockets and
+// the other fds in turn and sleep POLL_INTERVAL between rounds.
+
+#include <inc/lib.h>
+
+#define POLL_INTERVAL	10	// msec between rounds for mixed fd sets
+
+static int
+poll_fd(struct pollfd *pfd, struct pollfd *sock, int *issock)
+{
+	struct Fd *fd;
+	struct Dev *dev;
+	int mask = pfd->events | POLLERR | POLLHUP;
+
+	*issock = 0;
+	if (fd_lookup(pfd->fd, &fd) < 0 || dev_lookup(fd->fd_dev_id, &dev) < 0)
+		return POLLNVAL;
+	if (dev == &devsock) {
+		sock->fd = fd->fd_sock.sockid;
+		sock->events = pfd->events;
+		sock->revents = 0;
+		*issock = 1;
+		return 0;
+	}
+	if (!dev->dev_poll)
+		return pfd->events & (POLLIN | POLLOUT);
+	return dev->dev_poll(fd, pfd->events) & mask;
+}
+
+// Wait until one of the nfds fds in fds is ready for the events it asks
+// for, or timeout msec pass; a negative timeout waits forever.  Sets the
+// revents of every entry and returns the number of entries with
+// nonzero revents, or 0 on timeout.
+int
+poll(struct pollfd *fds, int nfds, int timeout)
+{
+	struct pollfd socks[MAXFD];
+	int sockidx[MAXFD];
+	unsigned now, deadline;
+	int i, r, n, nsocks, nother, issock, wait;
+
+	if (nfds < 0 || nfds > MAXFD)
+		return -E_INVAL;
+	deadline = sys_time_msec() + timeout;
+
+	for (;;) {
+		n = nsocks = nother = 0;
+		for (i = 0; i < nfds; i++) {
+			fds[i].revents = 0;
+			if (fds[i].fd < 0)
+				continue;
+			fds[i].revents = poll_fd(&fds[i], &socks[nsocks], &issock);
+			if (issock)
+				sockidx[nsocks++] = i;
+			else
+				nother++;
+			if (fds[i].revents)
+				n++;
+		}
+
+		if (nsocks > 0) {
+			// Only let ns block when nothing else can wake us.
+			wait = 0;
+			if (n == 0 && nother == 0 && timeout < 0)
+				wait = -1;
+			else if (n == 0 && nother == 0 && timeout > 0)
+				wait = MAX((int) (deadline - sys_time_msec()), 0);
+			if ((r = nsipc_poll(socks, nsocks, wait)) < 0)
+				return r;
+			for (i = 0; i < nsocks; i++)
+				if ((fds[sockidx[i]].revents = socks[i].revents))
+					n++;
+		}
+
+		if (n > 0 || timeout == 0)
+			return n;
+		now = sys_time_msec();
+		if (timeout > 0 && (int) (deadline - now) <= 0)
+			return 0;
+		// lwip_select can return early with nothing ready; if it
+		// did the waiting, just ask again.
+		if (nsocks > 0 && nother == 0)
+			continue;
+		if (timeout > 0 && (int) (deadline - now) < POLL_INTERVAL)
+			sys_sleep_until(deadline);
+		else
+			sys_sleep_until(now + POLL_INTERVAL);
+	}
+}
+
+// select() in terms of poll().  The exceptional condition is POLLERR.
+int
+select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+       struct timeval *timeout)
+{
+	struct pollfd fds[MAXFD];
+	int i, n, r, msec;
+
+	if (nfds < 0 || nfds > MAXFD)
+		return -E_INVAL;
+	n = 0;
+	for (i = 0; i < nfds; i++) {
+		fds[n].fd = i;
+		fds[n].events = 0;
+		if (readfds && FD_ISSET(i, readfds))
+			fds[n].events |= POLLIN;
+		if (writefds && FD_ISSET(i, writefds))
+			fds[n].events |= POLLOUT;
+		if (fds[n].events || (exceptfds && FD_ISSET(i, exceptfds)))
+			n++;
+	}
+
+	msec = -1;
+	if (timeout)
+		msec = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
+	if ((r = poll(fds, n, msec)) < 0)
+		return r;
+
+	if (readfds)
+		FD_ZERO(readfds);
+	if (writefds)
+		FD_ZERO(writefds);
+	if (exceptfds)
+		FD_ZERO(exceptfds);
+	r = 0;
+	for (i = 0; i < n; i++) {
+		if (fds[i].revents & POLLNVAL)
+			return -E_INVAL;
+		if ((fds[i].events & POLLIN)
+		    && (fds[i].revents & (POLLIN | POLLHUP))) {
+			FD_SET(fds[i].fd, readfds);
+			r++;
+		}
+		if ((fds[i].events & POLLOUT) && (fds[i].revents & POLLOUT)) {
+			FD_SET(fds[i].fd, writefds);
+			r++;
+		}
+		if (exceptfds && (fds[i].revents & POLLERR)) {
+			FD_SET(fds[i].fd, exceptfds);
+			r++;
+		}
+	}
+	return r;
+}
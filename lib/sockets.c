@@ -115,6 +115,62 @@ devsock_write(struct Fd *fd, const void *buf, size_t n)
 	return nsipc_send(fd->fd_sock.sockid, buf, n, 0);
 }
 
+// Like read and write, with lwIP's MSG_* flags; MSG_DONTWAIT makes a
+// call that would block return -E_AGAIN.
+ssize_t
+recv(int s, void *buf, size_t len, unsigned int flags)
+{
+	int r;
+	if ((r = fd2sockid(s)) < 0)
+		return r;
+	return nsipc_recv(r, buf, len, flags);
+}
+
+ssize_t
+send(int s, const void *buf, size_t len, unsigned int flags)
+{
+	int r;
+	if ((r = fd2sockid(s)) < 0)
+		return r;
+	return nsipc_send(r, buf, len, flags);
+}
+
+// File pages pass through here on their way from the file server to ns,
+// just below the fd table.
+#define SENDFILEVA	(0xD0000000 - NSIPC_BULK_PAGES * PGSIZE)
+
+// Send len bytes of file fd, starting at offset, on socket s.  The file
+// server lends us its block cache pages and we lend them on to ns, which
+// queues them on the connection without copying them.  The file position
+// does not change.  Returns the number of bytes sent.
+ssize_t
+sendfile(int s, int fd, off_t offset, size_t len)
+{
+	char *va = (char *) SENDFILEVA;
+	int sockid, n, r, i;
+	ssize_t sent = 0;
+
+	if ((sockid = fd2sockid(s)) < 0)
+		return sockid;
+	while (len > 0) {
+		n = MIN(len, NSIPC_BULK_PAGES * PGSIZE - offset % PGSIZE);
+		if ((r = read_pages(fd, offset, n, va)) <= 0)
+			return sent > 0 ? sent : r;
+		n = r;
+		r = nsipc_sendfile(sockid, va + offset % PGSIZE, n);
+		for (i = 0; i * PGSIZE < offset % PGSIZE + n; i++)
+			sys_page_unmap(0, va + i * PGSIZE);
+		if (r < 0)
+			return sent > 0 ? sent : r;
+		sent += r;
+		offset += r;
+		len -= r;
+		if (r < n)
+			break;
+	}
+	return sent;
+}
+
 static int
 devsock_stat(struct Fd *fd, struct Stat *stat)
 {
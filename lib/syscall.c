@@ -123,10 +123,38 @@ sys_time_msec(void)
 	return (unsigned int) syscall(SYS_time_msec, 0, 0, 0, 0, 0, 0);
 }
 
-int sys_nic_transmit(const void* packet, int size){
-    return syscall(SYS_nic_transmit, 1, packet, size, 0, 0, 0);
+int sys_nic_transmit(const void* packet, int size, int flags){
+    return syscall(SYS_nic_transmit, 1, packet, size, flags, 0, 0);
 }
 
-int sys_nic_recv(void* buf, int limit){
-    return syscall(SYS_nic_recv, 0, buf, limit, 0, 0, 0);
+int sys_nic_recv(void* dstva){
+    return syscall(SYS_nic_recv, 0, (uint32_t)dstva, 0, 0, 0, 0);
+}
+
+int sys_nic_wait(void){
+    return syscall(SYS_nic_wait, 0, 0, 0, 0, 0, 0);
+}
+
+int sys_nic_wait_tx(void){
+    return syscall(SYS_nic_wait_tx, 0, 0, 0, 0, 0, 0);
+}
+
+int sys_sleep_until(uint32_t msec){
+    return syscall(SYS_sleep_until, 0, msec, 0, 0, 0, 0);
+}
+
+int sys_ipc_recv_until(void* dstva, int npages, uint32_t msec){
+    return syscall(SYS_ipc_recv_until, 1, (uint32_t)dstva, npages, msec, 0, 0);
+}
+
+int sys_ipc_try_sendv(envid_t to_env, uint32_t value, void* const* pgs, int npgs, int perm){
+    return syscall(SYS_ipc_try_sendv, 0, to_env, value, (uint32_t)pgs, npgs, perm);
+}
+
+int sys_nic_transmit_batch(const struct nic_pkt* pkts, int n){
+    return syscall(SYS_nic_transmit_batch, 0, (uint32_t)pkts, n, 0, 0, 0);
+}
+
+int sys_nic_recv_batch(void* dstva, struct nic_rx* rx, int n){
+    return syscall(SYS_nic_recv_batch, 0, (uint32_t)dstva, (uint32_t)rx, n, 0, 0);
 }
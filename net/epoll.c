@@ -0,0 +1,232 @@
+/*
+ * Epoll instances of the network server.
+ *
+ * An epoll instance is a struct epoll_ring shared with the environment
+ * that created it, plus the set of sockets it watches.  lwIP calls
+ * ns_socket_event whenever a socket gains data, a connection, or send
+ * buffer space; for each instance watching the socket we put an event
+ * on its ring.  The owner takes events straight from the ring and only
+ * sends NSREQ_EPOLL_WAIT when the ring is empty.
+ */
+
+#include <arch/thread.h>
+#include <lwip/api.h>
+
+#include "ns.h"
+
+#define NEPOLL		16
+#define EPOLLVA		0x10400000
+
+struct epoll_reg {
+	bool r_used;
+	uint32_t r_events;	// Events the owner asked for
+	uint32_t r_data;	// Owner's epoll_data
+	bool r_queued;		// r_slot holds our latest event
+	uint32_t r_slot;	// Ring index of our latest event
+};
+
+static struct epoll {
+	envid_t ep_env;		// Owner, or 0 if the instance is free
+	struct epoll_ring *ep_ring;
+	struct epoll_reg ep_regs[MEMP_NUM_NETCONN];
+} epolls[NEPOLL];
+
+static struct epoll *
+epoll_lookup(envid_t env, int epid)
+{
+	if (epid < 0 || epid >= NEPOLL || epolls[epid].ep_env != env)
+		return NULL;
+	return &epolls[epid];
+}
+
+// Report events ev on the socket of registration r.
+static void
+epoll_push(struct epoll *ep, struct epoll_reg *r, uint32_t ev)
+{
+	struct epoll_ring *ring = ep->ep_ring;
+	struct epoll_event *e;
+
+	ev &= r->r_events | EPOLLERR | EPOLLHUP;
+	if (ev == 0)
+		return;
+
+	// If the owner has not taken our last event yet, add to it.  It
+	// may take it while we do; then the new bits need an event of
+	// their own.
+	if (r->r_queued && (int32_t) (r->r_slot - ring->er_cons) >= 0) {
+		e = &ring->er_ev[r->r_slot % EPOLL_RING_SLOTS];
+		__sync_fetch_and_or(&e->events, ev);
+		if ((int32_t) (r->r_slot - ring->er_cons) >= 0)
+			return;
+	}
+
+	// Only an owner that scribbled on er_cons can make the ring look
+	// full; it loses events.
+	if (ring->er_prod - ring->er_cons >= EPOLL_RING_SLOTS)
+		return;
+
+	e = &ring->er_ev[ring->er_prod % EPOLL_RING_SLOTS];
+	e->events = ev;
+	e->data.u32 = r->r_data;
+	r->r_queued = 1;
+	r->r_slot = ring->er_prod;
+	__sync_synchronize();
+	ring->er_prod++;
+	thread_wakeup(&ring->er_prod);
+}
+
+// The events pending on socket s right now.
+static uint32_t
+socket_events(int s)
+{
+	fd_set rset, wset;
+	struct timeval tv = { 0, 0 };
+	uint32_t ev = 0;
+
+	FD_ZERO(&rset);
+	FD_ZERO(&wset);
+	FD_SET(s, &rset);
+	FD_SET(s, &wset);
+	if (lwip_select(s + 1, &rset, &wset, NULL, &tv) <= 0)
+		return 0;
+	if (FD_ISSET(s, &rset))
+		ev |= EPOLLIN;
+	if (FD_ISSET(s, &wset))
+		ev |= EPOLLOUT;
+	return ev;
+}
+
+// Called by lwIP after socket s gains or loses data or buffer space.
+void
+ns_socket_event(int s, int evt)
+{
+	uint32_t ev;
+	int i;
+
+	if (evt == NETCONN_EVT_RCVPLUS)
+		ev = EPOLLIN;
+	else if (evt == NETCONN_EVT_SENDPLUS)
+		ev = EPOLLOUT;
+	else
+		return;
+	if (s < 0 || s >= MEMP_NUM_NETCONN)
+		return;
+
+	for (i = 0; i < NEPOLL; i++)
+		if (epolls[i].ep_env && epolls[i].ep_regs[s].r_used)
+			epoll_push(&epolls[i], &epolls[i].ep_regs[s], ev);
+}
+
+// Socket s is closed: no instance watches it any more.
+void
+ns_epoll_socket_closed(int s)
+{
+	int i;
+
+	if (s < 0 || s >= MEMP_NUM_NETCONN)
+		return;
+	for (i = 0; i < NEPOLL; i++)
+		epolls[i].ep_regs[s].r_used = 0;
+}
+
+// Create an instance for env around the ring page it sent us at va.
+int
+ns_epoll_create(envid_t env, void *va)
+{
+	struct epoll_ring *ring;
+	int i, r;
+
+	// One event per socket must fit.
+	static_assert(MEMP_NUM_NETCONN <= EPOLL_RING_SLOTS);
+
+	for (i = 0; i < NEPOLL; i++)
+		if (epolls[i].ep_env == 0)
+			break;
+	if (i == NEPOLL)
+		return -E_NO_MEM;
+
+	ring = (struct epoll_ring *) (EPOLLVA + i * PGSIZE);
+	if ((r = sys_page_map(0, va, 0, ring, PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	memset(&epolls[i], 0, sizeof(epolls[i]));
+	epolls[i].ep_env = env;
+	epolls[i].ep_ring = ring;
+	return i;
+}
+
+int
+ns_epoll_ctl(envid_t env, int epid, int op, int s, uint32_t events,
+	     uint32_t data)
+{
+	struct epoll *ep;
+	struct epoll_reg *r;
+
+	if ((ep = epoll_lookup(env, epid)) == NULL
+	    || s < 0 || s >= MEMP_NUM_NETCONN)
+		return -E_INVAL;
+	r = &ep->ep_regs[s];
+
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		if (r->r_used)
+			return -E_FILE_EXISTS;
+		r->r_used = 1;
+		r->r_queued = 0;
+		break;
+	case EPOLL_CTL_MOD:
+		if (!r->r_used)
+			return -E_NOT_FOUND;
+		break;
+	case EPOLL_CTL_DEL:
+		if (!r->r_used)
+			return -E_NOT_FOUND;
+		r->r_used = 0;
+		return 0;
+	default:
+		return -E_INVAL;
+	}
+
+	r->r_events = events;
+	r->r_data = data;
+	// Edge-triggered, but report what is already pending, or the
+	// owner would wait for an edge that has passed.
+	epoll_push(ep, r, socket_events(s));
+	return 0;
+}
+
+// Block this thread until the ring of epid has events or timeout msec
+// pass.  Returns the number of events in the ring.
+int
+ns_epoll_wait(envid_t env, int epid, int timeout)
+{
+	struct epoll *ep;
+	struct epoll_ring *ring;
+	uint32_t deadline, prod;
+
+	if ((ep = epoll_lookup(env, epid)) == NULL)
+		return -E_INVAL;
+	ring = ep->ep_ring;
+
+	deadline = timeout < 0 ? ~0 : sys_time_msec() + timeout;
+	while ((prod = ring->er_prod) == ring->er_cons) {
+		if (deadline != ~0 && (int32_t) (deadline - sys_time_msec()) <= 0)
+			break;
+		thread_wait(&ring->er_prod, prod, deadline);
+		// The owner closed the instance under us.
+		if (ep->ep_env != env)
+			return -E_INVAL;
+	}
+	return ring->er_prod - ring->er_cons;
+}
+
+int
+ns_epoll_close(envid_t env, int epid)
+{
+	struct epoll *ep;
+
+	if ((ep = epoll_lookup(env, epid)) == NULL)
+		return -E_INVAL;
+	ep->ep_env = 0;
+	thread_wakeup(&ep->ep_ring->er_prod);
+	return sys_page_unmap(0, ep->ep_ring);
+}
@@ -1,9 +1,5 @@
 #include "ns.h"
 
-extern union Nsipc nsipcbuf;
-#define BUFSIZE 2048
-#define RECV_GAP 10
-
 void
 input(envid_t ns_envid)
 {
@@ -14,16 +10,35 @@ input(envid_t ns_envid)
 	// Hint: When you IPC a page to the network server, it will be
 	// reading from it for a while, so don't immediately receive
 	// another packet in to the same physical page.
-    char buf[BUFSIZE];
-    int packet_size;
+    // The kernel maps the pages the NIC filled straight into the free
+    // slots of the RX ring, with each frame already where jp_data is,
+    // replacing the pages there last time; ns has mapped those itself,
+    // so nothing is copied and no page is sent.
+    struct jif_ring* rx = &JIF_RINGS->rx;
+    struct nic_rx nr[NIC_BATCH_MAX];
+    memset(nr, 0, sizeof(nr));
     while(1){
-        //waiting for valid packet
-        while(packet_size = sys_nic_recv(buf, BUFSIZE), packet_size < 0);
-        memcpy(nsipcbuf.pkt.jp_data, buf, packet_size);
-        nsipcbuf.pkt.jp_len = packet_size;
-        ipc_send(ns_envid, NSREQ_INPUT, &nsipcbuf, PTE_P|PTE_U);
-        //spin for a while
-        for(int i = 0;i < RECV_GAP;i++)
-            sys_yield();
+        uint32_t prod = rx->jr_prod;
+        uint32_t cons = rx->jr_cons;
+        if(prod - cons == JIF_RING_SLOTS){
+            //ring full: leave frames in the NIC until ns catches up
+            jifring_wait(&rx->jr_pwait, &rx->jr_cons, cons);
+            continue;
+        }
+        //the kernel maps a batch at consecutive pages, so stop at the wrap
+        int max = MIN((int)(JIF_RING_SLOTS - (prod - cons)), (int)(JIF_RING_SLOTS - prod % JIF_RING_SLOTS));
+        max = MIN(max, NIC_BATCH_MAX);
+        int n;
+        //sleep until the NIC interrupts instead of spinning
+        while(n = sys_nic_recv_batch((void*)JIF_RXSLOT(prod), nr, max), n <= 0)
+            sys_nic_wait();
+        for(int i = 0;i < n;i++){
+            struct jif_pkt* pkt = (struct jif_pkt*)JIF_RXSLOT(prod + i);
+            pkt->jp_len = nr[i].nr_len;
+            pkt->jp_flags = nr[i].nr_flags;
+        }
+        __sync_synchronize();
+        rx->jr_prod = prod + n;
+        jifring_notify(&rx->jr_cwait, ns_envid, NSREQ_INPUT);
     }
 }
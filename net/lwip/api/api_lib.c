@@ -498,6 +498,27 @@ netconn_close(struct netconn *conn)
   return conn->err;
 }
 
+/**
+ * Close the sending half of a TCP netconn: send a FIN but go on
+ * receiving until the peer closes too.
+ *
+ * @param conn the TCP netconn to half-close
+ * @return ERR_OK if the FIN is queued or was sent before, any other
+ *         err_t on error
+ */
+err_t
+netconn_close_tx(struct netconn *conn)
+{
+  struct api_msg msg;
+
+  LWIP_ERROR("netconn_close_tx: invalid conn",  (conn != NULL), return ERR_ARG;);
+
+  msg.function = do_close_tx;
+  msg.msg.conn = conn;
+  tcpip_apimsg(&msg);
+  return conn->err;
+}
+
 #if LWIP_IGMP
 /**
  * Join multicast groups for UDP netconns.
@@ -212,6 +212,20 @@ recv_tcp(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
     return ERR_MEM;
   }
 
+  /* After netconn_close_tx, the peer's FIN ends the connection for us:
+     let go of the pcb as do_close_internal would, since the stack frees
+     it in TIME_WAIT without telling us. */
+  if ((p == NULL) && (conn->state == NETCONN_NONE) &&
+      ((pcb->state == FIN_WAIT_1) || (pcb->state == FIN_WAIT_2) ||
+       (pcb->state == CLOSING) || (pcb->state == TIME_WAIT))) {
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_poll(pcb, NULL, 4);
+    tcp_err(pcb, NULL);
+    conn->pcb.tcp = NULL;
+  }
+
   return ERR_OK;
 }
 
@@ -1131,6 +1145,50 @@ do_close(struct api_msg_msg *msg)
   }
 }
 
+/**
+ * Send a FIN on a TCP pcb contained in a netconn, but keep the pcb and
+ * its callbacks so that data still arrives.
+ * Called from netconn_close_tx
+ *
+ * @param msg the api_msg_msg pointing to the connection
+ */
+void
+do_close_tx(struct api_msg_msg *msg)
+{
+#if LWIP_TCP
+  if ((msg->conn->pcb.tcp != NULL) && (msg->conn->type == NETCONN_TCP)) {
+    switch (msg->conn->pcb.tcp->state) {
+    case SYN_RCVD:
+    case ESTABLISHED:
+      /* From these states tcp_close() only queues a FIN */
+      msg->conn->err = tcp_close(msg->conn->pcb.tcp);
+      break;
+    case CLOSE_WAIT:
+      /* The peer has finished sending already: this is a full close.
+         The pcb is freed without a callback once our FIN is ACKed. */
+      msg->conn->state = NETCONN_CLOSE;
+      do_close_internal(msg->conn);
+      /* do_close_internal ACKs the message */
+      return;
+    case FIN_WAIT_1:
+    case FIN_WAIT_2:
+    case CLOSING:
+    case TIME_WAIT:
+    case LAST_ACK:
+      msg->conn->err = ERR_OK;
+      break;
+    default:
+      msg->conn->err = ERR_CONN;
+      break;
+    }
+  } else
+#endif /* LWIP_TCP */
+  {
+    msg->conn->err = ERR_CONN;
+  }
+  TCPIP_APIMSG_ACK(msg);
+}
+
 #if LWIP_IGMP
 /**
  * Join multicast groups for UDP netconns.
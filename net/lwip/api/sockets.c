@@ -258,6 +258,12 @@ lwip_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
   if (!sock)
     return -1;
 
+  if ((sock->flags & O_NONBLOCK) && sock->rcvevent <= 0) {
+    LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_accept(%d): returning EWOULDBLOCK\n", s));
+    sock_set_errno(sock, EWOULDBLOCK);
+    return -1;
+  }
+
   newconn = netconn_accept(sock->conn);
   if (!newconn) {
     LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_accept(%d) failed, err=%d\n", s, sock->conn->err));
@@ -627,7 +633,22 @@ lwip_send(int s, const void *data, int size, unsigned int flags)
 #endif /* (LWIP_UDP || LWIP_RAW) */
   }
 
-  err = netconn_write(sock->conn, data, size, NETCONN_COPY | ((flags & MSG_MORE)?NETCONN_MORE:0));
+  /* A non-blocking send queues only what fits in the send buffer now,
+     so netconn_write never has to wait for an ACK. */
+  if (((flags & MSG_DONTWAIT) || (sock->flags & O_NONBLOCK)) &&
+      sock->conn->pcb.tcp != NULL) {
+    struct tcp_pcb *pcb = sock->conn->pcb.tcp;
+    if (tcp_sndbuf(pcb) == 0 || pcb->snd_queuelen >= TCP_SND_QUEUELEN) {
+      LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send(%d): returning EWOULDBLOCK\n", s));
+      sock_set_errno(sock, EWOULDBLOCK);
+      return -1;
+    }
+    size = LWIP_MIN(size, tcp_sndbuf(pcb));
+  }
+
+  err = netconn_write(sock->conn, data, size,
+                      ((flags & MSG_NOCOPY)?NETCONN_NOCOPY:NETCONN_COPY) |
+                      ((flags & MSG_MORE)?NETCONN_MORE:0));
 
   LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_send(%d) err=%d size=%d\n", s, err, size));
   sock_set_errno(sock, err_to_errno(err));
@@ -1049,6 +1070,10 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
   }
   sys_sem_signal(selectsem);
 
+#ifdef LWIP_SOCKET_EVENT_HOOK
+  LWIP_SOCKET_EVENT_HOOK(s, evt);
+#endif
+
   /* Now decide if anyone is waiting for this socket */
   /* NOTE: This code is written this way to protect the select link list
      but to avoid a deadlock situation by releasing socksem before
@@ -1081,15 +1106,36 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
 }
 
 /**
- * Unimplemented: Close one end of a full-duplex connection.
- * Currently, the full connection is closed.
+ * Shut down part of a connection.  The socket stays open until
+ * lwip_close().  Only the sending half can be closed: after SHUT_RD
+ * the peer's data is still delivered.
  */
 int
 lwip_shutdown(int s, int how)
 {
-  LWIP_UNUSED_ARG(how);
+  struct lwip_socket *sock;
+  err_t err;
+
   LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_shutdown(%d, how=%d)\n", s, how));
-  return lwip_close(s); /* XXX temporary hack until proper implementation */
+
+  sock = get_socket(s);
+  if (!sock) {
+    return -1;
+  }
+
+  LWIP_ERROR("lwip_shutdown: invalid how", ((how == SHUT_RD) || (how == SHUT_WR) || (how == SHUT_RDWR)),
+             sock_set_errno(sock, err_to_errno(ERR_ARG)); return -1;);
+
+  if (how != SHUT_RD) {
+    err = netconn_close_tx(sock->conn);
+    if (err != ERR_OK) {
+      sock_set_errno(sock, err_to_errno(err));
+      return -1;
+    }
+  }
+
+  sock_set_errno(sock, 0);
+  return 0;
 }
 
 static int
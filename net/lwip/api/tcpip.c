@@ -64,7 +64,7 @@ static sys_mbox_t mbox = SYS_MBOX_NULL;
 sys_sem_t lock_tcpip_core;
 #endif /* LWIP_TCPIP_CORE_LOCKING */
 
-#if LWIP_TCP
+#if LWIP_TCP && TCPIP_TIMERS
 /* global variable that shows if the tcp timer is currently scheduled or not */
 static int tcpip_tcp_timer_active;
 
@@ -107,7 +107,7 @@ tcp_timer_needed(void)
   }
 }
 #endif /* !NO_SYS */
-#endif /* LWIP_TCP */
+#endif /* LWIP_TCP && TCPIP_TIMERS */
 
 #if IP_REASSEMBLY
 /**
@@ -125,7 +125,7 @@ ip_reass_timer(void *arg)
 }
 #endif /* IP_REASSEMBLY */
 
-#if LWIP_ARP
+#if LWIP_ARP && TCPIP_TIMERS
 /**
  * Timer callback function that calls etharp_tmr() and reschedules itself.
  *
@@ -139,9 +139,9 @@ arp_timer(void *arg)
   etharp_tmr();
   sys_timeout(ARP_TMR_INTERVAL, arp_timer, NULL);
 }
-#endif /* LWIP_ARP */
+#endif /* LWIP_ARP && TCPIP_TIMERS */
 
-#if LWIP_DHCP
+#if LWIP_DHCP && TCPIP_TIMERS
 /**
  * Timer callback function that calls dhcp_coarse_tmr() and reschedules itself.
  *
@@ -169,7 +169,7 @@ dhcp_timer_fine(void *arg)
   dhcp_fine_tmr();
   sys_timeout(DHCP_FINE_TIMER_MSECS, dhcp_timer_fine, NULL);
 }
-#endif /* LWIP_DHCP */
+#endif /* LWIP_DHCP && TCPIP_TIMERS */
 
 #if LWIP_AUTOIP
 /**
@@ -238,13 +238,13 @@ tcpip_thread(void *arg)
 #if IP_REASSEMBLY
   sys_timeout(IP_TMR_INTERVAL, ip_reass_timer, NULL);
 #endif /* IP_REASSEMBLY */
-#if LWIP_ARP
+#if LWIP_ARP && TCPIP_TIMERS
   sys_timeout(ARP_TMR_INTERVAL, arp_timer, NULL);
-#endif /* LWIP_ARP */
-#if LWIP_DHCP
+#endif /* LWIP_ARP && TCPIP_TIMERS */
+#if LWIP_DHCP && TCPIP_TIMERS
   sys_timeout(DHCP_COARSE_TIMER_MSECS, dhcp_timer_coarse, NULL);
   sys_timeout(DHCP_FINE_TIMER_MSECS, dhcp_timer_fine, NULL);
-#endif /* LWIP_DHCP */
+#endif /* LWIP_DHCP && TCPIP_TIMERS */
 #if LWIP_AUTOIP
   sys_timeout(AUTOIP_TMR_INTERVAL, autoip_timer, NULL);
 #endif /* LWIP_AUTOIP */
@@ -73,38 +73,54 @@
 struct mem_helper
 {
    memp_t poolnr;
+#ifdef MEM_POOL_OVERFLOW_ALLOC
+   /* size of an element from MEM_POOL_OVERFLOW_ALLOC (poolnr == MEMP_MAX) */
+   mem_size_t size;
+#endif /* MEM_POOL_OVERFLOW_ALLOC */
 };
 
 /**
  * Allocate memory: determine the smallest pool that is big enough
- * to contain an element of 'size' and get an element from that pool.
+ * to contain an element of 'size' and get an element from that pool,
+ * or from the next bigger one if it is empty. If MEM_POOL_OVERFLOW_ALLOC
+ * is defined, memory that no pool can provide comes from it instead.
  *
  * @param size the size in bytes of the memory needed
- * @return a pointer to the allocated memory or NULL if the pool is empty
+ * @return a pointer to the allocated memory or NULL if the pools are empty
  */
 void *
 mem_malloc(mem_size_t size)
 {
-  struct mem_helper *element;
+  struct mem_helper *element = NULL;
   memp_t poolnr;
 
   for (poolnr = MEMP_POOL_FIRST; poolnr <= MEMP_POOL_LAST; poolnr++) {
     /* is this pool big enough to hold an element of the required size
        plus a struct mem_helper that saves the pool this element came from? */
     if ((size + sizeof(struct mem_helper)) <= memp_sizes[poolnr]) {
-      break;
+      /* No need to DEBUGF or ASSERT if it is empty: This error is
+         already taken care of in memp.c */
+      element = (struct mem_helper*)memp_malloc(poolnr);
+      if (element != NULL) {
+        break;
+      }
     }
   }
-  if (poolnr > MEMP_POOL_LAST) {
-    LWIP_ASSERT("mem_malloc(): no pool is that big!", 0);
-    return NULL;
-  }
-  element = (struct mem_helper*)memp_malloc(poolnr);
   if (element == NULL) {
-    /* No need to DEBUGF or ASSERT: This error is already
-       taken care of in memp.c */
-    /** @todo: we could try a bigger pool if this one is empty! */
+#ifdef MEM_POOL_OVERFLOW_ALLOC
+    element = (struct mem_helper*)MEM_POOL_OVERFLOW_ALLOC(size + sizeof(struct mem_helper));
+    if (element == NULL) {
+      MEM_STATS_INC(err);
+      return NULL;
+    }
+    element->size = size;
+    MEM_STATS_INC_USED(used, size);
+    poolnr = MEMP_MAX;
+#else /* MEM_POOL_OVERFLOW_ALLOC */
+    LWIP_ASSERT("mem_malloc(): no pool is that big!",
+      (size + sizeof(struct mem_helper)) <= memp_sizes[MEMP_POOL_LAST]);
     return NULL;
+#endif /* MEM_POOL_OVERFLOW_ALLOC */
   }
 
   /* save the pool number this element came from */
@@ -135,6 +151,13 @@ mem_free(void *rmem)
 
   LWIP_ASSERT("hmem != NULL", (hmem != NULL));
   LWIP_ASSERT("hmem == MEM_ALIGN(hmem)", (hmem == LWIP_MEM_ALIGN(hmem)));
+#ifdef MEM_POOL_OVERFLOW_ALLOC
+  if (hmem->poolnr == MEMP_MAX) {
+    MEM_STATS_DEC_USED(used, hmem->size);
+    MEM_POOL_OVERFLOW_FREE(hmem);
+    return;
+  }
+#endif /* MEM_POOL_OVERFLOW_ALLOC */
   LWIP_ASSERT("hmem->poolnr < MEMP_MAX", (hmem->poolnr < MEMP_MAX));
 
   /* and put it in the pool we saved earlier */
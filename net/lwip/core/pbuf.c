@@ -399,6 +399,12 @@ pbuf_header(struct pbuf *p, s16_t header_size_increment)
     if ((header_size_increment < 0) && (increment_magnitude <= p->len)) {
       /* increase payload pointer */
       p->payload = (u8_t *)p->payload - header_size_increment;
+#ifdef LWIP_PBUF_REF_HEADROOM
+    /* uncover a header the owner of the memory says is there? */
+    } else if ((type == PBUF_REF) && (header_size_increment > 0) &&
+               (increment_magnitude <= LWIP_PBUF_REF_HEADROOM(p))) {
+      p->payload = (u8_t *)p->payload - header_size_increment;
+#endif
     } else {
       /* cannot expand payload to front (yet!)
        * bail out unsuccesfully */
@@ -500,6 +506,11 @@ pbuf_free(struct pbuf *p)
         memp_free(MEMP_PBUF_POOL, p);
       /* is this a ROM or RAM referencing pbuf? */
       } else if (type == PBUF_ROM || type == PBUF_REF) {
+#ifdef LWIP_PBUF_REF_FREE
+        /* let the owner of the referenced memory reclaim it */
+        if (type == PBUF_REF)
+          LWIP_PBUF_REF_FREE(p);
+#endif
         memp_free(MEMP_PBUF, p);
       /* type == PBUF_RAM */
       } else {
@@ -73,6 +73,15 @@ struct tcp_pcb *tcp_tw_pcbs;
 
 struct tcp_pcb *tcp_tmp_pcb;
 
+#if TCP_PCB_HASH_SIZE
+/** Active and TIME-WAIT PCBs by tcp_hash(), chained through hnext */
+static struct tcp_pcb *tcp_pcb_hash[TCP_PCB_HASH_SIZE];
+/** Listening PCBs by local port, chained through hnext */
+static struct tcp_pcb_listen *tcp_listen_hash[TCP_LISTEN_HASH_SIZE];
+
+#define TCP_LISTEN_HASH(port) ((port) & (TCP_LISTEN_HASH_SIZE - 1))
+#endif /* TCP_PCB_HASH_SIZE */
+
 static u8_t tcp_timer;
 static u16_t tcp_new_port(void);
 
@@ -426,8 +435,8 @@ tcp_recved(struct tcp_pcb *pcb, u16_t len)
     tcp_ack_now(pcb);
   }
 
-  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"U16_F" (%"U16_F").\n",
-         len, pcb->rcv_wnd, TCP_WND - pcb->rcv_wnd));
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"U32_F" (%"U32_F").\n",
+         len, (u32_t)pcb->rcv_wnd, (u32_t)(TCP_WND - pcb->rcv_wnd)));
 }
 
 /**
@@ -485,7 +494,8 @@ err_t
 tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
       err_t (* connected)(void *arg, struct tcp_pcb *tpcb, err_t err))
 {
-  u32_t optdata;
+  u32_t optdata[3];
+  u8_t optlen;
   err_t ret;
   u32_t iss;
 
@@ -526,10 +536,19 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
 
   snmp_inc_tcpactiveopens();
   
-  /* Build an MSS option */
-  optdata = TCP_BUILD_MSS_OPTION();
-
-  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, (u8_t *)&optdata, 4);
+  /* Build an MSS option, and offer to scale windows and to SACK */
+  optdata[0] = TCP_BUILD_MSS_OPTION();
+  optlen = 4;
+#if LWIP_WND_SCALE
+  optdata[optlen / 4] = TCP_BUILD_WS_OPTION();
+  optlen += 4;
+#endif /* LWIP_WND_SCALE */
+#if LWIP_SACK
+  optdata[optlen / 4] = TCP_BUILD_SACK_PERM_OPTION();
+  optlen += 4;
+#endif /* LWIP_SACK */
+
+  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, (u8_t *)optdata, optlen);
   if (ret == ERR_OK) { 
     tcp_output(pcb);
   }
@@ -547,7 +566,7 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *pcb2, *prev;
-  u16_t eff_wnd;
+  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   err_t err;
 
@@ -709,6 +728,7 @@ tcp_slowtmr(void)
         LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_active_pcbs", tcp_active_pcbs == pcb);
         tcp_active_pcbs = pcb->next;
       }
+      TCP_HASH_RMV(&tcp_active_pcbs, pcb);
 
       TCP_EVENT_ERR(pcb->errf, pcb->callback_arg, ERR_ABRT);
 
@@ -760,6 +780,7 @@ tcp_slowtmr(void)
         LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_tw_pcbs", tcp_tw_pcbs == pcb);
         tcp_tw_pcbs = pcb->next;
       }
+      TCP_HASH_RMV(&tcp_tw_pcbs, pcb);
       pcb2 = pcb->next;
       memp_free(MEMP_TCP_PCB, pcb);
       pcb = pcb2;
@@ -1213,6 +1234,135 @@ tcp_pcb_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
   LWIP_ASSERT("tcp_pcb_remove: tcp_pcbs_sane()", tcp_pcbs_sane());
 }
 
+#if TCP_PCB_HASH_SIZE
+/**
+ * Hashes the remote address and the ports of a connection. The local
+ * address is left out, as most hosts have only one.
+ */
+static u32_t
+tcp_hash(struct ip_addr *remote_ip, u16_t remote_port, u16_t local_port)
+{
+  u32_t h;
+
+  h = remote_ip->addr ^ (((u32_t)remote_port << 16) | local_port);
+  h ^= h >> 16;
+  h *= 0x45d9f3bU;
+  h ^= h >> 16;
+  return h & (TCP_PCB_HASH_SIZE - 1);
+}
+
+/**
+ * Adds a PCB just put on a PCB list to the hash chain for that list, if
+ * tcp_input() looks PCBs of that list up. Called by TCP_REG.
+ *
+ * @param pcbs PCB list the PCB was put on
+ * @param npcb the tcp_pcb, or a tcp_pcb_listen for tcp_listen_pcbs
+ */
+void
+tcp_hash_reg(struct tcp_pcb **pcbs, struct tcp_pcb *npcb)
+{
+  struct tcp_pcb **bucket;
+  struct tcp_pcb_listen *lpcb, **lbucket;
+
+  if (pcbs == &tcp_active_pcbs || pcbs == &tcp_tw_pcbs) {
+    bucket = &tcp_pcb_hash[tcp_hash(&npcb->remote_ip, npcb->remote_port,
+                                    npcb->local_port)];
+    npcb->hnext = *bucket;
+    *bucket = npcb;
+  } else if (pcbs == &tcp_listen_pcbs.pcbs) {
+    lpcb = (struct tcp_pcb_listen *)npcb;
+    lbucket = &tcp_listen_hash[TCP_LISTEN_HASH(lpcb->local_port)];
+    lpcb->hnext = *lbucket;
+    *lbucket = lpcb;
+  }
+}
+
+/**
+ * Removes a PCB taken off a PCB list from its hash chain. Called by
+ * TCP_RMV.
+ *
+ * @param pcbs PCB list the PCB was taken off
+ * @param npcb the tcp_pcb, or a tcp_pcb_listen for tcp_listen_pcbs
+ */
+void
+tcp_hash_rmv(struct tcp_pcb **pcbs, struct tcp_pcb *npcb)
+{
+  struct tcp_pcb **pp;
+  struct tcp_pcb_listen *lpcb, **lpp;
+
+  if (pcbs == &tcp_active_pcbs || pcbs == &tcp_tw_pcbs) {
+    for (pp = &tcp_pcb_hash[tcp_hash(&npcb->remote_ip, npcb->remote_port,
+                                     npcb->local_port)];
+         *pp != NULL; pp = &(*pp)->hnext) {
+      if (*pp == npcb) {
+        *pp = npcb->hnext;
+        break;
+      }
+    }
+    npcb->hnext = NULL;
+  } else if (pcbs == &tcp_listen_pcbs.pcbs) {
+    lpcb = (struct tcp_pcb_listen *)npcb;
+    for (lpp = &tcp_listen_hash[TCP_LISTEN_HASH(lpcb->local_port)];
+         *lpp != NULL; lpp = &(*lpp)->hnext) {
+      if (*lpp == lpcb) {
+        *lpp = lpcb->hnext;
+        break;
+      }
+    }
+    lpcb->hnext = NULL;
+  }
+}
+
+/**
+ * Finds the active or TIME-WAIT PCB of a connection, preferring an
+ * active one as the list walk in tcp_input() did.
+ *
+ * @return the tcp_pcb, or NULL if there is none
+ */
+struct tcp_pcb *
+tcp_hash_lookup(struct ip_addr *local_ip, u16_t local_port,
+                struct ip_addr *remote_ip, u16_t remote_port)
+{
+  struct tcp_pcb *pcb, *tw = NULL;
+
+  for (pcb = tcp_pcb_hash[tcp_hash(remote_ip, remote_port, local_port)];
+       pcb != NULL; pcb = pcb->hnext) {
+    if (pcb->remote_port == remote_port &&
+        pcb->local_port == local_port &&
+        ip_addr_cmp(&(pcb->remote_ip), remote_ip) &&
+        ip_addr_cmp(&(pcb->local_ip), local_ip)) {
+      if (pcb->state != TIME_WAIT) {
+        return pcb;
+      }
+      tw = pcb;
+    }
+  }
+  return tw;
+}
+
+/**
+ * Finds the PCB listening on a local address and port, or on the port of
+ * any address.
+ *
+ * @return the tcp_pcb_listen, or NULL if there is none
+ */
+struct tcp_pcb_listen *
+tcp_hash_lookup_listen(struct ip_addr *local_ip, u16_t local_port)
+{
+  struct tcp_pcb_listen *lpcb;
+
+  for (lpcb = tcp_listen_hash[TCP_LISTEN_HASH(local_port)];
+       lpcb != NULL; lpcb = lpcb->hnext) {
+    if ((ip_addr_isany(&(lpcb->local_ip)) ||
+         ip_addr_cmp(&(lpcb->local_ip), local_ip)) &&
+        lpcb->local_port == local_port) {
+      return lpcb;
+    }
+  }
+  return NULL;
+}
+#endif /* TCP_PCB_HASH_SIZE */
+
 /**
  * Calculates a new initial sequence number for new connections.
  *
@@ -76,6 +76,10 @@ struct tcp_pcb *tcp_input_pcb;
 static err_t tcp_process(struct tcp_pcb *pcb);
 static u8_t tcp_receive(struct tcp_pcb *pcb);
 static void tcp_parseopt(struct tcp_pcb *pcb);
+#if LWIP_SACK
+static void tcp_parsesack(struct tcp_pcb *pcb);
+static void tcp_sack_rexmit(struct tcp_pcb *pcb);
+#endif /* LWIP_SACK */
 
 static err_t tcp_listen_input(struct tcp_pcb_listen *pcb);
 static err_t tcp_timewait_input(struct tcp_pcb *pcb);
@@ -131,8 +135,9 @@ tcp_input(struct pbuf *p, struct netif *inp)
   }
 
 #if CHECKSUM_CHECK_TCP
-  /* Verify TCP checksum. */
-  if (inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
+  /* Verify TCP checksum, unless the network interface already did. */
+  if (!(p->flags & PBUF_FLAG_CSUM_L4_OK) &&
+      inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
       (struct ip_addr *)&(iphdr->dest),
       IP_PROTO_TCP, p->tot_len) != 0) {
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packet discarded due to failing checksum 0x%04"X16_F"\n",
@@ -172,6 +177,27 @@ tcp_input(struct pbuf *p, struct netif *inp)
   flags = TCPH_FLAGS(tcphdr) & TCP_FLAGS;
   tcplen = p->tot_len + ((flags & TCP_FIN || flags & TCP_SYN)? 1: 0);
 
+#if TCP_PCB_HASH_SIZE
+  /* Demultiplex an incoming segment through the hash tables: an active
+     connection first, then one in TIME-WAIT, then a listening PCB. */
+  pcb = tcp_hash_lookup(&(iphdr->dest), tcphdr->dest,
+                        &(iphdr->src), tcphdr->src);
+  if (pcb != NULL && pcb->state == TIME_WAIT) {
+    LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for TIME_WAITing connection.\n"));
+    tcp_timewait_input(pcb);
+    pbuf_free(p);
+    return;
+  }
+  if (pcb == NULL) {
+    lpcb = tcp_hash_lookup_listen(&(iphdr->dest), tcphdr->dest);
+    if (lpcb != NULL) {
+      LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for LISTENing connection.\n"));
+      tcp_listen_input(lpcb);
+      pbuf_free(p);
+      return;
+    }
+  }
+#else /* TCP_PCB_HASH_SIZE */
   /* Demultiplex an incoming segment. First, we check if it is destined
      for an active connection. */
   prev = NULL;
@@ -246,6 +272,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
       prev = (struct tcp_pcb *)lpcb;
     }
   }
+#endif /* TCP_PCB_HASH_SIZE */
 
 #if TCP_INPUT_DEBUG
   LWIP_DEBUGF(TCP_INPUT_DEBUG, ("+-+-+-+-+-+-+-+-+-+-+-+-+-+- tcp_input: flags "));
@@ -393,7 +420,8 @@ static err_t
 tcp_listen_input(struct tcp_pcb_listen *pcb)
 {
   struct tcp_pcb *npcb;
-  u32_t optdata;
+  u32_t optdata[3];
+  u8_t optlen;
 
   /* In the LISTEN state, we check for incoming SYN segments,
      creates a new PCB, and responds with a SYN|ACK. */
@@ -451,10 +479,24 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 
     snmp_inc_tcppassiveopens();
 
-    /* Build an MSS option. */
-    optdata = TCP_BUILD_MSS_OPTION();
-    /* Send a SYN|ACK together with the MSS option. */
-    tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, (u8_t *)&optdata, 4);
+    /* Build an MSS option, and window scale and SACK permitted options
+       if the SYN had them. */
+    optdata[0] = TCP_BUILD_MSS_OPTION();
+    optlen = 4;
+#if LWIP_WND_SCALE
+    if (npcb->flags & TF_WND_SCALE) {
+      optdata[optlen / 4] = TCP_BUILD_WS_OPTION();
+      optlen += 4;
+    }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_SACK
+    if (npcb->flags & TF_SACK) {
+      optdata[optlen / 4] = TCP_BUILD_SACK_PERM_OPTION();
+      optlen += 4;
+    }
+#endif /* LWIP_SACK */
+    /* Send a SYN|ACK together with the options. */
+    tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, (u8_t *)optdata, optlen);
     return tcp_output(npcb);
   }
   return ERR_OK;
@@ -596,7 +638,7 @@ tcp_process(struct tcp_pcb *pcb)
        !(flags & TCP_RST)) {
       /* expected ACK number? */
       if (TCP_SEQ_BETWEEN(ackno, pcb->lastack+1, pcb->snd_nxt)) {
-        u16_t old_cwnd;
+        tcpwnd_size_t old_cwnd;
         pcb->state = ESTABLISHED;
         LWIP_DEBUGF(TCP_DEBUG, ("TCP connection established %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
 #if LWIP_CALLBACK_API
@@ -721,24 +763,33 @@ tcp_receive(struct tcp_pcb *pcb)
   u32_t right_wnd_edge;
   u16_t new_tot_len;
   u8_t accepted_inseq = 0;
+  u8_t partial = 0;
+  tcpwnd_size_t snd_wnd;
 
   if (flags & TCP_ACK) {
+#if LWIP_SACK
+    if ((pcb->flags & TF_SACK) && TCPH_HDRLEN(tcphdr) > 5) {
+      tcp_parsesack(pcb);
+    }
+#endif /* LWIP_SACK */
     right_wnd_edge = pcb->snd_wnd + pcb->snd_wl1;
+    /* The window of a SYN is never scaled. */
+    snd_wnd = (flags & TCP_SYN) ? tcphdr->wnd : SND_WND_SCALE(pcb, tcphdr->wnd);
 
     /* Update window. */
     if (TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
        (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
-       (pcb->snd_wl2 == ackno && tcphdr->wnd > pcb->snd_wnd)) {
-      pcb->snd_wnd = tcphdr->wnd;
+       (pcb->snd_wl2 == ackno && snd_wnd > pcb->snd_wnd)) {
+      pcb->snd_wnd = snd_wnd;
       pcb->snd_wl1 = seqno;
       pcb->snd_wl2 = ackno;
       if (pcb->snd_wnd > 0 && pcb->persist_backoff > 0) {
           pcb->persist_backoff = 0;
       }
-      LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"U16_F"\n", pcb->snd_wnd));
+      LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"U32_F"\n", (u32_t)pcb->snd_wnd));
 #if TCP_WND_DEBUG
     } else {
-      if (pcb->snd_wnd != tcphdr->wnd) {
+      if (pcb->snd_wnd != snd_wnd) {
         LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: no window update lastack %"U32_F" snd_max %"U32_F" ackno %"U32_F" wl1 %"U32_F" seqno %"U32_F" wl2 %"U32_F"\n",
                                pcb->lastack, pcb->snd_max, ackno, pcb->snd_wl1, seqno, pcb->snd_wl2));
       }
@@ -775,12 +826,21 @@ tcp_receive(struct tcp_pcb *pcb)
 
             pcb->cwnd = pcb->ssthresh + 3 * pcb->mss;
             pcb->flags |= TF_INFR;
+            /* Recovery ends once everything sent so far is acknowledged */
+            pcb->recover = pcb->snd_max;
           } else {
             /* Inflate the congestion window, but not if it means that
                the value overflows. */
-            if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+            if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
               pcb->cwnd += pcb->mss;
             }
+#if LWIP_SACK
+            /* Each duplicate ACK means a segment left the network, so
+               fill the next hole the receiver reported. */
+            if (pcb->flags & TF_SACK) {
+              tcp_sack_rexmit(pcb);
+            }
+#endif /* LWIP_SACK */
           }
         }
       } else {
@@ -790,12 +850,19 @@ tcp_receive(struct tcp_pcb *pcb)
     } else if (TCP_SEQ_BETWEEN(ackno, pcb->lastack+1, pcb->snd_max)){
       /* We come here when the ACK acknowledges new data. */
       
-      /* Reset the "IN Fast Retransmit" flag, since we are no longer
-         in fast retransmit. Also reset the congestion window to the
-         slow start threshold. */
+      /* An ACK below the recovery point is a partial ACK (NewReno, RFC
+         6582): the segment after the acknowledged data was lost as well.
+         Stay in fast recovery and retransmit it below. Otherwise, reset
+         the "IN Fast Retransmit" flag, since we are no longer in fast
+         retransmit, and the congestion window to the slow start
+         threshold. */
       if (pcb->flags & TF_INFR) {
-        pcb->flags &= ~TF_INFR;
-        pcb->cwnd = pcb->ssthresh;
+        if (TCP_SEQ_LT(ackno, pcb->recover)) {
+          partial = 1;
+        } else {
+          pcb->flags &= ~TF_INFR;
+          pcb->cwnd = pcb->ssthresh;
+        }
       }
 
       /* Reset the number of retransmissions. */
@@ -810,19 +877,28 @@ tcp_receive(struct tcp_pcb *pcb)
       pcb->snd_buf += pcb->acked;
 
       /* Reset the fast retransmit variables. */
-      pcb->dupacks = 0;
+      if (!partial) {
+        pcb->dupacks = 0;
+      }
       pcb->lastack = ackno;
 
       /* Update the congestion control variables (cwnd and
-         ssthresh). */
-      if (pcb->state >= ESTABLISHED) {
+         ssthresh). A partial ACK deflates the congestion window by the
+         amount acknowledged, and adds back one segment for the
+         retransmission. */
+      if (partial) {
+        pcb->cwnd = (pcb->cwnd > pcb->acked ? pcb->cwnd - pcb->acked : 0) +
+          pcb->mss;
+        LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_receive: partial ACK %"U32_F", recover %"U32_F"\n",
+                                   ackno, pcb->recover));
+      } else if (pcb->state >= ESTABLISHED) {
         if (pcb->cwnd < pcb->ssthresh) {
-          if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+          if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
             pcb->cwnd += pcb->mss;
           }
           LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"U16_F"\n", pcb->cwnd));
         } else {
-          u16_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
+          tcpwnd_size_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
           if (new_cwnd > pcb->cwnd) {
             pcb->cwnd = new_cwnd;
           }
@@ -868,6 +944,18 @@ tcp_receive(struct tcp_pcb *pcb)
       else
         pcb->rtime = 0;
 
+      if (partial && pcb->unacked != NULL) {
+#if LWIP_SACK
+        /* If the first unacked segment already went out again in this
+           recovery, fill the next hole the receiver reported instead */
+        if ((pcb->flags & TF_SACK) &&
+            TCP_SEQ_LT(ntohl(pcb->unacked->tcphdr->seqno), pcb->rtx_high)) {
+          tcp_sack_rexmit(pcb);
+        } else
+#endif /* LWIP_SACK */
+        tcp_rexmit(pcb);
+      }
+
       pcb->polltmr = 0;
     } else {
       /* Fix bug bug #21582: out of sequence ACK, didn't really ack anything */
@@ -1158,6 +1246,10 @@ tcp_receive(struct tcp_pcb *pcb)
 
       } else {
         /* We get here if the incoming segment is out-of-sequence. */
+#if LWIP_SACK
+        /* The ACK reports the block with this segment first */
+        pcb->rcv_sack = seqno;
+#endif /* LWIP_SACK */
         tcp_ack_now(pcb);
 #if TCP_QUEUE_OOSEQ
         /* We queue the segment on the ->ooseq queue. */
@@ -1301,7 +1393,8 @@ tcp_receive(struct tcp_pcb *pcb)
  * from uIP with only small changes.)
  *
  * Called from tcp_listen_input() and tcp_process().
- * Currently, only the MSS option is supported!
+ * Currently, only the MSS, window scale and SACK permitted options are
+ * supported! SACK blocks are read by tcp_parsesack().
  *
  * @param pcb the tcp_pcb for which a segment arrived
  */
@@ -1314,7 +1407,7 @@ tcp_parseopt(struct tcp_pcb *pcb)
 
   opts = (u8_t *)tcphdr + TCP_HLEN;
 
-  /* Parse the TCP MSS option, if present. */
+  /* Parse the TCP MSS, window scale and SACK permitted options, if present. */
   if(TCPH_HDRLEN(tcphdr) > 0x5) {
     for(c = 0; c < (TCPH_HDRLEN(tcphdr) - 5) << 2 ;) {
       opt = opts[c];
@@ -1330,9 +1423,30 @@ tcp_parseopt(struct tcp_pcb *pcb)
         mss = (opts[c + 2] << 8) | opts[c + 3];
         /* Limit the mss to the configured TCP_MSS and prevent division by zero */
         pcb->mss = ((mss > TCP_MSS) || (mss == 0)) ? TCP_MSS : mss;
-
-        /* And we are done processing options. */
-        break;
+        c += 0x04;
+#if LWIP_WND_SCALE
+      } else if (opt == 0x03 &&
+        opts[c + 1] == 0x03) {
+        /* A window scale option, which only counts on a SYN. Both
+           sides scale from now on, the remote side by its shift and
+           we by ours (RFC 1323 section 2). */
+        if (flags & TCP_SYN) {
+          pcb->snd_scale = LWIP_MIN(opts[c + 2], 14);
+          pcb->rcv_scale = TCP_RCV_SCALE;
+          pcb->flags |= TF_WND_SCALE;
+        }
+        c += 0x03;
+#endif /* LWIP_WND_SCALE */
+#if LWIP_SACK
+      } else if (opt == 0x04 &&
+        opts[c + 1] == 0x02) {
+        /* SACK permitted, which also only counts on a SYN. We offer it
+           in our SYN, or answer with it in our SYN|ACK. */
+        if (flags & TCP_SYN) {
+          pcb->flags |= TF_SACK;
+        }
+        c += 0x02;
+#endif /* LWIP_SACK */
       } else {
         if (opts[c + 1] == 0) {
           /* If the length field is zero, the options are malformed
@@ -1347,4 +1461,91 @@ tcp_parseopt(struct tcp_pcb *pcb)
   }
 }
 
+#if LWIP_SACK
+/**
+ * Marks the segments on the unacked queue that the SACK blocks of the
+ * incoming segment cover (RFC 2018), so that fast recovery retransmits
+ * only the ones in between.
+ *
+ * Called from tcp_receive().
+ *
+ * @param pcb the tcp_pcb for which a segment arrived
+ */
+static void
+tcp_parsesack(struct tcp_pcb *pcb)
+{
+  u8_t c, i, optlen;
+  u8_t *opts;
+  u32_t left, right, segno;
+  struct tcp_seg *seg;
+
+  opts = (u8_t *)tcphdr + TCP_HLEN;
+  optlen = (TCPH_HDRLEN(tcphdr) - 5) << 2;
+
+  for(c = 0; c < optlen;) {
+    if (opts[c] == 0x00) {
+      /* End of options. */
+      break;
+    } else if (opts[c] == 0x01) {
+      /* NOP option. */
+      ++c;
+      continue;
+    }
+    if (c + 1 >= optlen || opts[c + 1] < 2 || c + opts[c + 1] > optlen) {
+      /* Malformed options. */
+      break;
+    }
+    if (opts[c] == 0x05) {
+      /* A SACK option: pairs of left and right edges in network order */
+      for(i = c + 2; i + 8 <= c + opts[c + 1]; i += 8) {
+        left = ((u32_t)opts[i] << 24) | ((u32_t)opts[i + 1] << 16) |
+          ((u32_t)opts[i + 2] << 8) | opts[i + 3];
+        right = ((u32_t)opts[i + 4] << 24) | ((u32_t)opts[i + 5] << 16) |
+          ((u32_t)opts[i + 6] << 8) | opts[i + 7];
+        for(seg = pcb->unacked; seg != NULL; seg = seg->next) {
+          segno = ntohl(seg->tcphdr->seqno);
+          if (TCP_SEQ_GEQ(segno, right)) {
+            break;
+          }
+          if (TCP_SEQ_GEQ(segno, left) &&
+              TCP_SEQ_LEQ(segno + TCP_TCPLEN(seg), right)) {
+            seg->flags |= TF_SEG_SACKED;
+          }
+        }
+      }
+    }
+    c += opts[c + 1];
+  }
+}
+
+/**
+ * Retransmits the first segment that the receiver has not reported in a
+ * SACK block although it reported a later one, and that has not been
+ * retransmitted in this recovery yet (NextSeg() rule 1 of RFC 6675).
+ *
+ * Called from tcp_receive() in fast recovery.
+ *
+ * @param pcb the tcp_pcb to retransmit a segment of
+ */
+static void
+tcp_sack_rexmit(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg, *hole = NULL;
+
+  for(seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (seg->flags & TF_SEG_SACKED) {
+      if (hole != NULL) {
+        LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_sack_rexmit: %"U32_F"\n",
+                                   ntohl(hole->tcphdr->seqno)));
+        tcp_rexmit_seg(pcb, hole);
+        return;
+      }
+    } else if (hole == NULL &&
+               TCP_SEQ_GEQ(ntohl(seg->tcphdr->seqno), pcb->rtx_high)) {
+      hole = seg;
+    }
+  }
+}
+#endif /* LWIP_SACK */
+
 #endif /* LWIP_TCP */
@@ -58,6 +58,17 @@
 
 /* Forward declarations.*/
 static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
+#if LWIP_SACK && TCP_QUEUE_OOSEQ
+/** Most SACK blocks an ACK reports; four take 36 of the 40 option bytes */
+#define TCP_SACK_BLOCKS 4
+static u8_t tcp_build_sack(struct tcp_pcb *pcb, u32_t *opts);
+#endif /* LWIP_SACK && TCP_QUEUE_OOSEQ */
+#if TCP_TSO_MAX
+/** Most segments tcp_output() joins into one super-segment */
+#define TCP_TSO_SEGS (TCP_TSO_MAX / TCP_MSS)
+static int tcp_tso_ok(struct tcp_seg *seg);
+static void tcp_output_tso(struct tcp_seg **segs, int n, struct tcp_pcb *pcb);
+#endif /* TCP_TSO_MAX */
 
 /**
  * Called by tcp_close() to send a segment including flags but not data.
@@ -195,6 +206,9 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
     }
     seg->next = NULL;
     seg->p = NULL;
+#if LWIP_SACK
+    seg->flags = 0;
+#endif /* LWIP_SACK */
 
     /* first segment of to-be-queued data? */
     if (queue == NULL) {
@@ -243,9 +257,16 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
       /* First, allocate a pbuf for holding the data.
        * since the referenced data is available at least until it is sent out on the
        * link (as it has to be ACKed by the remote party) we can safely use PBUF_ROM
-       * instead of PBUF_REF here.
+       * instead of PBUF_REF here. Unless the owner of the data wants to
+       * pin it while it is referenced: then it is a PBUF_REF, so that
+       * LWIP_PBUF_REF_FREE tells the owner when to let go.
        */
-      if ((p = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_ROM)) == NULL) {
+#ifdef LWIP_PBUF_REF_PIN
+      p = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_REF);
+#else
+      p = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_ROM);
+#endif
+      if (p == NULL) {
         LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 2, ("tcp_enqueue: could not allocate memory for zero-copy pbuf\n"));
         goto memerr;
       }
@@ -253,6 +274,9 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
       /* reference the non-volatile payload data */
       p->payload = ptr;
       seg->dataptr = ptr;
+#ifdef LWIP_PBUF_REF_PIN
+      LWIP_PBUF_REF_PIN(p);
+#endif
 
       /* Second, allocate a pbuf for the headers. */
       if ((seg->p = pbuf_alloc(PBUF_TRANSPORT, 0, PBUF_RAM)) == NULL) {
@@ -414,9 +438,20 @@ tcp_output(struct tcp_pcb *pcb)
   struct tcp_hdr *tcphdr;
   struct tcp_seg *seg, *useg;
   u32_t wnd;
+  u8_t optlen = 0;
+#if LWIP_SACK && TCP_QUEUE_OOSEQ
+  u32_t optdata[1 + 2 * TCP_SACK_BLOCKS];
+#endif /* LWIP_SACK && TCP_QUEUE_OOSEQ */
 #if TCP_CWND_DEBUG
   s16_t i = 0;
 #endif /* TCP_CWND_DEBUG */
+#if TCP_TSO_MAX
+  struct tcp_seg *tso[TCP_TSO_SEGS], *last;
+  int ntso = 0;
+  u32_t tsolen = 0;
+  struct netif *netif;
+  int can_tso;
+#endif /* TCP_TSO_MAX */
 
   /* First, check if we are invoked by the TCP input processing
      code. If so, we do not output anything. Instead, we rely on the
@@ -426,6 +461,21 @@ tcp_output(struct tcp_pcb *pcb)
     return ERR_OK;
   }
 
+#if LWIP_SACK
+  /* Retransmit the segments tcp_rexmit_seg() marked where they are on
+     the unacked queue. They carry the ACK a TF_ACK_NOW asks for. */
+  if (pcb->flags & TF_RTX_SEG) {
+    pcb->flags &= ~TF_RTX_SEG;
+    for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+      if (seg->flags & TF_SEG_RTX) {
+        seg->flags &= ~TF_SEG_RTX;
+        tcp_output_segment(seg, pcb);
+        pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
+      }
+    }
+  }
+#endif /* LWIP_SACK */
+
   wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
 
   seg = pcb->unsent;
@@ -445,7 +495,10 @@ tcp_output(struct tcp_pcb *pcb)
   if (pcb->flags & TF_ACK_NOW &&
      (seg == NULL ||
       ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len > wnd)) {
-    p = pbuf_alloc(PBUF_IP, TCP_HLEN, PBUF_RAM);
+#if LWIP_SACK && TCP_QUEUE_OOSEQ
+    optlen = (pcb->flags & TF_SACK) ? tcp_build_sack(pcb, optdata) : 0;
+#endif /* LWIP_SACK && TCP_QUEUE_OOSEQ */
+    p = pbuf_alloc(PBUF_IP, TCP_HLEN + optlen, PBUF_RAM);
     if (p == NULL) {
       LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_output: (ACK) could not allocate pbuf\n"));
       return ERR_BUF;
@@ -460,9 +513,14 @@ tcp_output(struct tcp_pcb *pcb)
     tcphdr->seqno = htonl(pcb->snd_nxt);
     tcphdr->ackno = htonl(pcb->rcv_nxt);
     TCPH_FLAGS_SET(tcphdr, TCP_ACK);
-    tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+    tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
     tcphdr->urgp = 0;
-    TCPH_HDRLEN_SET(tcphdr, 5);
+    TCPH_HDRLEN_SET(tcphdr, 5 + optlen / 4);
+#if LWIP_SACK && TCP_QUEUE_OOSEQ
+    if (optlen > 0) {
+      SMEMCPY(tcphdr + 1, optdata, optlen);
+    }
+#endif /* LWIP_SACK && TCP_QUEUE_OOSEQ */
 
     tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
@@ -510,6 +568,11 @@ tcp_output(struct tcp_pcb *pcb)
                  ntohl(seg->tcphdr->seqno), pcb->lastack));
   }
 #endif /* TCP_CWND_DEBUG */
+#if TCP_TSO_MAX
+  netif = ip_route(&pcb->remote_ip);
+  can_tso = netif != NULL && (netif->flags & NETIF_FLAG_TSO) &&
+    !ip_addr_isany(&pcb->local_ip);
+#endif /* TCP_TSO_MAX */
   /* data available and window allows it to be sent? */
   while (seg != NULL &&
          ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len <= wnd) {
@@ -542,7 +605,28 @@ tcp_output(struct tcp_pcb *pcb)
       pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
     }
 
+#if TCP_TSO_MAX
+    /* Hold back runs of full-sized data segments and send each run as
+     * one super-segment. */
+    if (ntso > 0) {
+      last = tso[ntso - 1];
+      if (!can_tso || !tcp_tso_ok(seg) || ntso == TCP_TSO_SEGS ||
+          tsolen + seg->len > TCP_TSO_MAX || last->len != pcb->mss ||
+          ntohl(seg->tcphdr->seqno) != ntohl(last->tcphdr->seqno) + last->len) {
+        tcp_output_tso(tso, ntso, pcb);
+        ntso = 0;
+        tsolen = 0;
+      }
+    }
+    if (can_tso && tcp_tso_ok(seg)) {
+      tso[ntso++] = seg;
+      tsolen += seg->len;
+    } else {
+      tcp_output_segment(seg, pcb);
+    }
+#else /* TCP_TSO_MAX */
     tcp_output_segment(seg, pcb);
+#endif /* TCP_TSO_MAX */
     pcb->snd_nxt = ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
     if (TCP_SEQ_LT(pcb->snd_max, pcb->snd_nxt)) {
       pcb->snd_max = pcb->snd_nxt;
@@ -575,6 +659,11 @@ tcp_output(struct tcp_pcb *pcb)
     }
     seg = pcb->unsent;
   }
+#if TCP_TSO_MAX
+  if (ntso > 0) {
+    tcp_output_tso(tso, ntso, pcb);
+  }
+#endif /* TCP_TSO_MAX */
 
   if (seg != NULL && pcb->persist_backoff == 0 && 
       ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len > pcb->snd_wnd) {
@@ -587,6 +676,74 @@ tcp_output(struct tcp_pcb *pcb)
   return ERR_OK;
 }
 
+#if LWIP_SACK && TCP_QUEUE_OOSEQ
+/**
+ * Takes the next run of contiguous segments off an out-of-sequence
+ * queue as one SACK block.
+ */
+static u8_t
+tcp_sack_block(struct tcp_seg **segp, u32_t *left, u32_t *right)
+{
+  struct tcp_seg *seg = *segp;
+
+  if (seg == NULL) {
+    return 0;
+  }
+  *left = seg->tcphdr->seqno;
+  *right = *left + TCP_TCPLEN(seg);
+  for (seg = seg->next; seg != NULL && seg->tcphdr->seqno == *right;
+       seg = seg->next) {
+    *right += TCP_TCPLEN(seg);
+  }
+  *segp = seg;
+  return 1;
+}
+
+/**
+ * Called by tcp_output() to build the SACK option of an empty ACK from
+ * the out-of-sequence queue (RFC 2018): first the block holding the
+ * segment that arrived last, then the others in sequence order.
+ *
+ * @param pcb the tcp_pcb to report the out-of-sequence queue of
+ * @param opts room for the option with TCP_SACK_BLOCKS blocks
+ * @return the option length in bytes, 0 if there is nothing to report
+ */
+static u8_t
+tcp_build_sack(struct tcp_pcb *pcb, u32_t *opts)
+{
+  struct tcp_seg *seg;
+  u32_t left, right, last_left;
+  u8_t n = 0;
+
+  /* the block holding the last segment that came in */
+  for (seg = pcb->ooseq; tcp_sack_block(&seg, &left, &right);) {
+    if (TCP_SEQ_GEQ(pcb->rcv_sack, left) && TCP_SEQ_LT(pcb->rcv_sack, right)) {
+      opts[1] = htonl(left);
+      opts[2] = htonl(right);
+      n = 1;
+      break;
+    }
+  }
+  last_left = n ? left : pcb->rcv_nxt;
+
+  for (seg = pcb->ooseq;
+       n < TCP_SACK_BLOCKS && tcp_sack_block(&seg, &left, &right);) {
+    if (left != last_left) {
+      opts[1 + 2 * n] = htonl(left);
+      opts[2 + 2 * n] = htonl(right);
+      n++;
+    }
+  }
+  if (n == 0) {
+    return 0;
+  }
+  /* two NOPs keep the blocks aligned */
+  opts[0] = htonl(((u32_t)1 << 24) | ((u32_t)1 << 16) | ((u32_t)5 << 8) |
+                  (2 + 8 * n));
+  return 4 + 8 * n;
+}
+#endif /* LWIP_SACK && TCP_QUEUE_OOSEQ */
+
 /**
  * Called by tcp_output() to actually send a TCP segment over IP.
  *
@@ -606,8 +763,13 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
    wnd fields remain. */
   seg->tcphdr->ackno = htonl(pcb->rcv_nxt);
 
-  /* advertise our receive window size in this TCP segment */
-  seg->tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  /* advertise our receive window size in this TCP segment; the window
+     of a SYN is never scaled */
+  if (TCPH_FLAGS(seg->tcphdr) & TCP_SYN) {
+    seg->tcphdr->wnd = htons(TCPWND16(pcb->rcv_ann_wnd));
+  } else {
+    seg->tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
+  }
 
   /* If we don't have a local IP address, we get one by
      calling ip_route(). */
@@ -666,6 +828,101 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
 #endif /* LWIP_NETIF_HWADDRHINT*/
 }
 
+#if TCP_TSO_MAX
+/**
+ * Can seg go out as part of a super-segment? Only data segments without
+ * options and without SYN, FIN or URG qualify.
+ */
+static int
+tcp_tso_ok(struct tcp_seg *seg)
+{
+  return seg->len > 0 && TCPH_HDRLEN(seg->tcphdr) == 5 &&
+    (TCPH_FLAGS(seg->tcphdr) & (TCP_SYN | TCP_FIN | TCP_RST | TCP_URG)) == 0;
+}
+
+/**
+ * Called by tcp_output() to send consecutive segments as one large TCP
+ * segment, which the netif splits back into pcb->mss sized ones. The
+ * segments stay on the unacked queue as they are, so retransmissions
+ * still go out one segment at a time.
+ *
+ * @param segs the segments, in sequence order; all but the last are
+ *        pcb->mss long
+ * @param n number of segments
+ * @param pcb the tcp_pcb for the TCP connection used to send the segments
+ */
+static void
+tcp_output_tso(struct tcp_seg **segs, int n, struct tcp_pcb *pcb)
+{
+  struct pbuf *p, *q, *r;
+  struct tcp_hdr *tcphdr;
+  u16_t off, len, left, flags;
+  int i;
+
+  p = n > 1 ? pbuf_alloc(PBUF_IP, TCP_HLEN, PBUF_RAM) : NULL;
+  flags = 0;
+  /* reference the data of every segment; the first pbuf of each holds
+     its header, and possibly some of its data */
+  for (i = 0; p != NULL && i < n; i++) {
+    flags |= TCPH_FLAGS(segs[i]->tcphdr);
+    q = segs[i]->p;
+    off = (u16_t)((u8_t *)segs[i]->tcphdr + TCP_HLEN - (u8_t *)q->payload);
+    for (left = segs[i]->len; left > 0; q = q->next) {
+      if (off >= q->len) {
+        off -= q->len;
+        continue;
+      }
+      len = LWIP_MIN(left, q->len - off);
+      r = pbuf_alloc(PBUF_RAW, len, PBUF_REF);
+      if (r == NULL) {
+        pbuf_free(p);
+        p = NULL;
+        break;
+      }
+      r->payload = (u8_t *)q->payload + off;
+      pbuf_cat(p, r);
+      left -= len;
+      off = 0;
+    }
+  }
+  if (p == NULL) {
+    /* a lone segment, or out of pbufs */
+    for (i = 0; i < n; i++) {
+      tcp_output_segment(segs[i], pcb);
+    }
+    return;
+  }
+
+  tcphdr = p->payload;
+  SMEMCPY(tcphdr, segs[0]->tcphdr, TCP_HLEN);
+  TCPH_FLAGS_SET(tcphdr, flags);
+  tcphdr->ackno = htonl(pcb->rcv_nxt);
+  tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
+  tcphdr->chksum = 0;
+  p->flags |= PBUF_FLAG_TSO;
+  p->tso_mss = pcb->mss;
+
+  /* Set retransmission timer running if it is not currently enabled */
+  if(pcb->rtime == -1)
+    pcb->rtime = 0;
+
+  if (pcb->rttest == 0) {
+    pcb->rttest = tcp_ticks;
+    pcb->rtseq = ntohl(tcphdr->seqno);
+  }
+  LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_output_tso: %"U32_F":%"U32_F" in %d segments\n",
+          ntohl(tcphdr->seqno), ntohl(tcphdr->seqno) + p->tot_len - TCP_HLEN, n));
+  for (i = 0; i < n; i++) {
+    snmp_inc_tcpoutsegs();
+    TCP_STATS_INC(tcp.xmit);
+  }
+
+  ip_output(p, &(pcb->local_ip), &(pcb->remote_ip), pcb->ttl, pcb->tos,
+      IP_PROTO_TCP);
+  pbuf_free(p);
+}
+#endif /* TCP_TSO_MAX */
+
 /**
  * Send a TCP RESET packet (empty segment with RST flag set) either to
  * abort a connection or to show that there is no matching local connection
@@ -707,7 +964,7 @@ tcp_rst(u32_t seqno, u32_t ackno,
   tcphdr->seqno = htonl(seqno);
   tcphdr->ackno = htonl(ackno);
   TCPH_FLAGS_SET(tcphdr, TCP_RST | TCP_ACK);
-  tcphdr->wnd = htons(TCP_WND);
+  tcphdr->wnd = htons(TCPWND16(TCP_WND));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
@@ -740,6 +997,17 @@ tcp_rexmit_rto(struct tcp_pcb *pcb)
     return;
   }
 
+#if LWIP_SACK
+  /* The receiver may drop data it reported in SACK blocks (RFC 2018
+     section 8), so after a time-out we go back to sending everything */
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    seg->flags = 0;
+  }
+  pcb->flags &= ~TF_RTX_SEG;
+#endif /* LWIP_SACK */
+  /* A time-out ends fast recovery, too */
+  pcb->flags &= ~TF_INFR;
+
   /* Move all unacked segments to the head of the unsent queue */
   for (seg = pcb->unacked; seg->next != NULL; seg = seg->next);
   /* concatenate unsent queue after unacked queue */
@@ -783,6 +1051,9 @@ tcp_rexmit(struct tcp_pcb *pcb)
   pcb->unacked = seg;
 
   pcb->snd_nxt = ntohl(pcb->unsent->tcphdr->seqno);
+#if LWIP_SACK
+  pcb->rtx_high = pcb->snd_nxt + TCP_TCPLEN(pcb->unsent);
+#endif /* LWIP_SACK */
 
   ++pcb->nrtx;
 
@@ -794,6 +1065,33 @@ tcp_rexmit(struct tcp_pcb *pcb)
   tcp_output(pcb);
 }
 
+#if LWIP_SACK
+/**
+ * Retransmit a segment on the unacked queue that the receiver reported
+ * missing with SACK. Unlike tcp_rexmit(), the segment stays where it is
+ * on the queue, as segments before it may still be outstanding.
+ *
+ * Called by tcp_receive() in fast recovery.
+ *
+ * @param pcb the tcp_pcb for which to retransmit seg
+ * @param seg the segment on pcb->unacked to retransmit
+ */
+void
+tcp_rexmit_seg(struct tcp_pcb *pcb, struct tcp_seg *seg)
+{
+  seg->flags |= TF_SEG_RTX;
+  pcb->flags |= TF_RTX_SEG;
+  pcb->rtx_high = ntohl(seg->tcphdr->seqno) + TCP_TCPLEN(seg);
+
+  /* Don't take any rtt measurements after retransmitting. */
+  pcb->rttest = 0;
+
+  /* Do the actual retransmission. */
+  snmp_inc_tcpretranssegs();
+  tcp_output(pcb);
+}
+#endif /* LWIP_SACK */
+
 /**
  * Send keepalive packets to keep a connection active although
  * no data is sent over it.
@@ -831,7 +1129,7 @@ tcp_keepalive(struct tcp_pcb *pcb)
   tcphdr->seqno = htonl(pcb->snd_nxt - 1);
   tcphdr->ackno = htonl(pcb->rcv_nxt);
   TCPH_FLAGS_SET(tcphdr, 0);
-  tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
@@ -914,7 +1212,7 @@ tcp_zero_window_probe(struct tcp_pcb *pcb)
   tcphdr->seqno = seg->tcphdr->seqno;
   tcphdr->ackno = htonl(pcb->rcv_nxt);
   TCPH_FLAGS_SET(tcphdr, 0);
-  tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
@@ -194,6 +194,7 @@ err_t             netconn_write   (struct netconn *conn,
                                    const void *dataptr, int size,
                                    u8_t apiflags);
 err_t             netconn_close   (struct netconn *conn);
+err_t             netconn_close_tx(struct netconn *conn);
 
 #if LWIP_IGMP
 err_t             netconn_join_leave_group (struct netconn *conn,
@@ -662,7 +662,30 @@
  */
 #ifndef TCP_WND
 #define TCP_WND                         2048
-#endif 
+#endif
+
+/**
+ * LWIP_WND_SCALE==1: Negotiate the window scale option (RFC 1323), so
+ * that TCP_WND may be larger than 64 KB. TCP_RCV_SCALE is the shift we
+ * offer the remote side; TCP_WND must fit in 16 bits once shifted by it.
+ */
+#ifndef LWIP_WND_SCALE
+#define LWIP_WND_SCALE                  0
+#endif
+
+#ifndef TCP_RCV_SCALE
+#define TCP_RCV_SCALE                   0
+#endif
+
+/**
+ * LWIP_SACK==1: Negotiate selective acknowledgements (RFC 2018). ACKs
+ * then report the segments on the out-of-sequence queue, and in fast
+ * recovery the segments the remote side reports missing are retransmitted
+ * one per duplicate ACK (RFC 6675) instead of one per round trip.
+ */
+#ifndef LWIP_SACK
+#define LWIP_SACK                       0
+#endif
 
 /**
  * TCP_MAXRTX: Maximum number of retransmissions of data segments.
@@ -734,6 +757,29 @@
 #define TCP_SNDLOWAT                    (TCP_SND_BUF/2)
 #endif
 
+/**
+ * TCP_TSO_MAX: Largest number of data bytes tcp_output() joins into one
+ * super-segment for a netif with NETIF_FLAG_TSO set. The netif cuts it
+ * back into mss-sized segments. 0 disables this.
+ */
+#ifndef TCP_TSO_MAX
+#define TCP_TSO_MAX                     0
+#endif
+
+/**
+ * TCP_PCB_HASH_SIZE: Number of buckets (a power of two) of the hash table
+ * tcp_input() finds active and TIME-WAIT PCBs in by their addresses and
+ * ports. TCP_LISTEN_HASH_SIZE buckets hold the listening PCBs by port.
+ * With 0, tcp_input() searches the PCB lists instead.
+ */
+#ifndef TCP_PCB_HASH_SIZE
+#define TCP_PCB_HASH_SIZE               0
+#endif
+
+#ifndef TCP_LISTEN_HASH_SIZE
+#define TCP_LISTEN_HASH_SIZE            16
+#endif
+
 /**
  * TCP_LISTEN_BACKLOG: Enable the backlog option for tcp listen pcb.
  */
@@ -932,6 +978,15 @@
 #define TCPIP_MBOX_SIZE                 0
 #endif
 
+/**
+ * TCPIP_TIMERS==1: The tcpip thread runs the TCP, ARP and DHCP timers
+ * with sys_timeout(). Set it to 0 if the port calls tcp_fasttmr(),
+ * tcp_slowtmr(), etharp_tmr() and the DHCP timers itself.
+ */
+#ifndef TCPIP_TIMERS
+#define TCPIP_TIMERS                    1
+#endif
+
 /**
  * SLIPIF_THREAD_NAME: The name assigned to the slipif_loop thread.
  */
@@ -60,6 +60,12 @@ typedef enum {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** the network interface already verified the IP header checksum */
+#define PBUF_FLAG_CSUM_IP_OK 0x02U
+/** the network interface already verified the TCP or UDP checksum */
+#define PBUF_FLAG_CSUM_L4_OK 0x04U
+/** a TCP super-segment for the netif to split into tso_mss sized segments */
+#define PBUF_FLAG_TSO 0x08U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
@@ -92,7 +98,11 @@ struct pbuf {
    * the stack itself, or pbuf->next pointers from a chain.
    */
   u16_t ref;
-  
+
+#if TCP_TSO_MAX
+  /** segment size for a PBUF_FLAG_TSO packet */
+  u16_t tso_mss;
+#endif /* TCP_TSO_MAX */
 };
 
 /* Initializes the pbuf module. This call is empty for now, but may not be in future. */
@@ -133,6 +133,12 @@ struct linger {
 #define MSG_OOB        0x04    /* Unimplemented: Requests out-of-band data. The significance and semantics of out-of-band data are protocol-specific */
 #define MSG_DONTWAIT   0x08    /* Nonblocking i/o for this operation only */
 #define MSG_MORE       0x10    /* Sender will send more */
+#define MSG_NOCOPY     0x20    /* JOS: queue the data in place; it must stay put until lwIP frees it */
+
+/* Values for the how argument of shutdown() */
+#define SHUT_RD        0       /* Accepted, but data keeps arriving until close */
+#define SHUT_WR        1       /* Send a FIN; the peer's data can still be read */
+#define SHUT_RDWR      2
 
 
 /*
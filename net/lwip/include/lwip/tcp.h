@@ -132,7 +132,7 @@ void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
  * unacknowledged.
  */
 #define tcp_do_output_nagle(tpcb) ((((tpcb)->unacked == NULL) || \
-                            ((tpcb)->flags & TF_NODELAY) || \
+                            ((tpcb)->flags & (TF_NODELAY | TF_INFR)) || \
                             (((tpcb)->unsent != NULL) && ((tpcb)->unsent->next != NULL))) ? \
                                 1 : 0)
 #define tcp_output_nagle(tpcb) (tcp_do_output_nagle(tpcb) ? tcp_output(tpcb) : ERR_OK)
@@ -144,6 +144,32 @@ void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
                                 (((u32_t)TCP_MSS / 256) << 8) | \
                                 (TCP_MSS & 255))
 
+#if LWIP_WND_SCALE
+/** This returns a NOP and a window scale option of TCP_RCV_SCALE in an u32_t */
+#define TCP_BUILD_WS_OPTION()   htonl(((u32_t)1 << 24) | \
+                                ((u32_t)3 << 16) | \
+                                ((u32_t)3 << 8) | \
+                                (TCP_RCV_SCALE & 255))
+
+typedef u32_t tcpwnd_size_t;
+/* The window we put in a segment header, and the one we take from it */
+#define RCV_WND_SCALE(pcb, wnd) ((wnd) >> (pcb)->rcv_scale)
+#define SND_WND_SCALE(pcb, wnd) ((tcpwnd_size_t)(wnd) << (pcb)->snd_scale)
+#else
+typedef u16_t tcpwnd_size_t;
+#define RCV_WND_SCALE(pcb, wnd) (wnd)
+#define SND_WND_SCALE(pcb, wnd) (wnd)
+#endif /* LWIP_WND_SCALE */
+/* Windows in SYN segments are never scaled, but may not exceed 16 bits */
+#define TCPWND16(wnd)           ((u16_t)LWIP_MIN((wnd), 0xffff))
+
+#if LWIP_SACK
+/** This returns two NOPs and a SACK permitted option in an u32_t */
+#define TCP_BUILD_SACK_PERM_OPTION() htonl(((u32_t)1 << 24) | \
+                                ((u32_t)1 << 16) | \
+                                ((u32_t)4 << 8) | 2)
+#endif /* LWIP_SACK */
+
 #define TCP_SEQ_LT(a,b)     ((s32_t)((a)-(b)) < 0)
 #define TCP_SEQ_LEQ(a,b)    ((s32_t)((a)-(b)) <= 0)
 #define TCP_SEQ_GT(a,b)     ((s32_t)((a)-(b)) > 0)
@@ -263,6 +289,7 @@ enum tcp_state {
  */
 #define TCP_PCB_COMMON(type) \
   type *next; /* for the linked list */ \
+  type *hnext; /* for the hash chain (TCP_PCB_HASH_SIZE) */ \
   enum tcp_state state; /* TCP state */ \
   u8_t prio; \
   void *callback_arg; \
@@ -279,20 +306,23 @@ struct tcp_pcb {
   /* ports are in host byte order */
   u16_t remote_port;
   
-  u8_t flags;
+  u16_t flags;
 #define TF_ACK_DELAY   (u8_t)0x01U   /* Delayed ACK. */
 #define TF_ACK_NOW     (u8_t)0x02U   /* Immediate ACK. */
 #define TF_INFR        (u8_t)0x04U   /* In fast recovery. */
 #define TF_FIN         (u8_t)0x20U   /* Connection was closed locally (FIN segment enqueued). */
 #define TF_NODELAY     (u8_t)0x40U   /* Disable Nagle algorithm */
 #define TF_NAGLEMEMERR (u8_t)0x80U /* nagle enabled, memerr, try to output to prevent delayed ACK to happen */
+#define TF_WND_SCALE   (u16_t)0x0100U /* Window scale option negotiated */
+#define TF_SACK        (u16_t)0x0200U /* SACK permitted by both sides */
+#define TF_RTX_SEG     (u16_t)0x0400U /* Segments on unacked marked TF_SEG_RTX */
 
   /* the rest of the fields are in host byte order
      as we have to do some math with them */
   /* receiver variables */
   u32_t rcv_nxt;   /* next seqno expected */
-  u16_t rcv_wnd;   /* receiver window */
-  u16_t rcv_ann_wnd; /* announced receive window */
+  tcpwnd_size_t rcv_wnd;   /* receiver window */
+  tcpwnd_size_t rcv_ann_wnd; /* announced receive window */
 
   /* Timers */
   u32_t tmr;
@@ -314,15 +344,24 @@ struct tcp_pcb {
   /* fast retransmit/recovery */
   u32_t lastack; /* Highest acknowledged seqno. */
   u8_t dupacks;
+  u32_t recover; /* snd_max when fast recovery began (NewReno) */
+#if LWIP_SACK
+  u32_t rtx_high; /* End of the last segment retransmitted in recovery */
+  u32_t rcv_sack; /* Seqno of the last out-of-sequence segment received */
+#endif /* LWIP_SACK */
   
   /* congestion avoidance/control variables */
-  u16_t cwnd;  
-  u16_t ssthresh;
+  tcpwnd_size_t cwnd;
+  tcpwnd_size_t ssthresh;
 
   /* sender variables */
   u32_t snd_nxt,   /* next seqno to be sent */
     snd_max;       /* Highest seqno sent. */
-  u16_t snd_wnd;   /* sender window */
+  tcpwnd_size_t snd_wnd;   /* sender window */
+#if LWIP_WND_SCALE
+  u8_t snd_scale;  /* shift of the windows the remote side announces */
+  u8_t rcv_scale;  /* shift of the windows we announce */
+#endif /* LWIP_WND_SCALE */
   u32_t snd_wl1, snd_wl2, /* Sequence and acknowledgement numbers of last
                              window update. */
     snd_lbb;       /* Sequence number of next byte to be buffered. */
@@ -495,6 +534,11 @@ struct tcp_seg {
   void *dataptr;           /* pointer to the TCP data in the pbuf */
   u16_t len;               /* the TCP length of this segment */
   struct tcp_hdr *tcphdr;  /* the TCP header */
+#if LWIP_SACK
+  u8_t flags;
+#define TF_SEG_SACKED  (u8_t)0x01U /* Reported received in a SACK block */
+#define TF_SEG_RTX     (u8_t)0x02U /* To be retransmitted by tcp_output() */
+#endif /* LWIP_SACK */
 };
 
 /* Internal functions and global variables: */
@@ -554,7 +598,7 @@ s16_t tcp_pcbs_sane(void);
 #  define tcp_pcbs_sane() 1
 #endif /* TCP_DEBUG */
 
-#if NO_SYS
+#if NO_SYS || !TCPIP_TIMERS
 #define tcp_timer_needed()
 #else
 void tcp_timer_needed(void);
@@ -580,6 +624,25 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
    4) All PCBs in the tcp_tw_pcbs list is in TIME-WAIT state.
 */
 
+#if TCP_PCB_HASH_SIZE
+/* Active and TIME-WAIT PCBs are also hashed by their addresses and ports,
+   and listening PCBs by their port; TCP_REG and TCP_RMV keep the hash
+   tables up to date with the lists. */
+void tcp_hash_reg(struct tcp_pcb **pcbs, struct tcp_pcb *npcb);
+void tcp_hash_rmv(struct tcp_pcb **pcbs, struct tcp_pcb *npcb);
+struct tcp_pcb *tcp_hash_lookup(struct ip_addr *local_ip, u16_t local_port,
+                                struct ip_addr *remote_ip, u16_t remote_port);
+struct tcp_pcb_listen *tcp_hash_lookup_listen(struct ip_addr *local_ip,
+                                              u16_t local_port);
+#define TCP_HASH_REG(pcbs, npcb) tcp_hash_reg((struct tcp_pcb **)(pcbs), \
+                                              (struct tcp_pcb *)(npcb))
+#define TCP_HASH_RMV(pcbs, npcb) tcp_hash_rmv((struct tcp_pcb **)(pcbs), \
+                                              (struct tcp_pcb *)(npcb))
+#else /* TCP_PCB_HASH_SIZE */
+#define TCP_HASH_REG(pcbs, npcb)
+#define TCP_HASH_RMV(pcbs, npcb)
+#endif /* TCP_PCB_HASH_SIZE */
+
 /* Define two macros, TCP_REG and TCP_RMV that registers a TCP PCB
    with a PCB list or removes a PCB from a list, respectively. */
 #if 0
@@ -594,6 +657,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                             npcb->next = *pcbs; \
                             LWIP_ASSERT("TCP_REG: npcb->next != npcb", npcb->next != npcb); \
                             *(pcbs) = npcb; \
+                            TCP_HASH_REG(pcbs, npcb); \
                             LWIP_ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
               tcp_timer_needed(); \
                             } while(0)
@@ -609,6 +673,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                                } \
                             } \
                             npcb->next = NULL; \
+                            TCP_HASH_RMV(pcbs, npcb); \
                             LWIP_ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
                             LWIP_DEBUGF(TCP_DEBUG, ("TCP_RMV: removed %p from %p\n", npcb, *pcbs)); \
                             } while(0)
@@ -617,6 +682,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
 #define TCP_REG(pcbs, npcb) do { \
                             npcb->next = *pcbs; \
                             *(pcbs) = npcb; \
+                            TCP_HASH_REG(pcbs, npcb); \
               tcp_timer_needed(); \
                             } while(0)
 #define TCP_RMV(pcbs, npcb) do { \
@@ -629,6 +695,7 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                                } \
                             } \
                             npcb->next = NULL; \
+                            TCP_HASH_RMV(pcbs, npcb); \
                             } while(0)
 #endif /* LWIP_DEBUG */
 
@@ -0,0 +1,164 @@
+/*
+ * Internet checksum for x86, used as LWIP_CHKSUM (see cc.h).
+ *
+ * Sums 32 bits at a time with add-with-carry, eight words per loop
+ * iteration, instead of the 16 bits per iteration of lwIP's portable
+ * lwip_standard_chksum.  The result is the same: the non-inverted sum
+ * in host order.  Summing little-endian words gives the byte-swapped
+ * sum, which is exactly what that function returns (RFC 1071).
+ *
+ * No SSE2: the kernel does not save XMM registers across environment
+ * switches, so user code cannot use them.
+ */
+
+#include <lwip/opt.h>
+#include <arch/cc.h>
+
+#define SWAP16(w)	((((w) & 0xff) << 8) | (((w) >> 8) & 0xff))
+
+static inline uint32_t
+fold(uint32_t sum)
+{
+    sum = (sum >> 16) + (sum & 0xffff);
+    return (sum >> 16) + (sum & 0xffff);
+}
+
+#define SUM8(op0)						\
+	op0  "  0(%[s]), %[sum]\n\t"				\
+	"adcl  4(%[s]), %[sum]\n\t"				\
+	"adcl  8(%[s]), %[sum]\n\t"				\
+	"adcl 12(%[s]), %[sum]\n\t"				\
+	"adcl 16(%[s]), %[sum]\n\t"				\
+	"adcl 20(%[s]), %[sum]\n\t"				\
+	"adcl 24(%[s]), %[sum]\n\t"				\
+	"adcl 28(%[s]), %[sum]\n\t"				\
+	"adcl $0, %[sum]"
+
+// Add nwords aligned 32-bit words at s to sum, with end-around carry.
+static uint32_t
+sum_words(const uint32_t *s, int nwords, uint32_t sum)
+{
+    for (; nwords >= 8; nwords -= 8, s += 8)
+	__asm__(SUM8("addl")
+		: [sum] "+r" (sum)
+		: [s] "r" (s)
+		: "cc", "memory");
+    for (; nwords > 0; nwords--, s++)
+	__asm__("addl %[w], %[sum]\n\tadcl $0, %[sum]"
+		: [sum] "+r" (sum)
+		: [w] "rm" (*s)
+		: "cc");
+    return sum;
+}
+
+// movl leaves the carry flag alone, so copying fits between the adcls.
+#define COPY1(off, op)						\
+	"movl " #off "(%[s]), %[t]\n\t"				\
+	op " %[t], %[sum]\n\t"					\
+	"movl %[t], " #off "(%[d])\n\t"
+
+// Like sum_words, also copying the words to d.
+static uint32_t
+sum_copy_words(uint32_t *d, const uint32_t *s, int nwords, uint32_t sum)
+{
+    uint32_t t;
+
+    for (; nwords >= 8; nwords -= 8, s += 8, d += 8)
+	__asm__(COPY1(0, "addl") COPY1(4, "adcl")
+		COPY1(8, "adcl") COPY1(12, "adcl")
+		COPY1(16, "adcl") COPY1(20, "adcl")
+		COPY1(24, "adcl") COPY1(28, "adcl")
+		"adcl $0, %[sum]"
+		: [sum] "+r" (sum), [t] "=&r" (t)
+		: [s] "r" (s), [d] "r" (d)
+		: "cc", "memory");
+    for (; nwords > 0; nwords--, s++, d++) {
+	*d = *s;
+	__asm__("addl %[w], %[sum]\n\tadcl $0, %[sum]"
+		: [sum] "+r" (sum)
+		: [w] "r" (*d)
+		: "cc");
+    }
+    return sum;
+}
+
+/*
+ * Sum len bytes at src into the non-inverted Internet checksum; if dst
+ * is not null, copy them there as well.  Loads are aligned on src.
+ */
+static u16_t
+chksum(void *dst, const void *src, u16_t len)
+{
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+    uint32_t sum = 0, first = 0;
+    int odd, n;
+
+    if (len == 0)
+	return 0;
+    // An odd start shifts every later byte into the other half of its
+    // word; sum from the next byte on and swap the result.
+    odd = (uintptr_t)s & 1;
+    if (odd) {
+	first = *s;
+	if (d)
+	    *d++ = *s;
+	s++;
+	len--;
+    }
+    if (((uintptr_t)s & 2) && len >= 2) {
+	sum = *(const uint16_t *)s;
+	if (d) {
+	    *(uint16_t *)d = *(const uint16_t *)s;
+	    d += 2;
+	}
+	s += 2;
+	len -= 2;
+    }
+
+    n = len / 4;
+    if (d) {
+	sum = sum_copy_words((uint32_t *)d, (const uint32_t *)s, n, sum);
+	d += n * 4;
+    } else
+	sum = sum_words((const uint32_t *)s, n, sum);
+    s += n * 4;
+    len -= n * 4;
+
+    sum = fold(sum);
+    if (len >= 2) {
+	sum += *(const uint16_t *)s;
+	if (d) {
+	    *(uint16_t *)d = *(const uint16_t *)s;
+	    d += 2;
+	}
+	s += 2;
+	len -= 2;
+    }
+    if (len) {
+	sum += *s;
+	if (d)
+	    *d = *s;
+    }
+    sum = fold(sum);
+
+    if (odd)
+	sum = fold(SWAP16(sum) + first);
+    return sum;
+}
+
+u16_t
+jos_chksum(void *dataptr, u16_t len)
+{
+    return chksum(NULL, dataptr, len);
+}
+
+/*
+ * Copy len bytes from src to dst and return their checksum, as
+ * jos_chksum(src, len) would, in a single pass over the data.
+ */
+u16_t
+jos_chksum_copy(void *dst, const void *src, u16_t len)
+{
+    return chksum(dst, src, len);
+}
@@ -154,6 +154,10 @@ const char *sys_errlist[] = {
   [ENSRCNAMELOOP] = "ENSRCNAMELOOP" /* Domain name is too long */
 };
 
+/* errno to make lwIP happy; here rather than in ns, so that the test
+   programs linked against lwIP get it too */
+int errno;
+
 void
 perror(const char *s) {
 	int err = errno;
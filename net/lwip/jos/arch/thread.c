@@ -7,12 +7,33 @@
 static thread_id_t max_tid;
 static struct thread_context *cur_tc;
 
+// Runnable threads, other than the one running.
 static struct thread_queue thread_queue;
 static struct thread_queue kill_queue;
 
+// Threads blocked in thread_wait on an address, hashed by address.
+enum { waitq_size = 61 };
+static LIST_HEAD(wait_list, thread_context) waitq[waitq_size];
+#define WAITQ(addr)	(&waitq[((uintptr_t)(addr) >> 2) % waitq_size])
+
+// Threads blocked in thread_wait with a timeout, as a binary min-heap
+// on tc_wait_until.
+enum { timer_heap_size = 256 };
+static struct thread_context *timer_heap[timer_heap_size];
+static int ntimers;
+
+// Threads blocked in thread_wait.
+static int nblocked;
+
 void
 thread_init(void) {
+    int i;
+
     threadq_init(&thread_queue);
+    for (i = 0; i < waitq_size; i++)
+	LIST_INIT(&waitq[i]);
+    ntimers = 0;
+    nblocked = 0;
     max_tid = 0;
 }
 
@@ -21,48 +42,159 @@ thread_id(void) {
     return cur_tc->tc_tid;
 }
 
+static void
+heap_set(int i, struct thread_context *tc) {
+    timer_heap[i] = tc;
+    tc->tc_heap_idx = i;
+}
+
+// Move the thread at index i up or down to where it belongs.
+static void
+heap_fix(int i) {
+    struct thread_context *tc = timer_heap[i];
+    int c;
+
+    while (i > 0 && timer_heap[(i - 1) / 2]->tc_wait_until > tc->tc_wait_until) {
+	heap_set(i, timer_heap[(i - 1) / 2]);
+	i = (i - 1) / 2;
+    }
+    while ((c = 2 * i + 1) < ntimers) {
+	if (c + 1 < ntimers &&
+	    timer_heap[c + 1]->tc_wait_until < timer_heap[c]->tc_wait_until)
+	    c++;
+	if (timer_heap[c]->tc_wait_until >= tc->tc_wait_until)
+	    break;
+	heap_set(i, timer_heap[c]);
+	i = c;
+    }
+    heap_set(i, tc);
+}
+
+static void
+heap_insert(struct thread_context *tc) {
+    if (ntimers == timer_heap_size)
+	panic("thread_wait: too many threads waiting with a timeout");
+    heap_set(ntimers++, tc);
+    heap_fix(ntimers - 1);
+}
+
+static void
+heap_remove(struct thread_context *tc) {
+    int i = tc->tc_heap_idx;
+
+    tc->tc_heap_idx = -1;
+    if (--ntimers == i)
+	return;
+    heap_set(i, timer_heap[ntimers]);
+    heap_fix(i);
+}
+
+// Take a thread out of thread_wait and make it runnable.
+static void
+thread_ready(struct thread_context *tc) {
+    if (tc->tc_wait_addr)
+	LIST_REMOVE(tc, tc_wait_link);
+    if (tc->tc_heap_idx >= 0)
+	heap_remove(tc);
+    tc->tc_wait_addr = 0;
+    nblocked--;
+    threadq_push(&thread_queue, tc);
+}
+
+// Make the threads whose thread_wait timed out runnable.
+static void
+timers_expire(void) {
+    uint32_t now;
+
+    if (ntimers == 0)
+	return;
+    now = sys_time_msec();
+    while (ntimers > 0 && timer_heap[0]->tc_wait_until <= now)
+	thread_ready(timer_heap[0]);
+}
+
+// Pick the next thread to run.  While every thread is blocked, only a
+// timeout can make one runnable again, so wait for that.  Returns 0 if
+// there are no other threads at all.
+static struct thread_context *
+thread_next(void) {
+    struct thread_context *tc;
+
+    for (;;) {
+	timers_expire();
+	if ((tc = threadq_pop(&thread_queue)) || nblocked == 0)
+	    return tc;
+	if (ntimers > 0)
+	    sys_sleep_until(timer_heap[0]->tc_wait_until);
+	else
+	    sys_yield();
+    }
+}
+
+// Switch from the current thread, which is blocked, halted or already
+// queued, to the next one.
+static void
+thread_switch(void) {
+    struct thread_context *next_tc = thread_next();
+
+    if (!next_tc || next_tc == cur_tc)
+	return;
+    if (cur_tc && jos_setjmp(&cur_tc->tc_jb) != 0)
+	return;
+    cur_tc = next_tc;
+    jos_longjmp(&cur_tc->tc_jb, 1);
+}
+
 void
 thread_wakeup(volatile uint32_t *addr) {
-    struct thread_context *tc = thread_queue.tq_first;
-    while (tc) {
+    struct thread_context *tc, *next;
+
+    for (tc = LIST_FIRST(WAITQ(addr)); tc; tc = next) {
+	next = LIST_NEXT(tc, tc_wait_link);
 	if (tc->tc_wait_addr == addr)
-	    tc->tc_wakeup = 1;
-	tc = tc->tc_queue_link;
+	    thread_ready(tc);
     }
 }
 
+// Block until thread_wakeup(addr) or until sys_time_msec() reaches msec,
+// unless *addr != val already.  A null addr just sleeps; an msec of ~0
+// never times out.
 void
 thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
-    uint32_t s = sys_time_msec();
-    uint32_t p = s;
+    if (addr && *addr != val)
+	return;
+    if (msec != (uint32_t)~0 && msec <= sys_time_msec())
+	return;
 
     cur_tc->tc_wait_addr = addr;
-    cur_tc->tc_wakeup = 0;
-
-    while (p < msec) {
-	if (p < s)
-	    break;
-	if (addr && *addr != val)
-	    break;
-	if (cur_tc->tc_wakeup)
-	    break;
-
-	thread_yield();
-	p = sys_time_msec();
+    if (addr)
+	LIST_INSERT_HEAD(WAITQ(addr), cur_tc, tc_wait_link);
+    if (msec != (uint32_t)~0) {
+	cur_tc->tc_wait_until = msec;
+	heap_insert(cur_tc);
     }
+    nblocked++;
+    thread_switch();
+}
 
-    cur_tc->tc_wait_addr = 0;
-    cur_tc->tc_wakeup = 0;
+// The earliest thread_wait timeout, or ~0 if no thread has one.  Threads
+// whose timeout has passed are made runnable first, so the deadline
+// returned is always in the future.
+uint32_t
+thread_next_timeout(void)
+{
+    timers_expire();
+    return ntimers > 0 ? timer_heap[0]->tc_wait_until : ~0;
 }
 
+// Number of runnable threads waiting for their turn.
 int
 thread_wakeups_pending(void)
 {
     struct thread_context *tc = thread_queue.tq_first;
     int n = 0;
     while (tc) {
-	if (tc->tc_wakeup)
-	    ++n;
+	++n;
 	tc = tc->tc_queue_link;
     }
     return n;
@@ -106,6 +238,7 @@ thread_create(thread_id_t *tid, const char *name,
 	return -E_NO_MEM;
 
     memset(tc, 0, sizeof(struct thread_context));
+    tc->tc_heap_idx = -1;
     
     thread_set_name(tc, name);
     tc->tc_tid = alloc_tid();
@@ -153,27 +286,19 @@ thread_halt() {
 
     threadq_push(&kill_queue, cur_tc);
     cur_tc = NULL;
-    thread_yield();
-    // WHAT IF THERE ARE NO MORE THREADS? HOW DO WE STOP?
-    // when yield has no thread to run, it will return here!
+    thread_switch();
+    // thread_switch returns only when no thread is left at all
     exit();
 }
 
 void
 thread_yield(void) {
-    struct thread_context *next_tc = threadq_pop(&thread_queue);
-
-    if (!next_tc)
+    timers_expire();
+    if (!thread_queue.tq_first)
 	return;
-
-    if (cur_tc) {
-	if (jos_setjmp(&cur_tc->tc_jb) != 0)
-	    return;
+    if (cur_tc)
 	threadq_push(&thread_queue, cur_tc);
-    }
-
-    cur_tc = next_tc;
-    jos_longjmp(&cur_tc->tc_jb, 1);
+    thread_switch();
 }
 
 static void
@@ -3,6 +3,7 @@
 
 #include <arch/thread.h>
 #include <arch/setjmp.h>
+#include <arch/queue.h>
 
 #define THREAD_NUM_ONHALT 4
 enum { name_size = 32 };
@@ -23,8 +24,10 @@ struct thread_context {
     void		(*tc_entry)(uint32_t);
     uint32_t		tc_arg;
     struct jos_jmp_buf	tc_jb;
-    volatile uint32_t	*tc_wait_addr;
-    volatile char	tc_wakeup;
+    volatile uint32_t	*tc_wait_addr;	// thread_wait address, or 0
+    uint32_t		tc_wait_until;	// thread_wait timeout
+    int			tc_heap_idx;	// index in the timer heap, or -1
+    LIST_ENTRY(thread_context) tc_wait_link;
     void		(*tc_onhalt[THREAD_NUM_ONHALT])(thread_id_t);
     int			tc_nonhalt;
     struct thread_context *tc_queue_link;
@@ -43,9 +43,25 @@
 #include <lwip/stats.h>
 
 #include <netif/etharp.h>
+#include <lwip/ip.h>
 
 #define PKTMAP		0x10000000
 
+// Received pages are kept here while lwIP holds pbufs that point at them.
+#define RXMAP		(PKTMAP + PGSIZE)
+#define RXPAGES		256
+// Marks a PBUF_REF whose payload is one of our received pages.
+#define PBUF_FLAG_JIF_RX	0x80U
+// Frames longer than a page are built here.
+#define TXMAP		(RXMAP + RXPAGES * PGSIZE)
+// Received frames we cannot keep are copied out of a page mapped here.
+#define RXTMP		(TXMAP + JIF_TX_PAGES * PGSIZE)
+
+static bool rxbusy[RXPAGES];
+// Pages in rxbusy, the most there have been, and frames we copied
+// because there were none left.
+static int rxused, rxmax, rxcopied;
+
 struct jif {
     struct eth_addr *ethaddr;
     envid_t envid;
@@ -58,7 +74,7 @@ low_level_init(struct netif *netif)
 
     netif->hwaddr_len = 6;
     netif->mtu = 1500;
-    netif->flags = NETIF_FLAG_BROADCAST;
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_TSO;
 
     // MAC address is hardcoded to eliminate a system call
     netif->hwaddr[0] = 0x52;
@@ -80,14 +96,34 @@ low_level_init(struct netif *netif)
 static err_t
 low_level_output(struct netif *netif, struct pbuf *p)
 {
-    int r = sys_page_alloc(0, (void *)PKTMAP, PTE_U|PTE_W|PTE_P);
-    if (r < 0)
-	panic("jif: could not allocate page of memory");
-    struct jif_pkt *pkt = (struct jif_pkt *)PKTMAP;
-
     struct jif *jif;
+    struct jif_ring *tx = &JIF_RINGS->tx;
     jif = netif->state;
 
+    /* Ring full: the output env is behind, waiting for the NIC.  Wait
+       for it without yielding to other threads, which could re-enter
+       lwIP in the middle of this output call. */
+    while (tx->jr_prod - tx->jr_cons == JIF_RING_SLOTS)
+	sys_yield();
+
+    /* A TSO super-segment fills several pages of the slot. */
+    int tso = p->flags & PBUF_FLAG_TSO;
+    int npages = tso ?
+	ROUNDUP(sizeof(struct jif_pkt) + p->tot_len, PGSIZE) / PGSIZE : 1;
+    if (npages > JIF_TX_PAGES)
+	panic("jif: oversized TSO frame, %d bytes", p->tot_len);
+    char *area = (char *)(npages > 1 ? TXMAP : PKTMAP);
+    char *dst = (char *)JIF_TXSLOT(tx->jr_prod);
+    int i, r;
+    for (i = 0; i < npages; i++) {
+	r = sys_page_alloc(0, area + i * PGSIZE, PTE_U|PTE_W|PTE_P);
+	if (r < 0)
+	    panic("jif: could not allocate page of memory");
+    }
+    struct jif_pkt *pkt = (struct jif_pkt *)area;
+
+    /* This is the only copy a packet sees on its way out: the kernel
+       hands the page to the NIC as it is. */
     char *txbuf = pkt->jp_data;
     int txsize = 0;
     struct pbuf *q;
@@ -96,20 +132,142 @@ low_level_output(struct netif *netif, struct pbuf *p)
 	   time. The size of the data in each pbuf is kept in the ->len
 	   variable. */
 
-	if (txsize + q->len > 2000)
+	if (txsize + q->len > (tso ? npages * PGSIZE - sizeof(*pkt) : 2000))
 	    panic("oversized packet, fragment %d txsize %d\n", q->len, txsize);
 	memcpy(&txbuf[txsize], q->payload, q->len);
 	txsize += q->len;
     }
 
     pkt->jp_len = txsize;
-
-    ipc_send(jif->envid, NSREQ_OUTPUT, (void *)pkt, PTE_P|PTE_W|PTE_U);
-    sys_page_unmap(0, (void *)pkt);
+    /* lwIP leaves the checksums to the NIC (see lwipopts.h). */
+    pkt->jp_flags = NIC_CSUM_OFFLOAD;
+    if (tso)
+	pkt->jp_flags |= NIC_TSO_FLAGS(p->tso_mss);
+
+    /* Our mappings are left for the next sys_page_alloc to replace. */
+    for (i = 0; i < npages; i++)
+	if ((r = sys_page_map(0, area + i * PGSIZE, jif->envid,
+			      dst + i * PGSIZE, PTE_P|PTE_W|PTE_U)) < 0)
+	    panic("jif: could not map frame page for output: %e", r);
+    tx->jr_prod++;
+    jifring_notify(&tx->jr_cwait, jif->envid, NSREQ_OUTPUT);
+    LINK_STATS_INC(link.xmit);
 
     return ERR_OK;
 }
 
+/*
+ * low_level_input_ref():
+ *
+ * Maps the page holding the incoming packet at a free RXMAP slot and
+ * returns a PBUF_REF pointing at the packet in place.
+ *
+ */
+static struct pbuf *
+low_level_input_ref(envid_t envid, void *va, int *flags)
+{
+    struct jif_pkt *pkt;
+    struct pbuf *p;
+    int i;
+
+    for (i = 0; i < RXPAGES; i++)
+	if (!rxbusy[i])
+	    break;
+    if (i == RXPAGES) {
+	rxcopied++;
+	return 0;
+    }
+
+    pkt = (struct jif_pkt *)(RXMAP + i * PGSIZE);
+    if (sys_page_map(envid, va, 0, pkt, PTE_P|PTE_U|PTE_W) < 0)
+	return 0;
+    *flags = pkt->jp_flags;
+    p = pbuf_alloc(PBUF_RAW, pkt->jp_len, PBUF_REF);
+    if (p == 0) {
+	sys_page_unmap(0, pkt);
+	return 0;
+    }
+    p->payload = pkt->jp_data;
+    p->flags |= PBUF_FLAG_JIF_RX;
+    rxbusy[i] = 1;
+    if (++rxused > rxmax)
+	rxmax = rxused;
+    return p;
+}
+
+/*
+ * Called by pbuf_free() for every PBUF_REF it releases.
+ */
+void
+jif_free_ref(struct pbuf *p)
+{
+    int i;
+
+    if (!(p->flags & PBUF_FLAG_JIF_RX))
+	return;
+    i = ((uint32_t)p->payload - RXMAP) / PGSIZE;
+    sys_page_unmap(0, (void *)(RXMAP + i * PGSIZE));
+    rxbusy[i] = 0;
+    rxused--;
+}
+
+/*
+ * Reports the use of the received pages we keep.
+ */
+void
+jif_stats(struct ns_mem_stats *ms)
+{
+    strcpy(ms->ms_name, "JIF_RX");
+    ms->ms_avail = RXPAGES;
+    ms->ms_used = rxused;
+    ms->ms_max = rxmax;
+    ms->ms_err = rxcopied;
+}
+
+/*
+ * How far the payload of a PBUF_REF may be moved back: to the start of
+ * the page for ours (the jif_pkt header is no longer needed), not at all
+ * for anyone else's.
+ */
+uint16_t
+jif_ref_headroom(struct pbuf *p)
+{
+    if (!(p->flags & PBUF_FLAG_JIF_RX))
+	return 0;
+    return PGOFF(p->payload);
+}
+
+/*
+ * Copies the len byte frame at src into the pbuf chain p and returns the
+ * checksum (as LWIP_CHKSUM) of bytes [from, to) of it, summed on the way.
+ */
+static u16_t
+jif_copy_sum(struct pbuf *p, const char *src, int len, int from, int to)
+{
+    struct pbuf *q;
+    u32_t acc = 0;
+    u16_t sum;
+    int pos = 0, n, a, b;
+
+    for (q = p; q != NULL && pos < len; q = q->next) {
+	n = LWIP_MIN(q->len, len - pos);
+	/* [pos, a) and [b, pos + n) are copied, [a, b) summed as well */
+	a = LWIP_MIN(LWIP_MAX(from, pos), pos + n);
+	b = LWIP_MAX(LWIP_MIN(to, pos + n), a);
+	memcpy(q->payload, src + pos, a - pos);
+	sum = jos_chksum_copy((char *)q->payload + (a - pos), src + a, b - a);
+	/* a piece starting at an odd offset has its bytes swapped */
+	if ((a - from) & 1)
+	    sum = (sum << 8) | (sum >> 8);
+	acc += sum;
+	memcpy((char *)q->payload + (b - pos), src + b, pos + n - b);
+	pos += n;
+    }
+    acc = (acc >> 16) + (acc & 0xffff);
+    acc = (acc >> 16) + (acc & 0xffff);
+    return acc;
+}
+
 /*
  * low_level_input():
  *
@@ -118,29 +276,52 @@ low_level_output(struct netif *netif, struct pbuf *p)
  *
  */
 static struct pbuf *
-low_level_input(void *va)
+low_level_input(envid_t envid, void *va, int *flags)
 {
-    struct jif_pkt *pkt = (struct jif_pkt *)va;
+    /* Keep the page the frame arrived in, if there is room to. */
+    struct pbuf *p = low_level_input_ref(envid, va, flags);
+    if (p)
+	return p;
+
+    if (sys_page_map(envid, va, 0, (void *)RXTMP, PTE_P|PTE_U) < 0)
+	return 0;
+    struct jif_pkt *pkt = (struct jif_pkt *)RXTMP;
     s16_t len = pkt->jp_len;
+    *flags = pkt->jp_flags;
 
-    struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
+    p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
     if (p == 0)
 	return 0;
 
-    /* We iterate over the pbuf chain until we have read the entire
-     * packet into the pbuf. */
-    void *rxbuf = (void *) pkt->jp_data;
-    int copied = 0;
-    struct pbuf *q;
-    for (q = p; q != NULL; q = q->next) {
-	/* Read enough bytes to fill this pbuf in the chain. The
-	 * available data in the pbuf is given by the q->len
-	 * variable. */
-	int bytes = q->len;
-	if (bytes > (len - copied))
-	    bytes = len - copied;
-	memcpy(q->payload, rxbuf + copied, bytes);
-	copied += bytes;
+    /* Copy the packet into the pbuf chain.  If the NIC has not
+     * checked the TCP or UDP checksum of an IPv4 packet, sum that part
+     * during the copy, so it need not be read again to check it. */
+    const char *rxbuf = pkt->jp_data;
+    struct eth_hdr *ethhdr = (struct eth_hdr *)rxbuf;
+    struct ip_hdr *iphdr = (struct ip_hdr *)(rxbuf + sizeof(struct eth_hdr));
+    const int ethlen = sizeof(struct eth_hdr);
+    int from = 0, to = 0;
+    u8_t proto = 0;
+    if (!(pkt->jp_flags & NIC_CSUM_L4_OK) && len >= ethlen + IP_HLEN &&
+	ethhdr->type == htons(ETHTYPE_IP) && IPH_V(iphdr) == 4 &&
+	(IPH_OFFSET(iphdr) & htons(IP_OFFMASK | IP_MF)) == 0) {
+	proto = IPH_PROTO(iphdr);
+	from = ethlen + IPH_HL(iphdr) * 4;
+	to = ethlen + ntohs(IPH_LEN(iphdr));
+	if ((proto != IP_PROTO_TCP && proto != IP_PROTO_UDP) ||
+	    from > to || to > len)
+	    from = to = 0;
+    }
+    u32_t acc = jif_copy_sum(p, rxbuf, len, from, to);
+    if (from < to) {
+	/* add the pseudo header */
+	acc += (iphdr->src.addr & 0xffff) + (iphdr->src.addr >> 16);
+	acc += (iphdr->dest.addr & 0xffff) + (iphdr->dest.addr >> 16);
+	acc += htons(proto) + htons(to - from);
+	acc = (acc >> 16) + (acc & 0xffff);
+	acc = (acc >> 16) + (acc & 0xffff);
+	if (acc == 0xffff)
+	    p->flags |= PBUF_FLAG_CSUM_L4_OK;
     }
 
     return p;
@@ -168,24 +349,36 @@ jif_output(struct netif *netif, struct pbuf *p,
  * This function should be called when a packet is ready to be read
  * from the interface. It uses the function low_level_input() that
  * should handle the actual reception of bytes from the network
- * interface.
+ * interface.  The packet is in the page at va in environment envid,
+ * a slot of the RX ring in the input environment.
  *
  */
 
 void
-jif_input(struct netif *netif, void *va)
+jif_input(struct netif *netif, envid_t envid, void *va)
 {
     struct jif *jif;
     struct eth_hdr *ethhdr;
     struct pbuf *p;
+    int csum = 0;
 
     jif = netif->state;
   
     /* move received packet into a new pbuf */
-    p = low_level_input(va);
+    p = low_level_input(envid, va, &csum);
 
     /* no packet could be read, silently ignore this */
-    if (p == NULL) return;
+    if (p == NULL) {
+	LINK_STATS_INC(link.memerr);
+	LINK_STATS_INC(link.drop);
+	return;
+    }
+    LINK_STATS_INC(link.recv);
+    /* pass on the checksums the NIC has already verified */
+    if (csum & NIC_CSUM_IP_OK)
+	p->flags |= PBUF_FLAG_CSUM_IP_OK;
+    if (csum & NIC_CSUM_L4_OK)
+	p->flags |= PBUF_FLAG_CSUM_L4_OK;
     /* points to packet payload, which starts with an Ethernet header */
     ethhdr = p->payload;
 
@@ -205,6 +398,8 @@ jif_input(struct netif *netif, void *va)
 	break;
 
     default:
+	LINK_STATS_INC(link.proterr);
+	LINK_STATS_INC(link.drop);
 	pbuf_free(p);
     }
 }
@@ -1,4 +1,8 @@
+#include <inc/env.h>
 #include <lwip/netif.h>
 
-void	jif_input(struct netif *netif, void *va);
+struct ns_mem_stats;
+
+void	jif_input(struct netif *netif, envid_t envid, void *va);
 err_t	jif_init(struct netif *netif);
+void	jif_stats(struct ns_mem_stats *ms);
@@ -10,7 +10,10 @@ void *memcpy(void *dst, const void *src, size_t n);
 
 //#define NO_SYS 1
 
-#define LWIP_STATS		0
+// Counters for every protocol and pool; ns hands them out on
+// NSREQ_STATS (net/stats.c) and user/netstat prints them.
+#define LWIP_STATS		1
+#define LWIP_STATS_LARGE	1
 #define LWIP_STATS_DISPLAY	0
 #define LWIP_DHCP		1
 #define LWIP_COMPAT_SOCKETS	0
@@ -22,27 +25,85 @@ void *memcpy(void *dst, const void *src, size_t n);
 
 #define MEM_ALIGNMENT		4
 
-#define MEMP_NUM_PBUF		64
+// PBUF_REFs: received frames in place (one per page jif keeps, see
+// RXPAGES in jif.c), and sendfile data (two per queued segment).
+#define MEMP_NUM_PBUF		(256 + 2 * MEMP_NUM_TCP_SEG)
 #define MEMP_NUM_UDP_PCB	8
-#define MEMP_NUM_TCP_PCB	32
+// Closed connections linger in TIME-WAIT for 2 * TCP_MSL, so a busy
+// httpd keeps many more PCBs than it has sockets; tcp_input finds them
+// through a hash table rather than by walking the lists.
+#define MEMP_NUM_TCP_PCB	256
+#define TCP_PCB_HASH_SIZE	256
 #define MEMP_NUM_TCP_PCB_LISTEN	16
-#define MEMP_NUM_TCP_SEG	TCP_SND_QUEUELEN// at least as big as TCP_SND_QUEUELEN
+// Segments are shared by all connections, queued for sending or held
+// out of order; one full send queue is not enough for a busy httpd.
+#define MEMP_NUM_TCP_SEG	(4 * TCP_SND_QUEUELEN)
 #define MEMP_NUM_NETBUF		128
 #define MEMP_NUM_NETCONN	32
+// serve() runs the TCP, ARP and DHCP timers from its timer wheel
+// (net/timer.c); the tcpip thread must not run them a second time.
+#define TCPIP_TIMERS		0
 #define MEMP_NUM_SYS_TIMEOUT    6
 
-#define PER_TCP_PCB_BUFFER	(16 * 4096)
-#define MEM_SIZE		(PER_TCP_PCB_BUFFER*MEMP_NUM_TCP_SEG + 4096*MEMP_NUM_TCP_SEG)
+// mem_malloc (PBUF_RAM pbufs: headers, and the copied data of queued
+// segments) takes an element of the smallest size class that fits from
+// the pools in lwippools.h, instead of searching a first-fit heap.  What
+// no pool can provide comes from whole pages through malloc().
+#define MEM_USE_POOLS		1
+#define MEMP_USE_CUSTOM_POOLS	1
+void *malloc(size_t size);
+void free(void *addr);
+#define MEM_POOL_OVERFLOW_ALLOC(size)	malloc(size)
+#define MEM_POOL_OVERFLOW_FREE(p)	free(p)
+// The largest mem_malloc; above 64000 it makes mem_size_t 32 bits.
+#define MEM_SIZE		(1024 * 1024)
 
 #define PBUF_POOL_SIZE		512
 #define PBUF_POOL_BUFSIZE	2000
 
+// Received frames are passed up in the page the NIC wrote them to;
+// jif unmaps the page when lwIP frees the PBUF_REF pointing at it, and
+// lets lwIP move the payload back over headers it has stripped.
+struct pbuf;
+void jif_free_ref(struct pbuf *p);
+uint16_t jif_ref_headroom(struct pbuf *p);
+#define LWIP_PBUF_REF_HEADROOM(p)	jif_ref_headroom(p)
+
+// Pages sendfile lends ns are queued on connections without a copy; ns
+// keeps each page mapped while a PBUF_REF points into it (net/sendfile.c).
+void ns_pin_ref(struct pbuf *p);
+void ns_unpin_ref(struct pbuf *p);
+#define LWIP_PBUF_REF_PIN(p)	ns_pin_ref(p)
+
+#define LWIP_PBUF_REF_FREE(p)	do { jif_free_ref(p); ns_unpin_ref(p); } while (0)
+
+// ns pushes socket readiness changes to epoll rings (net/epoll.c).
+void ns_socket_event(int s, int evt);
+#define LWIP_SOCKET_EVENT_HOOK(s, evt)	ns_socket_event(s, evt)
+
+// The e1000 fills in outgoing IP, TCP and UDP checksums (jif asks for
+// it on every frame) and reports which incoming ones it verified.
+#define CHECKSUM_GEN_IP		0
+#define CHECKSUM_GEN_UDP	0
+#define CHECKSUM_GEN_TCP	0
+
 #define TCP_MSS			1460
-#define TCP_WND			24000
-#define TCP_SND_BUF		(16 * TCP_MSS)
+// A window over 64 KB keeps a fast sender going while we are slow to
+// read; it takes the window scale option (RFC 1323) to announce it.
+#define LWIP_WND_SCALE		1
+#define TCP_RCV_SCALE		2
+#define TCP_WND			(64 * TCP_MSS)
+// snd_buf is 16 bits, so the send buffer must stay under 64 KB.
+#define TCP_SND_BUF		(32 * TCP_MSS)
+// With a window this large a lost segment or two costs a lot unless the
+// peer can tell us exactly which ones are missing.
+#define LWIP_SACK		1
 // lwip prints a warning if TCP_SND_QUEUELEN < (2 * TCP_SND_BUF/TCP_MSS), 
 // but 16 is faster.. 
 #define TCP_SND_QUEUELEN	(2 * TCP_SND_BUF/TCP_MSS)
+// Send runs of segments as one frame and let the e1000 cut it up again
+// (TCP segmentation offload); a frame must stay under 64 KB.
+#define TCP_TSO_MAX		(16 * TCP_MSS)
 //#define TCP_SND_QUEUELEN	16
 
 // Print error messages when we run out of memory
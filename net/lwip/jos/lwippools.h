@@ -0,0 +1,11 @@
+// Size classes of mem_malloc (see MEM_USE_POOLS in lwipopts.h).  Sizes
+// include the 8-byte header mem_malloc puts in front of each element.
+
+LWIP_MALLOC_MEMPOOL_START
+// Pure ACKs and other header-only segments, ARP and DHCP packets
+LWIP_MALLOC_MEMPOOL(512, 128)
+// Small writes, UDP datagrams
+LWIP_MALLOC_MEMPOOL(128, 512)
+// One full segment: a pbuf, link, IP and TCP headers and TCP_MSS bytes
+LWIP_MALLOC_MEMPOOL(MEMP_NUM_TCP_SEG + 64, 1600)
+LWIP_MALLOC_MEMPOOL_END
@@ -957,6 +957,13 @@ etharp_query(struct netif *netif, struct ip_addr *ipaddr, struct pbuf *q)
             pbuf_free(p);
             p = NULL;
           }
+#if TCP_TSO_MAX
+          /* the copy must still be split by the netif */
+          if (p != NULL && (q->flags & PBUF_FLAG_TSO)) {
+            p->flags |= PBUF_FLAG_TSO;
+            p->tso_mss = q->tso_mss;
+          }
+#endif /* TCP_TSO_MAX */
         }
       } else {
         /* referencing the old pbuf is enough */
@@ -5,14 +5,39 @@
 #define MASK "255.255.255.0"
 #define DEFAULT "10.0.2.2"
 
-#define TIMER_INTERVAL 250
-
 // Virtual address at which to receive page mappings containing client requests.
+// Each request has room for its page and the pages a bulk request lends.
 #define QUEUE_SIZE	20
-#define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
+#define REQ_PAGES	(1 + NSIPC_BULK_PAGES)
+#define REQVA		(0x0ffff000 - QUEUE_SIZE * REQ_PAGES * PGSIZE)
 
 /* timer.c */
-void timer(envid_t ns_envid, uint32_t initial_to);
+struct ns_timer {
+	void (*nt_func)(void);
+	uint32_t nt_interval;		// Period, in ticks
+	uint32_t nt_expires;		// Tick at which to fire next
+	struct ns_timer *nt_next;	// Next timer in the same wheel slot
+};
+
+void timer_init(uint32_t now);
+void timer_start(struct ns_timer *t, void (*func)(void), uint32_t msec);
+void timer_run(uint32_t now);
+uint32_t timer_next(void);
+
+/* epoll.c */
+int ns_epoll_create(envid_t env, void *va);
+int ns_epoll_ctl(envid_t env, int epid, int op, int s, uint32_t events,
+		 uint32_t data);
+int ns_epoll_wait(envid_t env, int epid, int timeout);
+int ns_epoll_close(envid_t env, int epid);
+void ns_epoll_socket_closed(int s);
+
+/* sendfile.c */
+int ns_sendfile(int s, const void *buf, int len, unsigned int flags);
+void ns_pin_stats(struct ns_mem_stats *ms);
+
+/* stats.c */
+int ns_stats(struct Nsret_stats *ret);
 
 /* input.c */
 void input(envid_t ns_envid);
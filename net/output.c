@@ -1,7 +1,5 @@
 #include "ns.h"
 
-extern union Nsipc nsipcbuf;
-
 void
 output(envid_t ns_envid)
 {
@@ -9,20 +7,36 @@ output(envid_t ns_envid)
 
 	// 	- read a packet from the network server
 	//	- send the packet to the device driver
+    //ns maps each frame into the next TX ring slot, see inc/ns.h, and
+    //everything it has queued goes to the NIC in one system call
+    struct jif_ring* tx = &JIF_RINGS->tx;
+    struct nic_pkt pkts[NIC_BATCH_MAX];
     while(1){
-        envid_t from_envid;
-        int32_t result = ipc_recv(&from_envid, &nsipcbuf, 0);
-        if(result < 0)
-            return;
-        if(from_envid != ns_envid)
-            return;
-        //now receive a packet
-        switch(result){
-            case NSREQ_OUTPUT:
-                int r = sys_nic_transmit(nsipcbuf.pkt.jp_data, nsipcbuf.pkt.jp_len);
-                while(r)
-                    r = sys_nic_transmit(nsipcbuf.pkt.jp_data, nsipcbuf.pkt.jp_len);
-                break;
+        uint32_t cons = tx->jr_cons;
+        uint32_t prod = tx->jr_prod;
+        if(cons == prod){
+            jifring_wait(&tx->jr_cwait, &tx->jr_prod, prod);
+            continue;
+        }
+        int n = MIN((int)(prod - cons), NIC_BATCH_MAX);
+        for(int i = 0;i < n;i++){
+            struct jif_pkt* pkt = (struct jif_pkt*)JIF_TXSLOT(cons + i);
+            pkts[i].np_data = pkt->jp_data;
+            pkts[i].np_len = pkt->jp_len;
+            pkts[i].np_flags = pkt->jp_flags;
+        }
+        int r = sys_nic_transmit_batch(pkts, n);
+        if(r == -E_NIC_BUSY){
+            //NIC ring full: sleep until it has sent something
+            sys_nic_wait_tx();
+            continue;
+        }
+        if(r < 0){
+            cprintf("ns_output: dropped %d byte packet: %e\n", pkts[0].np_len, r);
+            r = 1;
         }
+        //the NIC holds its own references to the pages, so ns may
+        //replace them in these slots now
+        tx->jr_cons = cons + r;
     }
 }
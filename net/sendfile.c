@@ -0,0 +1,148 @@
+/*
+ * Sendfile in the network server.
+ *
+ * NSREQ_SENDFILE lends us file pages that nothing will write: the file
+ * server writes later changes to the file to fresh pages.  Rather
+ * than copy them into lwIP, we map them into the pin window and queue
+ * them on the connection in place (MSG_NOCOPY).  tcp_enqueue calls
+ * ns_pin_ref for each PBUF_REF it points into the window and pbuf_free
+ * calls ns_unpin_ref, so a page stays mapped while any pbuf refers to
+ * it: until its data is acknowledged, or the connection is gone.  lwIP
+ * never moves the payload of these pbufs, so the pages a pbuf covers
+ * when it is freed are the ones it covered when it was made.
+ */
+
+#include <lwip/pbuf.h>
+#include <lwip/sockets.h>
+
+#include "ns.h"
+
+#define PINVA		0x10800000
+#define NPIN		512
+// Marks a PBUF_REF whose payload is in the pin window.
+#define PBUF_FLAG_NS_PIN	0x40U
+
+// Number of holds on each page of the window, 0 if it is free.
+static int pincount[NPIN];
+// Where the next search for free pages starts.
+static int pinnext;
+// Pages in use, the most there have been, and sends we copied because
+// the window was full.
+static int pinused, pinmax, pinfull;
+
+// Find npages free pages in a row in the window.
+static int
+pin_alloc(int npages)
+{
+	int i, j, s;
+
+	for (i = 0; i < NPIN; i++) {
+		s = (pinnext + i) % NPIN;
+		if (s + npages > NPIN)
+			continue;
+		for (j = 0; j < npages && pincount[s + j] == 0; j++)
+			;
+		if (j == npages) {
+			pinnext = (s + npages) % NPIN;
+			return s;
+		}
+	}
+	return -1;
+}
+
+static void
+unpin(int i)
+{
+	if (--pincount[i] == 0) {
+		sys_page_unmap(0, (void *) (PINVA + i * PGSIZE));
+		pinused--;
+	}
+}
+
+// Add delta holds to every window page the payload of p covers.
+static void
+pin_payload(struct pbuf *p, int delta)
+{
+	int i, first, last;
+
+	first = ((uintptr_t) p->payload - PINVA) / PGSIZE;
+	last = ((uintptr_t) p->payload + p->len - 1 - PINVA) / PGSIZE;
+	for (i = first; i <= last; i++)
+		if (delta > 0)
+			pincount[i]++;
+		else
+			unpin(i);
+}
+
+// Called by tcp_enqueue for every PBUF_REF it makes to queue data in
+// place.
+void
+ns_pin_ref(struct pbuf *p)
+{
+	if ((uintptr_t) p->payload < PINVA
+	    || (uintptr_t) p->payload + p->len > PINVA + NPIN * PGSIZE
+	    || p->len == 0)
+		return;
+	p->flags |= PBUF_FLAG_NS_PIN;
+	pin_payload(p, 1);
+}
+
+// Called by pbuf_free() for every PBUF_REF it releases.
+void
+ns_unpin_ref(struct pbuf *p)
+{
+	if (p->flags & PBUF_FLAG_NS_PIN)
+		pin_payload(p, -1);
+}
+
+// Send the len bytes at buf on socket s without copying them.  The
+// pages under buf must stay unwritten.  If the window is full we copy
+// after all.
+int
+ns_sendfile(int s, const void *buf, int len, unsigned int flags)
+{
+	uintptr_t va = ROUNDDOWN((uintptr_t) buf, PGSIZE);
+	int npages = (ROUNDUP((uintptr_t) buf + len, PGSIZE) - va) / PGSIZE;
+	char *pin;
+	int i, slot, r;
+
+	if (len <= 0)
+		return lwip_send(s, buf, len, flags);
+	if ((slot = pin_alloc(npages)) < 0) {
+		pinfull++;
+		return lwip_send(s, buf, len, flags);
+	}
+
+	pin = (char *) (PINVA + slot * PGSIZE);
+	for (i = 0; i < npages; i++) {
+		if ((r = sys_page_map(0, (void *) (va + i * PGSIZE),
+				      0, pin + i * PGSIZE, PTE_P|PTE_U)) < 0) {
+			while (--i >= 0)
+				unpin(slot + i);
+			return r;
+		}
+		// Our own hold, so lwIP freeing early data does not unmap
+		// a page we are still queueing.
+		pincount[slot + i] = 1;
+		pinused++;
+	}
+	if (pinused > pinmax)
+		pinmax = pinused;
+
+	r = lwip_send(s, pin + PGOFF(buf), len, flags | MSG_NOCOPY);
+
+	for (i = 0; i < npages; i++)
+		unpin(slot + i);
+	return r;
+}
+
+// Report the use of the pin window.
+void
+ns_pin_stats(struct ns_mem_stats *ms)
+{
+	strcpy(ms->ms_name, "NS_PIN");
+	ms->ms_avail = NPIN;
+	ms->ms_used = pinused;
+	ms->ms_max = pinmax;
+	ms->ms_err = pinfull;
+}
@@ -26,24 +26,17 @@
 
 #include "ns.h"
 
-/* errno to make lwIP happy */
-int errno;
-
 struct netif nif;
 
 #define debug 0
 
-struct timer_thread {
-	uint32_t msec;
-	void (*func)(void);
-	const char *name;
-};
-
-static struct timer_thread t_arp;
-static struct timer_thread t_tcpf;
-static struct timer_thread t_tcps;
+// lwIP's periodic timers, run by serve() from the timer wheel.
+static struct ns_timer t_arp;
+static struct ns_timer t_tcpf;
+static struct ns_timer t_tcps;
+static struct ns_timer t_dhcpf;
+static struct ns_timer t_dhcpc;
 
-static envid_t timer_envid;
 static envid_t input_envid;
 static envid_t output_envid;
 
@@ -59,12 +52,10 @@ get_buffer(void) {
 	for (i = 0; i < QUEUE_SIZE; i++)
 		if (!buse[i]) break;
 
-	if (i == QUEUE_SIZE) {
-		panic("NS: buffer overflow");
+	if (i == QUEUE_SIZE)
 		return 0;
-	}
 
-	va = (void *)(REQVA + i * PGSIZE);
+	va = (void *)(REQVA + i * REQ_PAGES * PGSIZE);
 	buse[i] = 1;
 
 	return va;
@@ -72,7 +63,7 @@ get_buffer(void) {
 
 static void
 put_buffer(void *va) {
-	int i = ((uint32_t)va - REQVA) / PGSIZE;
+	int i = ((uint32_t)va - REQVA) / (REQ_PAGES * PGSIZE);
 	buse[i] = 0;
 }
 
@@ -95,33 +86,38 @@ lwip_init(struct netif *nif, void *if_state,
 	netif_set_up(nif);
 }
 
+// Feeds the frames the input environment puts on the RX ring to lwIP.
 static void __attribute__((noreturn))
-net_timer(uint32_t arg)
+net_input(uint32_t arg)
 {
-	struct timer_thread *t = (struct timer_thread *) arg;
+	struct jif_ring *rx = &JIF_RINGS->rx;
+	uint32_t cons, prod;
 
 	for (;;) {
-		uint32_t cur = sys_time_msec();
-
-		lwip_core_lock();
-		t->func();
-		lwip_core_unlock();
+		cons = rx->jr_cons;
+		prod = rx->jr_prod;
+		if (cons == prod) {
+			// Have input ring the doorbell in case serve()
+			// blocks in ipc_recv while we wait.
+			rx->jr_cwait = 1;
+			__sync_synchronize();
+			if (rx->jr_prod == prod)
+				thread_wait(&rx->jr_prod, prod, (uint32_t)~0);
+			rx->jr_cwait = 0;
+			continue;
+		}
 
-		thread_wait(0, 0, cur + t->msec);
+		for (; cons != prod; cons++) {
+			lwip_core_lock();
+			jif_input(&nif, input_envid, (void *) JIF_RXSLOT(cons));
+			lwip_core_unlock();
+			rx->jr_cons = cons + 1;
+			jifring_notify(&rx->jr_pwait, input_envid, NSREQ_INPUT);
+		}
+		thread_yield();
 	}
 }
 
-static void
-start_timer(struct timer_thread *t, void (*func)(void), const char *name, int msec)
-{
-	t->msec = msec;
-	t->func = func;
-	t->name = name;
-	int r = thread_create(0, name, &net_timer, (uint32_t)t);
-	if (r < 0)
-		panic("cannot create timer thread: %s", e2s(r));
-}
-
 static void
 tcpip_init_done(void *arg)
 {
@@ -144,9 +140,16 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 
 	lwip_init(&nif, &output_envid, ipaddr, netmask, gw);
 
-	start_timer(&t_arp, &etharp_tmr, "arp timer", ARP_TMR_INTERVAL);
-	start_timer(&t_tcpf, &tcp_fasttmr, "tcp f timer", TCP_FAST_INTERVAL);
-	start_timer(&t_tcps, &tcp_slowtmr, "tcp s timer", TCP_SLOW_INTERVAL);
+	timer_init(sys_time_msec());
+	timer_start(&t_arp, &etharp_tmr, ARP_TMR_INTERVAL);
+	timer_start(&t_tcpf, &tcp_fasttmr, TCP_FAST_INTERVAL);
+	timer_start(&t_tcps, &tcp_slowtmr, TCP_SLOW_INTERVAL);
+	timer_start(&t_dhcpf, &dhcp_fine_tmr, DHCP_FINE_TIMER_MSECS);
+	timer_start(&t_dhcpc, &dhcp_coarse_tmr, DHCP_COARSE_TIMER_MSECS);
+
+	r = thread_create(0, "input", &net_input, 0);
+	if (r < 0)
+		panic("cannot create input thread: %s", e2s(r));
 
 	struct in_addr ia = {ipaddr};
 	cprintf("ns: %02x:%02x:%02x:%02x:%02x:%02x"
@@ -160,34 +163,108 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 	cprintf("NS: TCP/IP initialized.\n");
 }
 
-static void
-process_timer(envid_t envid) {
-	uint32_t start, now, to;
-
-	if (envid != timer_envid) {
-		cprintf("NS: received timer interrupt from envid %x not timer env\n", envid);
-		return;
-	}
-
-	start = sys_time_msec();
-	thread_yield();
-	now = sys_time_msec();
-
-	to = TIMER_INTERVAL - (now - start);
-	ipc_send(envid, to, 0, 0);
-}
+// Worker threads kept waiting for requests.  More are started while
+// every worker is busy, since some lwIP socket calls block, and those
+// exit again once the queue is empty.
+#define NWORKERS	8
 
+// A request waiting for, or being served by, a worker thread.  reqs[i]
+// describes the request pages at REQVA + i * REQ_PAGES * PGSIZE.
 struct st_args {
 	int32_t reqno;
 	uint32_t whom;
 	union Nsipc *req;
+	int npages;		// Request page plus any lent pages
 };
 
+static struct st_args reqs[QUEUE_SIZE];
+
+// Requests not yet taken by a worker, as indexes into reqs[].
+static int reqq[QUEUE_SIZE];
+static volatile uint32_t reqq_head, reqq_tail;
+
+static int nworkers;	// Worker threads running
+static int nidle;	// Workers waiting for a request
+
+// Wait with lwip_select for the sockets in a poll request and fill in
+// their revents.  Blocks this worker thread only.
+static int
+serve_poll(struct Nsreq_poll *req) {
+	fd_set rset, wset;
+	struct timeval tv, *tvp = NULL;
+	struct pollfd *pfd;
+	int i, maxs = -1, r;
+
+	if (req->req_nfds < 0 || req->req_nfds > MAXFD)
+		return -E_INVAL;
+
+	FD_ZERO(&rset);
+	FD_ZERO(&wset);
+	for (i = 0; i < req->req_nfds; i++) {
+		pfd = &req->req_fds[i];
+		if (pfd->fd < 0 || pfd->fd >= FD_SETSIZE)
+			return -E_INVAL;
+		if (pfd->events & POLLIN)
+			FD_SET(pfd->fd, &rset);
+		if (pfd->events & POLLOUT)
+			FD_SET(pfd->fd, &wset);
+		maxs = MAX(maxs, pfd->fd);
+	}
+	if (req->req_timeout >= 0) {
+		tv.tv_sec = req->req_timeout / 1000;
+		tv.tv_usec = (req->req_timeout % 1000) * 1000;
+		tvp = &tv;
+	}
+
+	if ((r = lwip_select(maxs + 1, &rset, &wset, NULL, tvp)) < 0)
+		return r;
+
+	r = 0;
+	for (i = 0; i < req->req_nfds; i++) {
+		pfd = &req->req_fds[i];
+		pfd->revents = 0;
+		if (FD_ISSET(pfd->fd, &rset))
+			pfd->revents |= POLLIN;
+		if (FD_ISSET(pfd->fd, &wset))
+			pfd->revents |= POLLOUT;
+		if (pfd->revents)
+			r++;
+	}
+	return r;
+}
+
+// Receive into, or send from, the buffer pages a bulk request lent us,
+// which follow the request page.  Sendfile pages are queued as they are.
+static int
+serve_bulk(struct st_args *args) {
+	struct Nsreq_bulk *req = &args->req->bulk;
+	char *buf = (char *) args->req + PGSIZE + req->req_off;
+	int n, r;
+
+	if (req->req_off < 0 || req->req_off >= PGSIZE || req->req_len < 0
+	    || req->req_off + req->req_len > (args->npages - 1) * PGSIZE)
+		return -E_INVAL;
+
+	if (args->reqno == NSREQ_SEND_BULK)
+		return lwip_send(req->req_s, buf, req->req_len, req->req_flags);
+	if (args->reqno == NSREQ_SENDFILE)
+		return ns_sendfile(req->req_s, buf, req->req_len, req->req_flags);
+
+	// lwip_recv returns at most one segment's data; take whatever
+	// else has arrived as well.
+	if ((r = lwip_recv(req->req_s, buf, req->req_len, req->req_flags)) <= 0)
+		return r;
+	for (n = r; n < req->req_len; n += r)
+		if ((r = lwip_recv(req->req_s, buf + n, req->req_len - n,
+				   req->req_flags | MSG_DONTWAIT)) <= 0)
+			break;
+	return n;
+}
+
 static void
-serve_thread(uint32_t a) {
-	struct st_args *args = (struct st_args *)a;
+serve_request(struct st_args *args) {
 	union Nsipc *req = args->req;
-	int r;
+	int i, r;
 
 	switch (args->reqno) {
 	case NSREQ_ACCEPT:
@@ -208,6 +285,7 @@ serve_thread(uint32_t a) {
 		break;
 	case NSREQ_CLOSE:
 		r = lwip_close(req->close.req_s);
+		ns_epoll_socket_closed(req->close.req_s);
 		break;
 	case NSREQ_CONNECT:
 		r = lwip_connect(req->connect.req_s, &req->connect.req_name,
@@ -230,9 +308,36 @@ serve_thread(uint32_t a) {
 		r = lwip_socket(req->socket.req_domain, req->socket.req_type,
 				req->socket.req_protocol);
 		break;
-	case NSREQ_INPUT:
-		jif_input(&nif, (void *)&req->pkt);
-		r = 0;
+	case NSREQ_POLL:
+		r = serve_poll(&req->poll);
+		break;
+	case NSREQ_RECV_BULK:
+	case NSREQ_SEND_BULK:
+	case NSREQ_SENDFILE:
+		r = serve_bulk(args);
+		break;
+	case NSREQ_IOCTL:
+		r = lwip_ioctl(req->ioctl.req_s, req->ioctl.req_cmd,
+			       &req->ioctl.req_arg);
+		break;
+	case NSREQ_EPOLL_CREATE:
+		r = ns_epoll_create(args->whom, req);
+		break;
+	case NSREQ_EPOLL_CTL:
+		r = ns_epoll_ctl(args->whom, req->epoll_ctl.req_epid,
+				 req->epoll_ctl.req_op, req->epoll_ctl.req_s,
+				 req->epoll_ctl.req_events,
+				 req->epoll_ctl.req_data);
+		break;
+	case NSREQ_EPOLL_WAIT:
+		r = ns_epoll_wait(args->whom, req->epoll_wait.req_epid,
+				  req->epoll_wait.req_timeout);
+		break;
+	case NSREQ_EPOLL_CLOSE:
+		r = ns_epoll_close(args->whom, req->epoll_close.req_epid);
+		break;
+	case NSREQ_STATS:
+		r = ns_stats(&req->statsRet);
 		break;
 	default:
 		cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
@@ -240,44 +345,130 @@ serve_thread(uint32_t a) {
 		break;
 	}
 
+	// Non-blocking calls that would block are not errors to report.
+	if (r == -1 && errno == EWOULDBLOCK)
+		r = -E_AGAIN;
 	if (r == -1) {
 		char buf[100];
 		snprintf(buf, sizeof buf, "ns req type %d", args->reqno);
 		perror(buf);
 	}
 
-	if (args->reqno != NSREQ_INPUT)
-		ipc_send(args->whom, r, 0, 0);
+	ipc_send(args->whom, r, 0, 0);
 
 	put_buffer(args->req);
-	sys_page_unmap(0, (void*) args->req);
-	free(args);
+	for (i = 0; i < args->npages; i++)
+		sys_page_unmap(0, (char *) args->req + i * PGSIZE);
+}
+
+static void
+serve_worker(uint32_t arg) {
+	uint32_t head;
+
+	for (;;) {
+		while ((head = reqq_head) == reqq_tail) {
+			if (nworkers > NWORKERS) {
+				nworkers--;
+				return;
+			}
+			nidle++;
+			thread_wait(&reqq_tail, head, (uint32_t)~0);
+			nidle--;
+		}
+		reqq_head = head + 1;
+		serve_request(&reqs[reqq[head % QUEUE_SIZE]]);
+	}
+}
+
+// Queue the request in buffer va for a worker thread, starting another
+// worker if there are more queued requests than idle workers.
+static void
+queue_request(int32_t reqno, uint32_t whom, void *va, int npages) {
+	int i = ((uint32_t)va - REQVA) / (REQ_PAGES * PGSIZE);
+	int r;
+
+	reqs[i].reqno = reqno;
+	reqs[i].whom = whom;
+	reqs[i].req = va;
+	reqs[i].npages = npages;
+	reqq[reqq_tail % QUEUE_SIZE] = i;
+	reqq_tail++;
+	thread_wakeup(&reqq_tail);
+
+	if (reqq_tail - reqq_head > nidle) {
+		r = thread_create(0, "serve_worker", serve_worker, 0);
+		if (r < 0)
+			panic("cannot create worker thread: %s", e2s(r));
+		nworkers++;
+	}
 }
 
 void
 serve(void) {
 	int32_t reqno;
-	uint32_t whom;
+	uint32_t whom, deadline;
 	int i, perm;
 	void *va;
+	struct jif_ring *rx = &JIF_RINGS->rx;
+
+	for (; nworkers < NWORKERS; nworkers++) {
+		i = thread_create(0, "serve_worker", serve_worker, 0);
+		if (i < 0)
+			panic("cannot create worker thread: %s", e2s(i));
+	}
 
 	while (1) {
+		timer_run(sys_time_msec());
+
 		// ipc_recv will block the entire process, so we flush
 		// all pending work from other threads.  We limit the
 		// number of yields in case there's a rogue thread.
 		for (i = 0; thread_wakeups_pending() && i < 32; ++i)
 			thread_yield();
 
+		// Out of request buffers: leave new clients blocked in
+		// ipc_send until a request finishes, but keep the threads,
+		// and with them the packet rings, running.
+		if ((va = get_buffer()) == NULL) {
+			thread_yield();
+			sys_yield();
+			continue;
+		}
+
+		// Frames that arrived while we were busy do not ring the
+		// doorbell if the input thread was not waiting yet.
+		if (rx->jr_prod != rx->jr_cons) {
+			thread_wakeup(&rx->jr_prod);
+			put_buffer(va);
+			continue;
+		}
+
+		// Sleep until a request, a doorbell, or the next timer,
+		// whether ours or one a thread is waiting on.  Threads
+		// whose wait just timed out run first, unless the yields
+		// above ran out.
+		deadline = MIN(timer_next(), thread_next_timeout());
+		if (thread_wakeups_pending() && i < 32) {
+			put_buffer(va);
+			continue;
+		}
 		perm = 0;
-		va = get_buffer();
-		reqno = ipc_recv((int32_t *) &whom, (void *) va, &perm);
+		reqno = ipc_recv_until((int32_t *) &whom, (void *) va,
+				       REQ_PAGES, &perm, deadline);
 		if (debug) {
 			cprintf("ns req %d from %08x\n", reqno, whom);
 		}
+		if (reqno == -E_TIMEOUT) {
+			put_buffer(va);
+			thread_yield();
+			continue;
+		}
 
 		// first take care of requests that do not contain an argument page
-		if (reqno == NSREQ_TIMER) {
-			process_timer(whom);
+
+		// The input environment put frames on the RX ring.
+		if (reqno == NSREQ_INPUT) {
+			thread_wakeup(&rx->jr_prod);
 			put_buffer(va);
 			continue;
 		}
@@ -285,21 +476,14 @@ serve(void) {
 		// All remaining requests must contain an argument page
 		if (!(perm & PTE_P)) {
 			cprintf("Invalid request from %08x: no argument page\n", whom);
+			put_buffer(va);
 			continue; // just leave it hanging...
 		}
 
-		// Since some lwIP socket calls will block, create a thread and
-		// process the rest of the request in the thread.
-		struct st_args *args = malloc(sizeof(struct st_args));
-		if (!args)
-			panic("could not allocate thread args structure");
-
-		args->reqno = reqno;
-		args->whom = whom;
-		args->req = va;
-
-		thread_create(0, "serve_thread", serve_thread, (uint32_t)args);
-		thread_yield(); // let the thread created run
+		// Since some lwIP socket calls will block, process the rest
+		// of the request in a worker thread.
+		queue_request(reqno, whom, va, thisenv->env_ipc_npages);
+		thread_yield(); // let a worker run
 	}
 }
 
@@ -315,17 +499,13 @@ void
 umain(int argc, char **argv)
 {
 	envid_t ns_envid = sys_getenvid();
+	int r;
 
 	binaryname = "ns";
 
-	// fork off the timer thread which will send us periodic messages
-	timer_envid = fork();
-	if (timer_envid < 0)
-		panic("error forking");
-	else if (timer_envid == 0) {
-		timer(ns_envid, TIMER_INTERVAL);
-		return;
-	}
+	// The packet rings are shared with input and output; see inc/ns.h.
+	if ((r = sys_page_alloc(0, JIF_RINGS, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("cannot allocate packet rings: %e", r);
 
 	// fork off the input thread which will poll the NIC driver for input
 	// packets
@@ -0,0 +1,96 @@
+/*
+ * Statistics of the network server.
+ *
+ * NSREQ_STATS returns lwIP's counters (lwip_stats) in the flat layout
+ * of struct Nsret_stats, so user/netstat need not know how lwIP was
+ * configured.  The pools of ns itself, the received pages jif keeps and
+ * the sendfile pin window, come after lwIP's.
+ */
+
+#include <lwip/stats.h>
+#include <lwip/tcp.h>
+#include <jif/jif.h>
+
+#include "ns.h"
+
+static const char *memp_names[] = {
+#define LWIP_MEMPOOL(name,num,size,desc) desc,
+#include <lwip/memp_std.h>
+};
+
+static void
+proto_stats(struct Nsret_stats *ret, const char *name,
+	    const struct stats_proto *sp)
+{
+	struct ns_proto_stats *ps;
+
+	if (ret->ret_nprotos == NS_STATS_PROTOS)
+		return;
+	ps = &ret->ret_protos[ret->ret_nprotos++];
+	strncpy(ps->ps_name, name, sizeof(ps->ps_name) - 1);
+	ps->ps_xmit = sp->xmit;
+	ps->ps_recv = sp->recv;
+	ps->ps_drop = sp->drop;
+	ps->ps_chkerr = sp->chkerr;
+	ps->ps_lenerr = sp->lenerr;
+	ps->ps_memerr = sp->memerr;
+	ps->ps_rterr = sp->rterr;
+	ps->ps_proterr = sp->proterr;
+	ps->ps_opterr = sp->opterr;
+	ps->ps_err = sp->err;
+}
+
+static struct ns_mem_stats *
+mem_stats(struct Nsret_stats *ret, const char *name,
+	  const struct stats_mem *sm)
+{
+	struct ns_mem_stats *ms;
+
+	if (ret->ret_nmems == NS_STATS_MEMS)
+		return NULL;
+	ms = &ret->ret_mems[ret->ret_nmems++];
+	if (sm) {
+		strncpy(ms->ms_name, name, sizeof(ms->ms_name) - 1);
+		ms->ms_avail = sm->avail;
+		ms->ms_used = sm->used;
+		ms->ms_max = sm->max;
+		ms->ms_err = sm->err;
+	}
+	return ms;
+}
+
+int
+ns_stats(struct Nsret_stats *ret)
+{
+	struct ns_mem_stats *ms;
+	int i;
+
+	static_assert(sizeof(memp_names) / sizeof(memp_names[0]) == MEMP_MAX);
+	static_assert(MEMP_MAX + 3 <= NS_STATS_MEMS);
+
+	memset(ret, 0, sizeof(*ret));
+
+	proto_stats(ret, "link", &lwip_stats.link);
+	proto_stats(ret, "etharp", &lwip_stats.etharp);
+	proto_stats(ret, "ip", &lwip_stats.ip);
+	proto_stats(ret, "icmp", &lwip_stats.icmp);
+	proto_stats(ret, "udp", &lwip_stats.udp);
+	proto_stats(ret, "tcp", &lwip_stats.tcp);
+
+	// With MEM_USE_POOLS, the heap counters count what mem_malloc
+	// took from malloc() because no pool could provide it.
+	mem_stats(ret, MEM_USE_POOLS ? "MEM_OVERFLOW" : "HEAP",
+		  &lwip_stats.mem);
+	for (i = 0; i < MEMP_MAX; i++)
+		mem_stats(ret, memp_names[i], &lwip_stats.memp[i]);
+	if ((ms = mem_stats(ret, NULL, NULL)))
+		jif_stats(ms);
+	if ((ms = mem_stats(ret, NULL, NULL)))
+		ns_pin_stats(ms);
+
+	ret->ret_tcp_mss = TCP_MSS;
+	ret->ret_tcp_wnd = TCP_WND;
+	ret->ret_tcp_rcv_scale = LWIP_WND_SCALE ? TCP_RCV_SCALE : 0;
+	ret->ret_tcp_snd_buf = TCP_SND_BUF;
+	return 0;
+}
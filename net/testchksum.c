@@ -0,0 +1,114 @@
+#include "ns.h"
+
+#define BUFSIZE 2048
+#define BENCH_LEN 1500
+#define BENCH_MSEC 200
+
+static uint8_t src[BUFSIZE + 8], dst[BUFSIZE + 8];
+static volatile uint32_t sink;
+
+// lwIP's portable checksum (LWIP_CHKSUM_ALGORITHM 1), as the reference.
+static u16_t
+ref_chksum(void *dataptr, u16_t len)
+{
+	uint32_t acc = 0;
+	uint8_t *octetptr = dataptr;
+
+	for (; len > 1; len -= 2, octetptr += 2)
+		acc += (octetptr[0] << 8) | octetptr[1];
+	if (len > 0)
+		acc += octetptr[0] << 8;
+	acc = (acc >> 16) + (acc & 0xffff);
+	acc = (acc >> 16) + (acc & 0xffff);
+	return htons(acc);
+}
+
+static u16_t
+ref_copy_chksum(void *d, const void *s, u16_t len)
+{
+	memcpy(d, s, len);
+	return ref_chksum(d, len);
+}
+
+static u16_t
+copy_chksum(void *d, const void *s, u16_t len)
+{
+	memcpy(d, s, len);
+	return jos_chksum(d, len);
+}
+
+static u16_t
+sum_only(void *d, const void *s, u16_t len)
+{
+	return jos_chksum((void *) s, len);
+}
+
+static u16_t
+ref_sum_only(void *d, const void *s, u16_t len)
+{
+	return ref_chksum((void *) s, len);
+}
+
+static void
+check(const char *what, int off, int len)
+{
+	u16_t want, got;
+	int doff = (off * 3) & 7;
+
+	want = ref_chksum(src + off, len);
+	if ((got = jos_chksum(src + off, len)) != want)
+		panic("%s: jos_chksum(+%d, %d) = %04x, want %04x",
+		      what, off, len, got, want);
+	memset(dst, 0, sizeof(dst));
+	if ((got = jos_chksum_copy(dst + doff, src + off, len)) != want)
+		panic("%s: jos_chksum_copy(+%d, %d) = %04x, want %04x",
+		      what, off, len, got, want);
+	if (memcmp(dst + doff, src + off, len) != 0 || dst[doff + len] != 0)
+		panic("%s: jos_chksum_copy(+%d, %d) copied wrong",
+		      what, off, len);
+}
+
+static void
+bench(const char *name, u16_t (*fn)(void *, const void *, u16_t))
+{
+	unsigned start, now;
+	int i, n = 0;
+
+	start = sys_time_msec();
+	while ((now = sys_time_msec()) - start < BENCH_MSEC) {
+		for (i = 0; i < 100; i++)
+			sink += fn(dst, src, BENCH_LEN);
+		n += 100;
+	}
+	cprintf("testchksum: %-22s %5d MB/s\n", name,
+		n * BENCH_LEN / (now - start) / 1000);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t seed = 1;
+	int i, off, len;
+
+	binaryname = "testchksum";
+
+	// Random data, then all ones, which carries on every add.
+	for (i = 0; i < sizeof(src); i++) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = seed >> 16;
+	}
+	for (off = 0; off < 8; off++)
+		for (len = 0; len <= BUFSIZE; len++)
+			check("random", off, len);
+	memset(src, 0xff, sizeof(src));
+	for (off = 0; off < 8; off++)
+		for (len = 0; len <= BUFSIZE; len += 7)
+			check("ones", off, len);
+	cprintf("testchksum: all checks passed\n");
+
+	bench("reference", ref_sum_only);
+	bench("jos_chksum", sum_only);
+	bench("memcpy + reference", ref_copy_chksum);
+	bench("memcpy + jos_chksum", copy_chksum);
+	bench("jos_chksum_copy", jos_chksum_copy);
+}
@@ -39,7 +39,13 @@ announce(void)
 	memset(arp->dhwaddr.addr,  0x00,  ETHARP_HWADDR_LEN);
 	memcpy(arp->dipaddr.addrw, &gwip, 4);
 
-	ipc_send(output_envid, NSREQ_OUTPUT, pkt, PTE_P|PTE_W|PTE_U);
+	// The output environment has nothing queued yet, so slot 0 is free.
+	struct jif_ring *tx = &JIF_RINGS->tx;
+	if ((r = sys_page_map(0, pkt, output_envid, (void *) JIF_TXSLOT(0),
+			      PTE_P|PTE_W|PTE_U)) < 0)
+		panic("sys_page_map: %e", r);
+	tx->jr_prod++;
+	jifring_notify(&tx->jr_cwait, output_envid, NSREQ_OUTPUT);
 	sys_page_unmap(0, pkt);
 }
 
@@ -68,10 +74,14 @@ void
 umain(int argc, char **argv)
 {
 	envid_t ns_envid = sys_getenvid();
+	struct jif_ring *rx = &JIF_RINGS->rx;
 	int i, r, first = 1;
 
 	binaryname = "testinput";
 
+	if ((r = sys_page_alloc(0, JIF_RINGS, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+
 	output_envid = fork();
 	if (output_envid < 0)
 		panic("error forking");
@@ -92,16 +102,17 @@ umain(int argc, char **argv)
 	announce();
 
 	while (1) {
-		envid_t whom;
-		int perm;
-
-		int32_t req = ipc_recv((int32_t *)&whom, pkt, &perm);
-		if (req < 0)
-			panic("ipc_recv: %e", req);
-		if (whom != input_envid)
-			panic("IPC from unexpected environment %08x", whom);
-		if (req != NSREQ_INPUT)
-			panic("Unexpected IPC %d", req);
+		uint32_t cons = rx->jr_cons;
+
+		if (cons == rx->jr_prod) {
+			jifring_wait(&rx->jr_cwait, &rx->jr_prod, cons);
+			continue;
+		}
+		if ((r = sys_page_map(input_envid, (void *) JIF_RXSLOT(cons),
+				      0, pkt, PTE_P|PTE_U)) < 0)
+			panic("sys_page_map: %e", r);
+		rx->jr_cons = cons + 1;
+		jifring_notify(&rx->jr_pwait, input_envid, NSREQ_INPUT);
 
 		hexdump("input: ", pkt->jp_data, pkt->jp_len);
 		cprintf("\n");
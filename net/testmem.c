@@ -0,0 +1,152 @@
+// Drive mem_malloc the way 32 busy TCP connections do: each keeps a
+// queue of PBUF_RAM segments (full ones, pure ACKs, short writes, the
+// odd large UDP datagram) that is acknowledged from the front at random.
+// Checks that nothing fails while the queues fit the pools and that
+// everything comes back, then reports the cycles per pbuf_alloc and
+// pbuf_free and how many bytes the allocator held for the payload.
+
+#include <inc/x86.h>
+#include <lwip/mem.h>
+#include <lwip/memp.h>
+#include <lwip/pbuf.h>
+#include <lwip/stats.h>
+#include <lwip/tcp.h>
+
+#include "ns.h"
+
+#define NCONN		32
+#define QUEUE		8	// Most pbufs a connection holds
+#define ROUNDS		200000
+
+static struct conn {
+	struct pbuf *q[QUEUE];
+	int head, n;
+} conns[NCONN];
+
+static uint32_t seed = 1;
+static uint64_t alloc_cycles, free_cycles;
+static int nalloc, nfree, asked, peak_asked, peak_held;
+
+static uint32_t
+rnd(uint32_t n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % n;
+}
+
+// Bytes the allocator holds now for the pbufs handed out.
+static int
+held(void)
+{
+	int n = lwip_stats.mem.used;
+#if MEM_USE_POOLS
+	memp_t i;
+
+	for (i = MEMP_POOL_FIRST; i <= MEMP_POOL_LAST; i++)
+		n += lwip_stats.memp[i].used * memp_sizes[i];
+#endif
+	return n;
+}
+
+static void
+conn_push(struct conn *c)
+{
+	struct pbuf *p;
+	pbuf_layer layer = PBUF_TRANSPORT;
+	uint64_t t;
+	int len, r = rnd(100);
+
+	if (r < 60)
+		len = TCP_MSS;
+	else if (r < 85) {
+		layer = PBUF_IP;
+		len = TCP_HLEN;
+	} else if (r < 99)
+		len = 1 + rnd(TCP_MSS);
+	else {
+		layer = PBUF_IP;
+		len = 4096 + rnd(8192);
+	}
+
+	t = read_tsc();
+	p = pbuf_alloc(layer, len, PBUF_RAM);
+	alloc_cycles += read_tsc() - t;
+	nalloc++;
+	if (!p)
+		panic("pbuf_alloc(%d) failed with %d bytes held", len, held());
+
+	c->q[(c->head + c->n++) % QUEUE] = p;
+	asked += len;
+	if (asked > peak_asked) {
+		peak_asked = asked;
+		peak_held = held();
+	}
+}
+
+static void
+conn_pop(struct conn *c)
+{
+	struct pbuf *p = c->q[c->head];
+	uint64_t t;
+
+	c->head = (c->head + 1) % QUEUE;
+	c->n--;
+	asked -= p->tot_len;
+
+	t = read_tsc();
+	pbuf_free(p);
+	free_cycles += read_tsc() - t;
+	nfree++;
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct conn *c;
+	memp_t i;
+	int round, k;
+
+	binaryname = "testmem";
+	mem_init();
+	memp_init();
+
+	for (round = 0; round < ROUNDS; round++) {
+		c = &conns[rnd(NCONN)];
+		// Acknowledge a run of segments now and then, and always
+		// when the queue is full.
+		if (c->n == QUEUE || (c->n > 0 && rnd(3) == 0))
+			for (k = 1 + rnd(c->n); k > 0; k--)
+				conn_pop(c);
+		else
+			conn_push(c);
+	}
+	for (c = conns; c < conns + NCONN; c++)
+		while (c->n > 0)
+			conn_pop(c);
+
+	if (lwip_stats.mem.used != 0 || held() != 0)
+		panic("%d bytes still held after freeing everything", held());
+#if MEM_USE_POOLS
+	for (i = MEMP_POOL_FIRST; i <= MEMP_POOL_LAST; i++)
+		if (lwip_stats.memp[i].used != 0)
+			panic("pool of %d still has %d elements out",
+			      memp_sizes[i], lwip_stats.memp[i].used);
+#else
+	USED(i);
+#endif
+	cprintf("testmem: all checks passed\n");
+
+	cprintf("testmem: %d allocs, %d cycles each; %d frees, %d cycles each\n",
+		nalloc, (int) (alloc_cycles / nalloc),
+		nfree, (int) (free_cycles / nfree));
+	cprintf("testmem: at peak %d KB held for %d KB of payload (%d%%)\n",
+		peak_held / 1024, peak_asked / 1024,
+		(int) ((uint64_t) peak_held * 100 / peak_asked));
+#if MEM_USE_POOLS
+	for (i = MEMP_POOL_FIRST; i <= MEMP_POOL_LAST; i++)
+		cprintf("testmem: pool of %4d: %4d max of %4d, %d empty\n",
+			memp_sizes[i], lwip_stats.memp[i].max,
+			lwip_stats.memp[i].avail, lwip_stats.memp[i].err);
+	cprintf("testmem: %d KB most from malloc\n", lwip_stats.mem.max / 1024);
+#endif
+}
@@ -13,10 +13,14 @@ void
 umain(int argc, char **argv)
 {
 	envid_t ns_envid = sys_getenvid();
+	struct jif_ring *tx = &JIF_RINGS->tx;
 	int i, r;
 
 	binaryname = "testoutput";
 
+	if ((r = sys_page_alloc(0, JIF_RINGS, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+
 	output_envid = fork();
 	if (output_envid < 0)
 		panic("error forking");
@@ -26,13 +30,20 @@ umain(int argc, char **argv)
 	}
 
 	for (i = 0; i < TESTOUTPUT_COUNT; i++) {
+		while (tx->jr_prod - tx->jr_cons == JIF_RING_SLOTS)
+			sys_yield();
 		if ((r = sys_page_alloc(0, pkt, PTE_P|PTE_U|PTE_W)) < 0)
 			panic("sys_page_alloc: %e", r);
 		pkt->jp_len = snprintf(pkt->jp_data,
 				       PGSIZE - sizeof(pkt->jp_len),
 				       "Packet %02d", i);
 		cprintf("Transmitting packet %d\n", i);
-		ipc_send(output_envid, NSREQ_OUTPUT, pkt, PTE_P|PTE_W|PTE_U);
+		if ((r = sys_page_map(0, pkt, output_envid,
+				      (void *) JIF_TXSLOT(tx->jr_prod),
+				      PTE_P|PTE_W|PTE_U)) < 0)
+			panic("sys_page_map: %e", r);
+		tx->jr_prod++;
+		jifring_notify(&tx->jr_cwait, output_envid, NSREQ_OUTPUT);
 		sys_page_unmap(0, pkt);
 	}
 
@@ -0,0 +1,307 @@
+// Send data between two lwIP TCP connections of this environment over
+// a loopback netif that drops some of the data segments, and check that
+// it all arrives intact.  The netif models a 100 Mbit/s link with 10 ms
+// of delay each way on a virtual clock, which also runs the TCP timers,
+// so the time a transfer takes counts its round trips and time-outs.
+//
+// Every transfer runs twice: once with SACK, and once with the netif
+// taking the SACK permitted option out of the SYNs, so that recovery
+// falls back to NewReno.  With SACK, each lost segment must go out again
+// exactly once and without a time-out.
+
+#include <lwip/init.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/ip.h>
+#include <lwip/netif.h>
+#include <lwip/tcp.h>
+
+#include "ns.h"
+
+#define PORT		7
+#define TOTAL		(2 * 1024 * 1024)
+#define PERIOD		251	// Prime, so misplaced data shows
+#define DELAY		10000	// One-way delay, in microseconds
+#define MAXTIME		120000000	// Virtual time before giving up
+
+struct run {
+	const char *name;
+	int sack;
+	int every;		// Drop a run of segments this often,
+	int burst;		// this many long
+};
+
+static struct run runs[] = {
+	{ "single",	1, 50, 1 },
+	{ "single",	0, 50, 1 },
+	{ "burst of 3",	1, 100, 3 },
+	{ "burst of 3",	0, 100, 3 },
+};
+
+static struct netif lossif;
+static struct run *run;
+static uint8_t pattern[PERIOD + TCP_SND_BUF];
+
+// Packets in flight in each direction, oldest first
+static struct link {
+	struct {
+		struct pbuf *p;
+		uint32_t due;	// When it arrives
+	} q[1024];
+	int head, n;
+	uint32_t free;		// When the link can take the next packet
+} links[2];
+
+// The virtual clock, in microseconds, and when the TCP timers run next
+static uint32_t now, next_tmr;
+static int ntmr;
+
+// What the netif saw of the current transfer
+static uint32_t snd_base;	// Sequence number of the first data
+static uint32_t snd_high;	// End of the data sent so far
+static int nseg, ndrop, nrexmit;
+
+// The two ends
+static struct tcp_pcb *listener, *client;
+static int queued, received;
+
+static err_t
+lossif_output(struct netif *netif, struct pbuf *p, struct ip_addr *ipaddr)
+{
+	struct ip_hdr *iph;
+	struct tcp_hdr *tcph;
+	struct link *l;
+	struct pbuf *c;
+	uint32_t seq;
+	uint8_t *opt;
+	int len, hlen, i;
+
+	if (!(c = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM)))
+		panic("lossif: out of memory");
+	pbuf_copy(c, p);
+
+	iph = c->payload;
+	hlen = IPH_HL(iph) * 4;
+	tcph = (struct tcp_hdr *) ((uint8_t *) iph + hlen);
+	len = ntohs(IPH_LEN(iph)) - hlen - TCPH_HDRLEN(tcph) * 4;
+	seq = ntohl(tcph->seqno);
+
+	// Take the SACK permitted option out of SYNs for a NewReno run
+	if ((TCPH_FLAGS(tcph) & TCP_SYN) && !run->sack) {
+		opt = (uint8_t *) (tcph + 1);
+		for (i = 0; i < (TCPH_HDRLEN(tcph) - 5) * 4 && opt[i] != 0; )
+			if (opt[i] == 1)
+				i++;
+			else if (opt[i] == 4)
+				opt[i] = opt[i + 1] = 1;
+			else
+				i += opt[i + 1];
+	}
+
+	// Drop new data from the client now and then.  Never drop
+	// retransmissions, so that both runs lose the same segments, nor
+	// the last few segments, which leave too few to follow them for
+	// duplicate ACKs.
+	if (len > 0 && ntohs(tcph->dest) == PORT) {
+		if (nseg == 0)
+			snd_base = snd_high = seq;
+		if (TCP_SEQ_LT(seq, snd_high))
+			nrexmit++;
+		else {
+			snd_high = seq + len;
+			if (nseg++ % run->every >= run->every - run->burst &&
+			    seq - snd_base < TOTAL - 8 * TCP_MSS) {
+				ndrop++;
+				pbuf_free(c);
+				return ERR_OK;
+			}
+		}
+	}
+
+	// The checksums the card would have filled in
+	tcph->chksum = 0;
+	pbuf_header(c, -hlen);
+	tcph->chksum = inet_chksum_pseudo(c, &iph->src, &iph->dest,
+					  IP_PROTO_TCP, c->tot_len);
+	pbuf_header(c, hlen);
+	IPH_CHKSUM_SET(iph, 0);
+	IPH_CHKSUM_SET(iph, inet_chksum(iph, hlen));
+
+	// A byte takes 80 ns at 100 Mbit/s
+	l = &links[ntohs(tcph->dest) == PORT];
+	if (l->n == ARRAY_SIZE(l->q))
+		panic("lossif: %d packets in flight", l->n);
+	l->free = MAX(l->free, now) + c->tot_len * 8 / 100;
+	i = (l->head + l->n++) % ARRAY_SIZE(l->q);
+	l->q[i].p = c;
+	l->q[i].due = l->free + DELAY;
+	return ERR_OK;
+}
+
+static err_t
+lossif_init(struct netif *netif)
+{
+	netif->output = lossif_output;
+	netif->mtu = 1500;
+	return ERR_OK;
+}
+
+static void
+send_more(struct tcp_pcb *pcb)
+{
+	int len;
+
+	while (queued < TOTAL && tcp_sndbuf(pcb) > 0) {
+		len = MIN(tcp_sndbuf(pcb), TOTAL - queued);
+		if (tcp_write(pcb, pattern + queued % PERIOD, len, 0) != ERR_OK)
+			break;
+		queued += len;
+	}
+	tcp_output(pcb);
+}
+
+static err_t
+client_sent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+	send_more(pcb);
+	return ERR_OK;
+}
+
+static err_t
+client_connected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+	if (run->sack != !!(pcb->flags & TF_SACK))
+		panic("%s: SACK %snegotiated", run->name,
+		      run->sack ? "not " : "");
+	send_more(pcb);
+	return ERR_OK;
+}
+
+static err_t
+server_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+	struct pbuf *r;
+	uint8_t *d;
+	int i;
+
+	if (p == NULL) {
+		tcp_close(pcb);
+		return ERR_OK;
+	}
+	for (r = p; r != NULL; r = r->next)
+		for (d = r->payload, i = 0; i < r->len; i++, received++)
+			if (d[i] != received % PERIOD)
+				panic("%s: byte %d is %d, not %d", run->name,
+				      received, d[i], received % PERIOD);
+	tcp_recved(pcb, p->tot_len);
+	pbuf_free(p);
+	return ERR_OK;
+}
+
+static err_t
+server_accept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+	tcp_accepted(listener);
+	tcp_recv(pcb, server_recv);
+	return ERR_OK;
+}
+
+// Move the clock on to the next packet to arrive, or to the TCP timers
+// if they come first, and deliver it or run them
+static void
+step(void)
+{
+	struct link *l, *next = NULL;
+	struct pbuf *p;
+
+	for (l = links; l < links + ARRAY_SIZE(links); l++)
+		if (l->n > 0 && (!next || TCP_SEQ_LT(l->q[l->head].due,
+						     next->q[next->head].due)))
+			next = l;
+
+	if (next && TCP_SEQ_LT(next->q[next->head].due, next_tmr)) {
+		now = next->q[next->head].due;
+		p = next->q[next->head].p;
+		next->head = (next->head + 1) % ARRAY_SIZE(next->q);
+		next->n--;
+		ip_input(p, &lossif);
+		return;
+	}
+
+	now = next_tmr;
+	next_tmr += TCP_FAST_INTERVAL * 1000;
+	tcp_fasttmr();
+	if (ntmr++ % (TCP_SLOW_INTERVAL / TCP_FAST_INTERVAL) == 0)
+		tcp_slowtmr();
+}
+
+// Send TOTAL bytes from a new connection on port; returns the time it
+// took in milliseconds
+static int
+transfer(struct run *r, u16_t port)
+{
+	struct ip_addr ipaddr;
+	uint32_t start = now;
+	int ms;
+
+	run = r;
+	snd_high = queued = received = 0;
+	nseg = ndrop = nrexmit = 0;
+
+	client = tcp_new();
+	tcp_bind(client, IP_ADDR_ANY, port);
+	tcp_sent(client, client_sent);
+	ipaddr = lossif.ip_addr;
+	tcp_connect(client, &ipaddr, PORT, client_connected);
+
+	while (received < TOTAL) {
+		step();
+		if (now - start > MAXTIME)
+			panic("%s: stuck after %d of %d bytes", r->name,
+			      received, TOTAL);
+	}
+	ms = (now - start) / 1000;
+	tcp_close(client);
+	while (links[0].n > 0 || links[1].n > 0)
+		step();
+
+	cprintf("testtcp: %-10s %-7s %3d dropped, %3d retransmitted, "
+		"%5d ms\n", r->name, r->sack ? "SACK" : "NewReno",
+		ndrop, nrexmit, ms);
+	if (r->sack && nrexmit != ndrop)
+		panic("%s: %d segments retransmitted for %d dropped",
+		      r->name, nrexmit, ndrop);
+	return ms;
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct ip_addr ipaddr, netmask, gw;
+	int i, sack_ms;
+
+	binaryname = "testtcp";
+	for (i = 0; i < ARRAY_SIZE(pattern); i++)
+		pattern[i] = i % PERIOD;
+
+	lwip_init();
+	IP4_ADDR(&ipaddr, 10, 0, 0, 1);
+	IP4_ADDR(&netmask, 255, 255, 255, 0);
+	IP4_ADDR(&gw, 10, 0, 0, 254);
+	netif_add(&lossif, &ipaddr, &netmask, &gw, NULL, lossif_init,
+		  ip_input);
+	netif_set_default(&lossif);
+	netif_set_up(&lossif);
+
+	listener = tcp_new();
+	tcp_bind(listener, IP_ADDR_ANY, PORT);
+	listener = tcp_listen(listener);
+	tcp_accept(listener, server_accept);
+
+	for (i = 0; i < ARRAY_SIZE(runs); i += 2) {
+		sack_ms = transfer(&runs[i], 4000 + i);
+		if (sack_ms > transfer(&runs[i + 1], 4001 + i))
+			panic("%s: SACK took longer than NewReno",
+			      runs[i].name);
+	}
+	cprintf("testtcp: all checks passed\n");
+}
@@ -1,32 +1,126 @@
+/*
+ * Hierarchical timer wheel for the network server's periodic timers.
+ *
+ * Time is counted in ticks of TIMER_TICK msec, the kernel clock's
+ * resolution.  Level 0 has a slot for each of the next 64 ticks, level
+ * 1 a slot for each of the next 64 spans of 64 ticks, and level 2 for
+ * spans of 64 * 64 ticks.  Whenever level 0 wraps, the next slot of
+ * level 1 is spread over level 0 again, and likewise for level 2, so
+ * adding and firing a timer take constant time no matter how many are
+ * pending.
+ */
+
 #include "ns.h"
 
-void
-timer(envid_t ns_envid, uint32_t initial_to) {
-	int r;
-	uint32_t stop = sys_time_msec() + initial_to;
+#define TIMER_TICK	10
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	3
 
-	binaryname = "ns_timer";
+static struct ns_timer *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint32_t wheel_now;	// Next tick to process
+static int ntimers;
 
-	while (1) {
-		while((r = sys_time_msec()) < stop && r >= 0) {
-			sys_yield();
-		}
-		if (r < 0)
-			panic("sys_time_msec: %e", r);
+static void
+wheel_add(struct ns_timer *t)
+{
+	uint32_t delta = t->nt_expires - wheel_now;
+	struct ns_timer **slot;
+	int level;
 
-		ipc_send(ns_envid, NSREQ_TIMER, 0, 0);
+	if ((int32_t) delta < 0)
+		t->nt_expires = wheel_now;
+	for (level = 0; level < WHEEL_LEVELS - 1; level++)
+		if (t->nt_expires - wheel_now < (1 << (WHEEL_BITS * (level + 1))))
+			break;
+	if (level == WHEEL_LEVELS - 1 &&
+	    t->nt_expires - wheel_now >= (1 << (WHEEL_BITS * WHEEL_LEVELS)))
+		t->nt_expires = wheel_now + (1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
 
-		while (1) {
-			uint32_t to, whom;
-			to = ipc_recv((int32_t *) &whom, 0, 0);
+	slot = &wheel[level][(t->nt_expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	t->nt_next = *slot;
+	*slot = t;
+}
 
-			if (whom != ns_envid) {
-				cprintf("NS TIMER: timer thread got IPC message from env %x not NS\n", whom);
-				continue;
-			}
+// Move the timers in one slot of a higher level down to where they
+// belong now.
+static void
+cascade(int level, int i)
+{
+	struct ns_timer *t = wheel[level][i], *next;
 
-			stop = sys_time_msec() + to;
-			break;
+	wheel[level][i] = 0;
+	for (; t; t = next) {
+		next = t->nt_next;
+		wheel_add(t);
+	}
+}
+
+void
+timer_init(uint32_t now)
+{
+	memset(wheel, 0, sizeof(wheel));
+	wheel_now = now / TIMER_TICK;
+	ntimers = 0;
+}
+
+// Call func every msec milliseconds, starting msec from now.
+void
+timer_start(struct ns_timer *t, void (*func)(void), uint32_t msec)
+{
+	t->nt_func = func;
+	t->nt_interval = ROUNDUP(msec, TIMER_TICK) / TIMER_TICK;
+	t->nt_expires = wheel_now + t->nt_interval;
+	wheel_add(t);
+	ntimers++;
+}
+
+// Fire every timer that is due by 'now' (in msec).
+void
+timer_run(uint32_t now)
+{
+	struct ns_timer *t, *next;
+	uint32_t target = now / TIMER_TICK;
+	int i;
+
+	while ((int32_t) (target - wheel_now) >= 0) {
+		i = wheel_now & WHEEL_MASK;
+		if (i == 0) {
+			if (((wheel_now >> WHEEL_BITS) & WHEEL_MASK) == 0)
+				cascade(2, (wheel_now >> (2 * WHEEL_BITS)) & WHEEL_MASK);
+			cascade(1, (wheel_now >> WHEEL_BITS) & WHEEL_MASK);
+		}
+
+		t = wheel[0][i];
+		wheel[0][i] = 0;
+		wheel_now++;
+		for (; t; t = next) {
+			next = t->nt_next;
+			t->nt_func();
+			// Skip the periods we slept through rather than
+			// firing again at once for each of them.
+			t->nt_expires += t->nt_interval;
+			if ((int32_t) (t->nt_expires - target) <= 0)
+				t->nt_expires = target + t->nt_interval;
+			wheel_add(t);
 		}
 	}
 }
+
+// When timer_run next has work to do, in msec: the first nonempty slot
+// of level 0, or the next cascade.  ~0 if there are no timers.
+uint32_t
+timer_next(void)
+{
+	uint32_t tick;
+
+	if (ntimers == 0)
+		return ~0;
+	if ((wheel_now & WHEEL_MASK) == 0)
+		return wheel_now * TIMER_TICK;
+	for (tick = wheel_now; tick == wheel_now || (tick & WHEEL_MASK); tick++)
+		if (wheel[0][tick & WHEEL_MASK])
+			break;
+	return tick * TIMER_TICK;
+}
@@ -0,0 +1,116 @@
+// Echo server like pollsrv, driven by epoll: non-blocking sockets, and
+// events pushed by the network server instead of a poll per round.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define PORT 7
+
+#define BUFFSIZE 512
+#define MAXPENDING 5    // Max connection requests
+#define MAXEVENTS 16
+
+static void
+die(char *m)
+{
+	cprintf("%s\n", m);
+	exit();
+}
+
+static void
+watch(int epfd, int sock, uint32_t events)
+{
+	struct epoll_event ev;
+	int r;
+
+	ev.events = events;
+	ev.data.fd = sock;
+	if ((r = epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev)) < 0)
+		panic("epoll_ctl: %e", r);
+}
+
+// Echo everything sock has for us.  Returns < 0 once the client is
+// gone or broken.
+static int
+echo(int sock)
+{
+	char buffer[BUFFSIZE];
+	int n, m, r;
+
+	for (;;) {
+		if ((n = read(sock, buffer, BUFFSIZE)) == -E_AGAIN)
+			return 0;
+		if (n <= 0)
+			return -1;
+		// The reply is small; wait out a full send buffer.
+		for (m = 0; m < n; m += r)
+			if ((r = write(sock, buffer + m, n - m)) == -E_AGAIN) {
+				r = 0;
+				sys_yield();
+			} else if (r <= 0)
+				return -1;
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct epoll_event events[MAXEVENTS];
+	struct sockaddr_in echoserver, echoclient;
+	unsigned int clientlen;
+	int serversock, sock, epfd, i, n;
+
+	binaryname = "epollsrv";
+
+	if ((serversock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("Failed to create socket");
+
+	memset(&echoserver, 0, sizeof(echoserver));
+	echoserver.sin_family = AF_INET;
+	echoserver.sin_addr.s_addr = htonl(INADDR_ANY);
+	echoserver.sin_port = htons(PORT);
+	if (bind(serversock, (struct sockaddr *) &echoserver,
+		 sizeof(echoserver)) < 0)
+		die("Failed to bind the server socket");
+	if (listen(serversock, MAXPENDING) < 0)
+		die("Failed to listen on server socket");
+	if (fcntl(serversock, F_SETFL, O_NONBLOCK) < 0)
+		die("Failed to make the server socket non-blocking");
+
+	if ((epfd = epoll_create(MAXEVENTS)) < 0)
+		panic("epoll_create: %e", epfd);
+	watch(epfd, serversock, EPOLLIN);
+
+	cprintf("bound\n");
+
+	while (1) {
+		if ((n = epoll_wait(epfd, events, MAXEVENTS, -1)) < 0)
+			panic("epoll_wait: %e", n);
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd != serversock) {
+				if (echo(events[i].data.fd) < 0)
+					close(events[i].data.fd);
+				continue;
+			}
+
+			// Accept every pending connection.
+			for (;;) {
+				clientlen = sizeof(echoclient);
+				sock = accept(serversock,
+					      (struct sockaddr *) &echoclient,
+					      &clientlen);
+				if (sock == -E_AGAIN)
+					break;
+				if (sock < 0)
+					die("Failed to accept client connection");
+				cprintf("Client connected: %s\n",
+					inet_ntoa(echoclient.sin_addr));
+				if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0)
+					die("Failed to make a client socket non-blocking");
+				watch(epfd, sock, EPOLLIN);
+			}
+		}
+	}
+}
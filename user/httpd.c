@@ -1,31 +1,37 @@
+// Web server.  One environment serves every client at once: each
+// connection is a non-blocking socket with a little state, and poll()
+// says which ones can make progress.  HTTP/1.1 connections stay open
+// for more requests (keep-alive), and requests sent back to back
+// (pipelining) are answered in order.  Small files are kept in memory
+// behind their response head; others go out with sendfile(), so their
+// data never passes through httpd.
+
 #include <inc/lib.h>
 #include <lwip/sockets.h>
 #include <lwip/inet.h>
 
 #define PORT 80
-#define VERSION "0.1"
-#define HTTP_VERSION "1.0"
+#define VERSION "0.2"
+#define HTTP_VERSION "1.1"
 
 #define E_BAD_REQ	1000
 
-#define BUFFSIZE 512
-#define MAXPENDING 5	// Max connection requests
+#define BUFFSIZE 2048	// Longest request head
+#define OUTSIZE 512	// Longest response head
+#define MAXPENDING 16	// Max connection requests
+// Every connection may have a socket and a file open.
+#define MAXCONNS ((MAXFD - 4) / 2)
+#define NHEADS 16	// Cached response heads
+#define NFILES 32	// Cached files
+#define FILE_CACHE_MAX (256 * 1024)	// Largest file kept in memory
+#define CACHE_BYTES (4 * 1024 * 1024)	// Memory for cached files
+#define CACHE_CHECK 1000	// Msec a cached file is trusted without a stat
 
 struct http_request {
 	int sock;
 	char *url;
 	char *version;
-};
-
-struct responce_header {
-	int code;
-	char *header;
-};
-
-struct responce_header headers[] = {
-	{ 200, 	"HTTP/" HTTP_VERSION " 200 OK\r\n"
-		"Server: jhttpd/" VERSION "\r\n"},
-	{0, 0},
+	bool keepalive;
 };
 
 struct error_messages {
@@ -36,8 +42,83 @@ struct error_messages {
 struct error_messages errors[] = {
 	{400, "Bad Request"},
 	{404, "Not Found"},
+	{0, 0},
 };
 
+struct mime_types {
+	char *ext;
+	char *type;
+};
+
+struct mime_types mime_types[] = {
+	{"html", "text/html"},
+	{"htm", "text/html"},
+	{"txt", "text/plain"},
+	{"css", "text/css"},
+	{"js", "application/javascript"},
+	{"json", "application/json"},
+	{"xml", "application/xml"},
+	{"png", "image/png"},
+	{"jpg", "image/jpeg"},
+	{"jpeg", "image/jpeg"},
+	{"gif", "image/gif"},
+	{"svg", "image/svg+xml"},
+	{"ico", "image/x-icon"},
+	{"pdf", "application/pdf"},
+	{0, 0},
+};
+
+// A connection and the response it is sending.
+struct conn {
+	int sock;		// -1 if the slot is free
+	char in[BUFFSIZE];	// Requests received but not yet answered
+	int inlen;
+	bool eof;		// The client has sent all it will
+	bool keepalive;		// Read another request after this response
+	char out[OUTSIZE];	// Response head, or a whole error response
+	int outoff, outlen;
+	struct cached_file *cf;	// Cached file to send from after out, or NULL
+	const char *data;	// What of it to send
+	int dataoff, datalen;
+	int fd;			// File to send after out, or -1
+	off_t foff, fsize;
+};
+
+static struct conn conns[MAXCONNS];
+
+// A file kept in memory, after the head of a keep-alive response for
+// it, so that a keep-alive request for it takes a single write.  It is
+// dropped when evicted, or when a stat shows the file has changed; if
+// connections are still sending it, it is freed after them.
+struct cached_file {
+	char url[128];		// "" once dropped
+	off_t size;
+	uint32_t version;	// st_version of the file when it was read
+	unsigned checked;	// When size and version were last checked
+	unsigned used;		// When last requested
+	int refs;		// Connections sending from data
+	int connoff;		// Offset of the Connection header in data
+	int headlen;		// Bytes of head before the file
+	char *data;		// NULL if the slot is free
+};
+
+static const char keepalive_fin[] = "Connection: keep-alive\r\n\r\n";
+
+static struct cached_file files[NFILES];
+static size_t cache_bytes;
+
+// The head of the response to a GET of url, a file of size bytes, up
+// to the Connection header, which depends on the request.
+struct cached_head {
+	char url[128];		// "" if unused
+	off_t size;
+	int len;
+	char head[256];
+};
+
+static struct cached_head heads[NHEADS];
+static int nexthead;
+
 static void
 die(char *m)
 {
@@ -53,103 +134,206 @@ req_free(struct http_request *req)
 }
 
 static int
-send_header(struct http_request *req, int code)
+strncasecmp(const char *s1, const char *s2, size_t n)
 {
-	struct responce_header *h = headers;
-	while (h->code != 0 && h->header!= 0) {
-		if (h->code == code)
-			break;
-		h++;
-	}
+	int c1, c2;
 
-	if (h->code == 0)
-		return -1;
-
-	int len = strlen(h->header);
-	if (write(req->sock, h->header, len) != len) {
-		die("Failed to send bytes to client");
+	for (; n > 0; n--, s1++, s2++) {
+		c1 = (*s1 >= 'A' && *s1 <= 'Z') ? *s1 - 'A' + 'a' : *s1;
+		c2 = (*s2 >= 'A' && *s2 <= 'Z') ? *s2 - 'A' + 'a' : *s2;
+		if (c1 != c2 || c1 == 0)
+			return c1 - c2;
 	}
-
 	return 0;
 }
 
-static int
-send_data(struct http_request *req, int fd)
+static const char*
+mime_type(const char *file)
 {
-    char buf[1024];
-    int len = 0;
-    int r = read(fd, buf, 1024);
-    while(r > 0){
-        if(write(req->sock, buf, r) != r)
-            die("Failed to send data to client");
-        len += r;
-        r = read(fd, buf, 1024);
-    }
-    return len;
+	const char *ext = NULL;
+	struct mime_types *m;
+
+	for (; *file; file++)
+		if (*file == '.')
+			ext = file + 1;
+		else if (*file == '/')
+			ext = NULL;
+	if (ext)
+		for (m = mime_types; m->ext; m++)
+			if (strncasecmp(ext, m->ext, strlen(m->ext) + 1) == 0)
+				return m->type;
+	return "application/octet-stream";
 }
 
-static int
-send_size(struct http_request *req, off_t size)
+// Find the head for url and size in the cache, or render it there.
+static const struct cached_head *
+file_head(const char *url, off_t size)
 {
-	char buf[64];
-	int r;
-
-	r = snprintf(buf, 64, "Content-Length: %ld\r\n", (long)size);
-	if (r > 63)
+	static struct cached_head uncached;
+	struct cached_head *h;
+	int i;
+
+	for (i = 0; i < NHEADS; i++)
+		if (heads[i].size == size && strcmp(heads[i].url, url) == 0)
+			return &heads[i];
+
+	if (strlen(url) < sizeof(h->url)) {
+		h = &heads[nexthead];
+		nexthead = (nexthead + 1) % NHEADS;
+		strcpy(h->url, url);
+	} else
+		h = &uncached;
+	h->size = size;
+	h->len = snprintf(h->head, sizeof(h->head),
+			  "HTTP/" HTTP_VERSION " 200 OK\r\n"
+			  "Server: jhttpd/" VERSION "\r\n"
+			  "Content-Length: %ld\r\n"
+			  "Content-Type: %s\r\n",
+			  (long) size, mime_type(url));
+	if (h->len >= sizeof(h->head))
 		panic("buffer too small!");
-
-	if (write(req->sock, buf, r) != r)
-		return -1;
-
-	return 0;
+	return h;
 }
 
-static const char*
-mime_type(const char *file)
+static void
+cache_release(struct cached_file *cf)
 {
-	//TODO: for now only a single mime type
-	return "text/html";
+	if (--cf->refs > 0 || cf->url[0] != '\0')
+		return;
+	cache_bytes -= cf->headlen + cf->size;
+	free(cf->data);
+	cf->data = NULL;
 }
 
-static int
-send_content_type(struct http_request *req)
+static void
+cache_drop(struct cached_file *cf)
 {
-	char buf[128];
-	int r;
-	const char *type;
+	cf->url[0] = '\0';
+	cf->refs++;
+	cache_release(cf);
+}
 
-	type = mime_type(req->url);
-	if (!type)
-		return -1;
+// The cached copy of url, if it is still current.
+static struct cached_file *
+cache_lookup(const char *url)
+{
+	struct cached_file *cf;
+	struct Stat st;
+	unsigned now = sys_time_msec();
+	int i;
+
+	for (i = 0; i < NFILES; i++) {
+		cf = &files[i];
+		if (!cf->data || strcmp(cf->url, url) != 0)
+			continue;
+		if (now - cf->checked >= CACHE_CHECK) {
+			if (stat(url, &st) < 0 || st.st_isdir
+			    || st.st_size != cf->size
+			    || st.st_version != cf->version) {
+				cache_drop(cf);
+				return NULL;
+			}
+			cf->checked = now;
+		}
+		cf->used = now;
+		return cf;
+	}
+	return NULL;
+}
 
-	r = snprintf(buf, 128, "Content-Type: %s\r\n", type);
-	if (r > 127)
-		panic("buffer too small!");
+// Read file fd, which is url and has status st, into the cache, evicting
+// the files requested least recently to make room.  Returns NULL if the
+// file is too big, or there is no room that is not in use.
+static struct cached_file *
+cache_fill(const char *url, int fd, struct Stat *st)
+{
+	const struct cached_head *h;
+	struct cached_file *cf, *victim;
+	unsigned now = sys_time_msec();
+	int i, len;
+
+	if (st->st_size > FILE_CACHE_MAX || strlen(url) >= sizeof(cf->url))
+		return NULL;
+	h = file_head(url, st->st_size);
+	len = h->len + sizeof(keepalive_fin) - 1 + st->st_size;
+
+	for (;;) {
+		cf = victim = NULL;
+		for (i = 0; i < NFILES; i++)
+			if (!files[i].data) {
+				if (!cf)
+					cf = &files[i];
+			} else if (files[i].url[0] && files[i].refs == 0
+				   && (!victim || (int) (files[i].used - victim->used) < 0))
+				victim = &files[i];
+		if (cf && cache_bytes + len <= CACHE_BYTES)
+			break;
+		if (!victim)
+			return NULL;
+		cache_drop(victim);
+	}
 
-	if (write(req->sock, buf, r) != r)
-		return -1;
+	if ((cf->data = malloc(len)) == NULL)
+		return NULL;
+	memmove(cf->data, h->head, h->len);
+	memmove(cf->data + h->len, keepalive_fin, sizeof(keepalive_fin) - 1);
+	cf->connoff = h->len;
+	cf->headlen = h->len + sizeof(keepalive_fin) - 1;
+	if (readn(fd, cf->data + cf->headlen, st->st_size) != st->st_size) {
+		free(cf->data);
+		cf->data = NULL;
+		return NULL;
+	}
 
-	return 0;
+	strcpy(cf->url, url);
+	cf->size = st->st_size;
+	cf->version = st->st_version;
+	cf->checked = cf->used = now;
+	cf->refs = 0;
+	cache_bytes += len;
+	return cf;
 }
 
+// The length of the request head at the start of buf, including the
+// empty line that ends it, or 0 if it is not all there yet.
 static int
-send_header_fin(struct http_request *req)
+head_length(const char *buf, int len)
 {
-	const char *fin = "\r\n";
-	int fin_len = strlen(fin);
-
-	if (write(req->sock, fin, fin_len) != fin_len)
-		return -1;
-
+	int i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != '\n')
+			continue;
+		if (i + 1 < len && buf[i + 1] == '\n')
+			return i + 2;
+		if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n')
+			return i + 3;
+	}
 	return 0;
 }
 
+// Copy the n bytes at s into a new string, without a trailing \r.
+static char *
+copy_token(const char *s, int n)
+{
+	char *t;
+
+	if (n > 0 && s[n - 1] == '\r')
+		n--;
+	if ((t = malloc(n + 1)) == NULL)
+		return NULL;
+	memmove(t, s, n);
+	t[n] = '\0';
+	return t;
+}
+
 // given a request, this function creates a struct http_request
 static int
 http_request_parse(struct http_request *req, char *request)
 {
 	const char *url;
 	const char *version;
+	const char *value;
 	int url_len, version_len;
 
 	if (!req)
@@ -161,38 +345,60 @@ http_request_parse(struct http_request *req, char *request)
 	// skip GET
 	request += 4;
 
-	// get the url
+	// get the url, without a query
 	url = request;
-	while (*request && *request != ' ')
+	while (*request && *request != ' ' && *request != '?')
 		request++;
 	url_len = request - url;
+	while (*request && *request != ' ')
+		request++;
 
-	req->url = malloc(url_len + 1);
-	memmove(req->url, url, url_len);
-	req->url[url_len] = '\0';
+	if ((req->url = copy_token(url, url_len)) == NULL)
+		return -E_NO_MEM;
 
 	// skip space
-	request++;
+	if (*request)
+		request++;
 
 	version = request;
 	while (*request && *request != '\n')
 		request++;
 	version_len = request - version;
 
-	req->version = malloc(version_len + 1);
-	memmove(req->version, version, version_len);
-	req->version[version_len] = '\0';
+	if ((req->version = copy_token(version, version_len)) == NULL)
+		return -E_NO_MEM;
+
+	// HTTP/1.1 keeps the connection by default, earlier versions
+	// only when asked to
+	req->keepalive = strcmp(req->version, "HTTP/1.1") == 0;
+
+	// the only header we care about is Connection
+	while (*request) {
+		request++;
+		if (strncasecmp(request, "Connection:", 11) == 0) {
+			value = request + 11;
+			while (*value == ' ' || *value == '\t')
+				value++;
+			if (strncasecmp(value, "close", 5) == 0)
+				req->keepalive = 0;
+			else if (strncasecmp(value, "keep-alive", 10) == 0)
+				req->keepalive = 1;
+		}
+		while (*request && *request != '\n')
+			request++;
+	}
 
 	// no entity parsing
 
 	return 0;
 }
 
-static int
-send_error(struct http_request *req, int code)
+// Make an error page c's response.
+static void
+send_error(struct conn *c, int code)
 {
-	char buf[512];
-	int r;
+	char body[128];
+	int n;
 
 	struct error_messages *e = errors;
 	while (e->code != 0 && e->msg != 0) {
@@ -202,112 +408,261 @@ send_error(struct http_request *req, int code)
 	}
 
 	if (e->code == 0)
-		return -1;
+		panic("no message for error %d", code);
+
+	n = snprintf(body, 128, "<html><body><p>%d - %s</p></body></html>\r\n",
+		     e->code, e->msg);
+	c->outlen = snprintf(c->out, OUTSIZE,
+			     "HTTP/" HTTP_VERSION " %d %s\r\n"
+			     "Server: jhttpd/" VERSION "\r\n"
+			     "Content-Length: %d\r\n"
+			     "Content-Type: text/html\r\n"
+			     "Connection: %s\r\n"
+			     "\r\n"
+			     "%s",
+			     e->code, e->msg, n,
+			     c->keepalive ? "keep-alive" : "close", body);
+	if (c->outlen >= OUTSIZE)
+		panic("buffer too small!");
+	c->outoff = 0;
+}
 
-	r = snprintf(buf, 512, "HTTP/" HTTP_VERSION" %d %s\r\n"
-			       "Server: jhttpd/" VERSION "\r\n"
-			       "Connection: close"
-			       "Content-type: text/html\r\n"
-			       "\r\n"
-			       "<html><body><p>%d - %s</p></body></html>\r\n",
-			       e->code, e->msg, e->code, e->msg);
+// Make cached file cf c's response.
+static void
+send_cached(struct conn *c, struct cached_file *cf)
+{
+	cf->refs++;
+	c->cf = cf;
+	c->dataoff = 0;
+	c->outoff = 0;
+	if (c->keepalive) {
+		c->outlen = 0;
+		c->data = cf->data;
+		c->datalen = cf->headlen + cf->size;
+		return;
+	}
+	memmove(c->out, cf->data, cf->connoff);
+	c->outlen = cf->connoff + snprintf(c->out + cf->connoff,
+					   OUTSIZE - cf->connoff,
+					   "Connection: close\r\n\r\n");
+	c->data = cf->data + cf->headlen;
+	c->datalen = cf->size;
+}
 
-	if (write(req->sock, buf, r) != r)
-		return -1;
+// Make the file req asks for c's response.
+static void
+send_file(struct conn *c, struct http_request *req)
+{
+	const struct cached_head *h;
+	struct cached_file *cf;
+	struct Stat st;
+	int fd, r;
+
+	if ((cf = cache_lookup(req->url)) != NULL) {
+		send_cached(c, cf);
+		return;
+	}
 
-	return 0;
+	// if the file does not exist, or is a directory, send a 404
+	if ((fd = open(req->url, O_RDONLY)) < 0) {
+		send_error(c, 404);
+		return;
+	}
+	if ((r = fstat(fd, &st)) < 0 || st.st_isdir) {
+		close(fd);
+		send_error(c, 404);
+		return;
+	}
+
+	if ((cf = cache_fill(req->url, fd, &st)) != NULL) {
+		close(fd);
+		send_cached(c, cf);
+		return;
+	}
+
+	h = file_head(req->url, st.st_size);
+	memmove(c->out, h->head, h->len);
+	c->outlen = h->len + snprintf(c->out + h->len, OUTSIZE - h->len,
+				      "Connection: %s\r\n\r\n",
+				      c->keepalive ? "keep-alive" : "close");
+	c->outoff = 0;
+	c->fd = fd;
+	c->foff = 0;
+	c->fsize = st.st_size;
 }
 
+// Send what the socket takes of c's response.  Returns 1 once all of it
+// is sent, 0 if the socket is full, < 0 if the client is gone.
 static int
-send_file(struct http_request *req)
+conn_flush(struct conn *c)
 {
 	int r;
-	off_t file_size = -1;
-	int fd;
-
-	// open the requested url for reading
-	// if the file does not exist, send a 404 error using send_error
-	// if the file is a directory, send a 404 error using send_error
-	// set file_size to the size of the file
-    struct Stat stat_buf;
-    if(r = stat(req -> url, &stat_buf), r < 0){
-        send_error(req, 404);
-        return r;
-    }
-    if(stat_buf.st_isdir){
-        send_error(req, 404);
-        return r;
-    }
-    fd = open(req -> url, O_RDONLY);
-    if(fd < 0){
-        send_error(req, 404);
-        return fd;
-    }
-    file_size = stat_buf.st_size;
-
-	if ((r = send_header(req, 200)) < 0)
-		goto end;
-
-	if ((r = send_size(req, file_size)) < 0)
-		goto end;
-
-	if ((r = send_content_type(req)) < 0)
-		goto end;
-
-	if ((r = send_header_fin(req)) < 0)
-		goto end;
-
-	r = send_data(req, fd);
-
-end:
-	close(fd);
-	return r;
+
+	while (c->outoff < c->outlen) {
+		r = write(c->sock, c->out + c->outoff, c->outlen - c->outoff);
+		if (r == -E_AGAIN)
+			return 0;
+		if (r <= 0)
+			return -1;
+		c->outoff += r;
+	}
+	while (c->cf && c->dataoff < c->datalen) {
+		r = write(c->sock, c->data + c->dataoff, c->datalen - c->dataoff);
+		if (r == -E_AGAIN)
+			return 0;
+		if (r <= 0)
+			return -1;
+		c->dataoff += r;
+	}
+	if (c->cf) {
+		cache_release(c->cf);
+		c->cf = NULL;
+	}
+	while (c->fd >= 0 && c->foff < c->fsize) {
+		// the file server's pages go to ns without a copy
+		r = sendfile(c->sock, c->fd, c->foff, c->fsize - c->foff);
+		if (r == -E_AGAIN)
+			return 0;
+		// a file that shrank under us cannot fill the response
+		if (r <= 0)
+			return -1;
+		c->foff += r;
+	}
+	if (c->fd >= 0) {
+		close(c->fd);
+		c->fd = -1;
+	}
+	return 1;
 }
 
-static void
-handle_client(int sock)
+// Answer the requests c has received, in order, for as long as the
+// socket takes the responses.  Returns < 0 once c should be closed.
+static int
+conn_serve(struct conn *c)
 {
-	struct http_request con_d;
-	int r;
-	char buffer[BUFFSIZE];
-	int received = -1;
-	struct http_request *req = &con_d;
+	struct http_request req;
+	int r, n;
+
+	for (;;) {
+		if ((r = conn_flush(c)) <= 0)
+			return r;
+		if (!c->keepalive)
+			return -1;
+
+		// some clients end a request with an extra empty line
+		for (n = 0; n < c->inlen && (c->in[n] == '\r' || c->in[n] == '\n'); n++)
+			;
+		c->inlen -= n;
+		memmove(c->in, c->in + n, c->inlen);
+
+		if ((n = head_length(c->in, c->inlen)) == 0) {
+			if (c->eof)
+				return -1;
+			if (c->inlen < BUFFSIZE)
+				return 0;
+			// a request head that does not fit
+			c->keepalive = 0;
+			send_error(c, 400);
+			continue;
+		}
 
-	while (1)
-	{
-		// Receive message
-		if ((received = read(sock, buffer, BUFFSIZE)) < 0)
-			panic("failed to read");
+		c->in[n - 1] = '\0';
+		memset(&req, 0, sizeof(req));
+		req.sock = c->sock;
+		r = http_request_parse(&req, c->in);
+		if (r == -E_BAD_REQ) {
+			c->keepalive = 0;
+			send_error(c, 400);
+		} else if (r < 0)
+			panic("parse failed: %e", r);
+		else {
+			c->keepalive = req.keepalive;
+			send_file(c, &req);
+		}
+		req_free(&req);
 
-		memset(req, 0, sizeof(*req));
+		c->inlen -= n;
+		memmove(c->in, c->in + n, c->inlen);
+	}
+}
 
-		req->sock = sock;
+// Take in what c's client has sent.
+static void
+conn_read(struct conn *c)
+{
+	int r;
 
-		r = http_request_parse(req, buffer);
-		if (r == -E_BAD_REQ)
-			send_error(req, 400);
-		else if (r < 0)
-			panic("parse failed");
-		else
-			send_file(req);
+	while (c->inlen < BUFFSIZE) {
+		r = read(c->sock, c->in + c->inlen, BUFFSIZE - c->inlen);
+		if (r == -E_AGAIN)
+			return;
+		if (r <= 0) {
+			c->eof = 1;
+			return;
+		}
+		c->inlen += r;
+	}
+}
 
-		req_free(req);
+static void
+conn_close(struct conn *c)
+{
+	if (c->cf)
+		cache_release(c->cf);
+	if (c->fd >= 0)
+		close(c->fd);
+	close(c->sock);
+	c->sock = -1;
+}
 
-		// no keep alive
-		break;
+// Accept the pending connections there are free slots for.
+static void
+conn_accept(int serversock)
+{
+	struct sockaddr_in client;
+	unsigned int clientlen;
+	struct conn *c;
+	int i, sock;
+
+	for (i = 0; i < MAXCONNS; i++) {
+		c = &conns[i];
+		if (c->sock >= 0)
+			continue;
+
+		clientlen = sizeof(client);
+		sock = accept(serversock, (struct sockaddr *) &client,
+			      &clientlen);
+		if (sock == -E_AGAIN)
+			return;
+		if (sock < 0)
+			die("Failed to accept client connection");
+		if (fcntl(sock, F_SETFL, O_NONBLOCK) < 0)
+			die("Failed to make a client socket non-blocking");
+
+		c->sock = sock;
+		c->inlen = 0;
+		c->eof = 0;
+		c->keepalive = 1;
+		c->outoff = c->outlen = 0;
+		c->cf = NULL;
+		c->fd = -1;
 	}
-
-	close(sock);
 }
 
 void
 umain(int argc, char **argv)
 {
-	int serversock, clientsock;
-	struct sockaddr_in server, client;
+	struct pollfd fds[MAXCONNS + 1];
+	struct conn *fdconn[MAXCONNS + 1];
+	struct sockaddr_in server;
+	struct conn *c;
+	int serversock, nfds, nfree, i, r;
 
 	binaryname = "jhttpd";
 
+	for (i = 0; i < MAXCONNS; i++)
+		conns[i].sock = -1;
+
 	// Create the TCP socket
 	if ((serversock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
 		die("Failed to create socket");
@@ -328,19 +683,46 @@ umain(int argc, char **argv)
 	// Listen on the server socket
 	if (listen(serversock, MAXPENDING) < 0)
 		die("Failed to listen on server socket");
+	if (fcntl(serversock, F_SETFL, O_NONBLOCK) < 0)
+		die("Failed to make the server socket non-blocking");
 
 	cprintf("Waiting for http connections...\n");
 
 	while (1) {
-		unsigned int clientlen = sizeof(client);
-		// Wait for client connection
-		if ((clientsock = accept(serversock,
-					 (struct sockaddr *) &client,
-					 &clientlen)) < 0)
-		{
-			die("Failed to accept client connection");
+		// Wait for something to send or read on a connection,
+		// or for a new connection if there is room for it
+		nfds = 1;
+		nfree = 0;
+		for (i = 0; i < MAXCONNS; i++) {
+			c = &conns[i];
+			if (c->sock < 0) {
+				nfree++;
+				continue;
+			}
+			fds[nfds].fd = c->sock;
+			if (c->outoff < c->outlen || c->cf || c->fd >= 0)
+				fds[nfds].events = POLLOUT;
+			else
+				fds[nfds].events = POLLIN;
+			fdconn[nfds++] = c;
+		}
+		fds[0].fd = serversock;
+		fds[0].events = nfree ? POLLIN : 0;
+
+		if ((r = poll(fds, nfds, -1)) < 0)
+			panic("poll: %e", r);
+
+		for (i = 1; i < nfds; i++) {
+			c = fdconn[i];
+			if (!fds[i].revents)
+				continue;
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				conn_read(c);
+			if (conn_serve(c) < 0)
+				conn_close(c);
 		}
-		handle_client(clientsock);
+		if (fds[0].revents & POLLIN)
+			conn_accept(serversock);
 	}
 
 	close(serversock);
@@ -0,0 +1,85 @@
+// Print the network server's protocol counters and memory pool use.
+// A pool whose max reaches avail, or with failed allocations (err), is
+// too small for the load it has seen.  A pool with no avail has no
+// fixed size.
+
+#include <inc/lib.h>
+
+int flag[256];
+
+void
+usage(void)
+{
+	printf("usage: netstat [-mp]\n");
+	exit();
+}
+
+void
+print_protos(struct Nsret_stats *st)
+{
+	struct ns_proto_stats *ps;
+	int i;
+
+	printf("%-8s %10s %10s %8s %8s %8s %8s\n", "proto", "xmit", "recv",
+	       "drop", "chkerr", "memerr", "err");
+	for (i = 0; i < st->ret_nprotos; i++) {
+		ps = &st->ret_protos[i];
+		printf("%-8s %10u %10u %8u %8u %8u %8u\n", ps->ps_name,
+		       ps->ps_xmit, ps->ps_recv, ps->ps_drop, ps->ps_chkerr,
+		       ps->ps_memerr, ps->ps_lenerr + ps->ps_rterr +
+		       ps->ps_proterr + ps->ps_opterr + ps->ps_err);
+	}
+}
+
+void
+print_mems(struct Nsret_stats *st)
+{
+	struct ns_mem_stats *ms;
+	int i;
+
+	printf("%-16s %8s %8s %8s %8s\n", "pool", "avail", "used", "max",
+	       "err");
+	for (i = 0; i < st->ret_nmems; i++) {
+		ms = &st->ret_mems[i];
+		printf("%-16s %8u %8u %8u %8u%s\n", ms->ms_name, ms->ms_avail,
+		       ms->ms_used, ms->ms_max, ms->ms_err,
+		       ms->ms_err || (ms->ms_avail
+				      && ms->ms_max >= ms->ms_avail) ? " !" : "");
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Nsret_stats st;
+	struct Argstate args;
+	int i, r;
+
+	argstart(&argc, argv, &args);
+	while ((i = argnext(&args)) >= 0)
+		switch (i) {
+		case 'm':
+		case 'p':
+			flag[i]++;
+			break;
+		default:
+			usage();
+		}
+	if (argc != 1)
+		usage();
+	if (!flag['m'] && !flag['p'])
+		flag['m'] = flag['p'] = 1;
+
+	if ((r = nsipc_stats(&st)) < 0)
+		panic("nsipc_stats: %e", r);
+
+	printf("tcp: mss %u, window %u (scale %u), send buffer %u\n",
+	       st.ret_tcp_mss, st.ret_tcp_wnd, st.ret_tcp_rcv_scale,
+	       st.ret_tcp_snd_buf);
+	if (flag['p'])
+		print_protos(&st);
+	if (flag['p'] && flag['m'])
+		printf("\n");
+	if (flag['m'])
+		print_mems(&st);
+}
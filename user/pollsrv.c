@@ -0,0 +1,82 @@
+// Echo server like echosrv, but a single environment serves every
+// client at once, multiplexing the sockets with poll().
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define PORT 7
+
+#define BUFFSIZE 512
+#define MAXPENDING 5    // Max connection requests
+#define MAXCLIENTS 16
+
+static void
+die(char *m)
+{
+	cprintf("%s\n", m);
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct pollfd fds[MAXCLIENTS + 1];
+	struct sockaddr_in echoserver, echoclient;
+	char buffer[BUFFSIZE];
+	unsigned int clientlen;
+	int serversock, sock, nfds, i, n;
+
+	binaryname = "pollsrv";
+
+	if ((serversock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("Failed to create socket");
+
+	memset(&echoserver, 0, sizeof(echoserver));
+	echoserver.sin_family = AF_INET;
+	echoserver.sin_addr.s_addr = htonl(INADDR_ANY);
+	echoserver.sin_port = htons(PORT);
+	if (bind(serversock, (struct sockaddr *) &echoserver,
+		 sizeof(echoserver)) < 0)
+		die("Failed to bind the server socket");
+	if (listen(serversock, MAXPENDING) < 0)
+		die("Failed to listen on server socket");
+
+	cprintf("bound\n");
+
+	fds[0].fd = serversock;
+	fds[0].events = POLLIN;
+	nfds = 1;
+
+	while (1) {
+		if ((n = poll(fds, nfds, -1)) < 0)
+			panic("poll: %e", n);
+
+		for (i = 1; i < nfds; i++) {
+			if (!fds[i].revents)
+				continue;
+			n = read(fds[i].fd, buffer, BUFFSIZE);
+			if (n <= 0 || write(fds[i].fd, buffer, n) != n) {
+				close(fds[i].fd);
+				fds[i--] = fds[--nfds];
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			clientlen = sizeof(echoclient);
+			if ((sock = accept(serversock,
+					   (struct sockaddr *) &echoclient,
+					   &clientlen)) < 0)
+				die("Failed to accept client connection");
+			if (nfds == MAXCLIENTS + 1) {
+				close(sock);
+				continue;
+			}
+			cprintf("Client connected: %s\n",
+				inet_ntoa(echoclient.sin_addr));
+			fds[nfds].fd = sock;
+			fds[nfds].events = POLLIN;
+			nfds++;
+		}
+	}
+}